@@ -0,0 +1,227 @@
+// Author :     Faris Nassif
+// Module :     Theory Of Algorithms
+// Summary:     Compile time MD5 and SHA-256 for C++17 and later
+
+#ifndef DIGEST_HPP
+#define DIGEST_HPP
+
+#include <array>       // Digests are returned by value
+#include <cstddef>     // size_t
+#include <cstdint>     // Req for uint(x) unsigned int
+#include <string_view> // constexpr view of a string literal
+#include "digest_tables.h" // Round constants and initial values, shared with md5.c and sha.c
+#if __cplusplus >= 202002L
+#include <type_traits> // std::is_constant_evaluated
+#endif
+
+/*
+    Usage:
+
+        constexpr auto id = digest::md5("literal");      // computed by the compiler
+        constexpr auto h  = digest::sha256("literal");
+
+    Both take a std::string_view and return the digest bytes in the usual order
+    (the order md5.exe and sha256sum print them in). In a constant expression
+    the whole hash, padding included, is done by the compiler and nothing is
+    left for startup.
+
+    Called at run time the same functions go to the fast kernels when they are
+    linked in, define DIGEST_MD5_KERNELS and link md5.c built with
+    -DMD5_NO_MAIN, and/or DIGEST_SHA256_KERNELS and sha.c built with
+    -DSHA_NO_MAIN (one of the two per program, they share some helper names).
+    Otherwise the portable constexpr code runs at run time too. The
+    (data, len) overloads are run time only and hash any bytes.
+*/
+#if defined(DIGEST_MD5_KERNELS)
+extern "C" void md5_buffer(const void *data, size_t len, uint32_t *MD5_RES);
+#endif
+#if defined(DIGEST_SHA256_KERNELS)
+extern "C" void sha256_buffer(const void *data, size_t len, uint8_t digest[32]);
+#endif
+
+namespace digest {
+
+using md5_digest = std::array<uint8_t, 16>;
+using sha256_digest = std::array<uint8_t, 32>;
+
+namespace detail {
+
+/* True while the compiler is evaluating a constant expression */
+constexpr bool constant_evaluated() {
+#if __cplusplus >= 202002L
+    return std::is_constant_evaluated();
+#elif defined(__GNUC__) || defined(__clang__)
+    return __builtin_is_constant_evaluated();
+#else
+    return true;
+#endif
+}
+
+/* ------------------------------ Tables ------------------------------
+* The initializer lists md5.c and sha.c build their const arrays from, as
+* constexpr arrays here */
+constexpr uint32_t MM[64] = MD5_MM_INIT;
+constexpr uint32_t S[64] = MD5_S_INIT;
+constexpr uint32_t T[64] = MD5_T_INIT;
+constexpr uint32_t MD5_IV[4] = { MD5_IV_A, MD5_IV_B, MD5_IV_C, MD5_IV_D };
+constexpr uint32_t K[64] = SHA256_K_INIT;
+constexpr uint32_t H0[8] = SHA256_H0_INIT;
+
+constexpr uint32_t rotl(uint32_t x, uint32_t n) { return (x << n) | (x >> (32 - n)); }
+constexpr uint32_t rotr(uint32_t x, uint32_t n) { return (x >> n) | (x << (32 - n)); }
+
+/* Byte (i) of the message, or of its padding once (i) runs past the end */
+struct padded {
+    std::string_view s;
+    size_t total; // Padded length, a multiple of 64
+    bool big_endian; // Which order the length in bits is stored in
+
+    constexpr uint8_t operator[](size_t i) const {
+        if (i < s.size()) {
+            return static_cast<uint8_t>(s[i]);
+        }
+        if (i == s.size()) {
+            return 0x80;
+        }
+        if (i < total - 8) {
+            return 0;
+        }
+        uint64_t bits = static_cast<uint64_t>(s.size()) * 8;
+        size_t k = i - (total - 8); // 0 .. 7
+        return static_cast<uint8_t>(bits >> (big_endian ? 8 * (7 - k) : 8 * k));
+    }
+};
+
+/* Room for the message, the 0x80 byte and 8 length bytes, rounded up to a whole block */
+constexpr size_t padded_length(size_t len) { return (len + 8) / 64 * 64 + 64; }
+
+/* ------------------------- constexpr MD5 -----------------------------
+* The table driven loop of md5_reference(), over the padded message */
+constexpr md5_digest md5(std::string_view s) {
+    const padded M{s, padded_length(s.size()), false};
+    uint32_t res[4] = { MD5_IV[0], MD5_IV[1], MD5_IV[2], MD5_IV[3] };
+
+    for (size_t block = 0; block < M.total; block += 64) {
+        uint32_t X[16] = {};
+        for (size_t w = 0; w < 16; w++) {
+            for (size_t b = 0; b < 4; b++) {
+                X[w] |= static_cast<uint32_t>(M[block + 4 * w + b]) << (8 * b);
+            }
+        }
+
+        uint32_t a = res[0], b = res[1], c = res[2], d = res[3];
+        for (size_t i = 0; i < 64; i++) {
+            uint32_t f = 0;
+            switch (i / 16) {
+                case 0: f = (b & c) | (~b & d); break;
+                case 1: f = (b & d) | (c & ~d); break;
+                case 2: f = b ^ c ^ d; break;
+                default: f = c ^ (b | ~d); break;
+            }
+            uint32_t t = d;
+            d = c;
+            c = b;
+            b = b + rotl(a + f + X[MM[i]] + T[i], S[i]);
+            a = t;
+        }
+        res[0] += a;
+        res[1] += b;
+        res[2] += c;
+        res[3] += d;
+    }
+
+    md5_digest out{};
+    for (size_t i = 0; i < 16; i++) {
+        out[i] = static_cast<uint8_t>(res[i / 4] >> (8 * (i % 4)));
+    }
+    return out;
+}
+
+/* ----------------------- constexpr SHA-256 ---------------------------
+* nexthash() from sha.c over the padded message, Section 6.2.2 */
+constexpr sha256_digest sha256(std::string_view s) {
+    const padded M{s, padded_length(s.size()), true};
+    uint32_t H[8] = { H0[0], H0[1], H0[2], H0[3], H0[4], H0[5], H0[6], H0[7] };
+
+    for (size_t block = 0; block < M.total; block += 64) {
+        uint32_t W[64] = {};
+        for (size_t t = 0; t < 16; t++) {
+            for (size_t b = 0; b < 4; b++) {
+                W[t] |= static_cast<uint32_t>(M[block + 4 * t + b]) << (24 - 8 * b);
+            }
+        }
+        for (size_t t = 16; t < 64; t++) {
+            uint32_t s0 = rotr(W[t - 15], 7) ^ rotr(W[t - 15], 18) ^ (W[t - 15] >> 3);
+            uint32_t s1 = rotr(W[t - 2], 17) ^ rotr(W[t - 2], 19) ^ (W[t - 2] >> 10);
+            W[t] = s1 + W[t - 7] + s0 + W[t - 16];
+        }
+
+        uint32_t a = H[0], b = H[1], c = H[2], d = H[3], e = H[4], f = H[5], g = H[6], h = H[7];
+        for (size_t t = 0; t < 64; t++) {
+            uint32_t T1 = h + (rotr(e, 6) ^ rotr(e, 11) ^ rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[t] + W[t];
+            uint32_t T2 = (rotr(a, 2) ^ rotr(a, 13) ^ rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+            h = g;
+            g = f;
+            f = e;
+            e = d + T1;
+            d = c;
+            c = b;
+            b = a;
+            a = T1 + T2;
+        }
+        H[0] += a; H[1] += b; H[2] += c; H[3] += d;
+        H[4] += e; H[5] += f; H[6] += g; H[7] += h;
+    }
+
+    sha256_digest out{};
+    for (size_t i = 0; i < 32; i++) {
+        out[i] = static_cast<uint8_t>(H[i / 4] >> (24 - 8 * (i % 4)));
+    }
+    return out;
+}
+
+} // namespace detail
+
+/* --------------------------- Run Time Only --------------------------- */
+inline md5_digest md5(const void *data, size_t len) {
+#if defined(DIGEST_MD5_KERNELS)
+    uint32_t res[4];
+    md5_digest out{};
+    ::md5_buffer(data, len, res);
+    for (size_t i = 0; i < 16; i++) {
+        out[i] = static_cast<uint8_t>(res[i / 4] >> (8 * (i % 4)));
+    }
+    return out;
+#else
+    return detail::md5(std::string_view(static_cast<const char *>(data), len));
+#endif
+}
+
+inline sha256_digest sha256(const void *data, size_t len) {
+#if defined(DIGEST_SHA256_KERNELS)
+    sha256_digest out{};
+    ::sha256_buffer(data, len, out.data());
+    return out;
+#else
+    return detail::sha256(std::string_view(static_cast<const char *>(data), len));
+#endif
+}
+
+/* ------------------ Compile Time, or Fast at Run Time ---------------- */
+constexpr md5_digest md5(std::string_view s) {
+    if (detail::constant_evaluated()) {
+        return detail::md5(s);
+    }
+    return md5(s.data(), s.size());
+}
+
+constexpr sha256_digest sha256(std::string_view s) {
+    if (detail::constant_evaluated()) {
+        return detail::sha256(s);
+    }
+    return sha256(s.data(), s.size());
+}
+
+} // namespace digest
+
+#endif
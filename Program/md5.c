@@ -3,11 +3,38 @@
 // Summary:     A program that executes a MD5 Hash on a given input
 //              This program has been adapted based on the process outlined in https://tools.ietf.org/html/rfc1321
 
+#if defined(__linux__)
+#define _GNU_SOURCE   // F_SETPIPE_SZ, to read standard input in bigger pieces
+#endif
+
 #include <stdlib.h>   // For additional getopt() functionality
 #include <stdio.h>    // Input/Output
 #include <stdint.h>   // Req for uint(x) unsigned int
 #include <inttypes.h> // Includes formatters for output
 #include <getopt.h>   // Command line argument functionality
+#include <string.h>   // memcpy/memset for the bulk block functions
+#include "digest_tables.h" // MM, S, T and A .. D, shared with digest.hpp
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/mman.h> // mmap/madvise for hashing files in place
+#include <sys/stat.h> // fstat, to only map regular files
+#include <fcntl.h>    // posix_fadvise
+#include <unistd.h>   // pread
+#include <errno.h>    // EINTR
+#include <pthread.h>  // Read-ahead thread and worker pool
+#include <stdatomic.h> // Lock free work queues
+#include <time.h>     // nanosleep
+#include <dirent.h>   // DT_* entry types
+#include <sys/syscall.h> // getdents64, perf_event_open
+#define MD5_HAVE_MMAP
+#define MD5_HAVE_PTHREAD
+#endif
+
+#if defined(__linux__)
+#include <linux/perf_event.h> // Hardware counters for --bench --perf
+#include <sys/ioctl.h>        // PERF_EVENT_IOC_*
+#define MD5_HAVE_PERF
+#endif
 
 /* 
     https://tools.ietf.org/html/rfc1321 => Page 2
@@ -23,6 +50,13 @@
 */
 #define ROTL(x, n) (((x) << (n)) | ((x) >> (32 - (n))))
 
+/*
+    [Load Function]
+    =>  Reads a host order Word from (p), which doesn't need to be aligned.
+    =>  The fixed size memcpy compiles down to a single load
+*/
+static inline WORD LOAD32(const BYTE *p) { WORD w; memcpy(&w, p, 4); return w; }
+
 /* 
     https://tools.ietf.org/html/rfc1321 => Page 4
     http://www.boblandstrom.com/the-md5-hashing-algorithm/
@@ -49,6 +83,109 @@
 #define HH(a,b,c,d,m,s,t) { a += H(b,c,d) + m + t; a = b + ROTL(a,s); }
 #define II(a,b,c,d,m,s,t) { a += I(b,c,d) + m + t; a = b + ROTL(a,s); }
 
+/*
+    [STEP_F, STEP_G, STEP_H, STEP_I] => Same transformations as above, rearranged
+    for the unrolled md5() kernel so as little as possible waits on (b), which is
+    the value produced by the previous step.
+
+    The message word and constant are added to (a) first since they're known early.
+    F is computed as ((c ^ d) & b) ^ d, one operation shorter than the textbook form.
+    G is split into (~d & c) + (d & b), the two halves never share a set bit so the
+    OR can be an add, and the (~d & c) half can be added in before (b) is ready.
+    I only needs (b | ~d), where ~d is already available.
+*/
+#define STEP_F(a,b,c,d,m,s,t) { a += (m) + (t); a += (((c) ^ (d)) & (b)) ^ (d); a = (b) + ROTL(a,s); }
+#define STEP_G(a,b,c,d,m,s,t) { a += (m) + (t); a += ~(d) & (c); a += (d) & (b); a = (b) + ROTL(a,s); }
+#define STEP_H(a,b,c,d,m,s,t) { a += (m) + (t); a += (b) ^ (c) ^ (d); a = (b) + ROTL(a,s); }
+#define STEP_I(a,b,c,d,m,s,t) { a += (m) + (t); a += (c) ^ ((b) | ~(d)); a = (b) + ROTL(a,s); }
+
+/*
+    All 64 steps of the compression function in order, written once and expanded
+    by each kernel with its own step macros. (a, b, c, d) are the working registers
+    and X0 .. X15 the sixteen message words, which the kernel has to have in scope.
+    Word order, shift amounts and constants match the MM, S and T tables below.
+    The rounds are separate macros so a kernel can stop before the last three
+    steps, after which (a) already holds the first digest word, and round 1 puts
+    L_(n) before step n, which a kernel can make a case label to start part way.
+*/
+#define MD5_ROUND1(F_, L_)                      \
+    L_(0)  F_(a, b, c, d, X0 ,  7, 0xd76aa478U); \
+    L_(1)  F_(d, a, b, c, X1 , 12, 0xe8c7b756U); \
+    L_(2)  F_(c, d, a, b, X2 , 17, 0x242070dbU); \
+    L_(3)  F_(b, c, d, a, X3 , 22, 0xc1bdceeeU); \
+    L_(4)  F_(a, b, c, d, X4 ,  7, 0xf57c0fafU); \
+    L_(5)  F_(d, a, b, c, X5 , 12, 0x4787c62aU); \
+    L_(6)  F_(c, d, a, b, X6 , 17, 0xa8304613U); \
+    L_(7)  F_(b, c, d, a, X7 , 22, 0xfd469501U); \
+    L_(8)  F_(a, b, c, d, X8 ,  7, 0x698098d8U); \
+    L_(9)  F_(d, a, b, c, X9 , 12, 0x8b44f7afU); \
+    L_(10) F_(c, d, a, b, X10, 17, 0xffff5bb1U); \
+    L_(11) F_(b, c, d, a, X11, 22, 0x895cd7beU); \
+    L_(12) F_(a, b, c, d, X12,  7, 0x6b901122U); \
+    L_(13) F_(d, a, b, c, X13, 12, 0xfd987193U); \
+    L_(14) F_(c, d, a, b, X14, 17, 0xa679438eU); \
+    L_(15) F_(b, c, d, a, X15, 22, 0x49b40821U);
+
+#define MD5_ROUND2(G_)                          \
+    G_(a, b, c, d, X1 ,  5, 0xf61e2562U);       \
+    G_(d, a, b, c, X6 ,  9, 0xc040b340U);       \
+    G_(c, d, a, b, X11, 14, 0x265e5a51U);       \
+    G_(b, c, d, a, X0 , 20, 0xe9b6c7aaU);       \
+    G_(a, b, c, d, X5 ,  5, 0xd62f105dU);       \
+    G_(d, a, b, c, X10,  9, 0x02441453U);       \
+    G_(c, d, a, b, X15, 14, 0xd8a1e681U);       \
+    G_(b, c, d, a, X4 , 20, 0xe7d3fbc8U);       \
+    G_(a, b, c, d, X9 ,  5, 0x21e1cde6U);       \
+    G_(d, a, b, c, X14,  9, 0xc33707d6U);       \
+    G_(c, d, a, b, X3 , 14, 0xf4d50d87U);       \
+    G_(b, c, d, a, X8 , 20, 0x455a14edU);       \
+    G_(a, b, c, d, X13,  5, 0xa9e3e905U);       \
+    G_(d, a, b, c, X2 ,  9, 0xfcefa3f8U);       \
+    G_(c, d, a, b, X7 , 14, 0x676f02d9U);       \
+    G_(b, c, d, a, X12, 20, 0x8d2a4c8aU);
+
+#define MD5_ROUND3(H_)                          \
+    H_(a, b, c, d, X5 ,  4, 0xfffa3942U);       \
+    H_(d, a, b, c, X8 , 11, 0x8771f681U);       \
+    H_(c, d, a, b, X11, 16, 0x6d9d6122U);       \
+    H_(b, c, d, a, X14, 23, 0xfde5380cU);       \
+    H_(a, b, c, d, X1 ,  4, 0xa4beea44U);       \
+    H_(d, a, b, c, X4 , 11, 0x4bdecfa9U);       \
+    H_(c, d, a, b, X7 , 16, 0xf6bb4b60U);       \
+    H_(b, c, d, a, X10, 23, 0xbebfbc70U);       \
+    H_(a, b, c, d, X13,  4, 0x289b7ec6U);       \
+    H_(d, a, b, c, X0 , 11, 0xeaa127faU);       \
+    H_(c, d, a, b, X3 , 16, 0xd4ef3085U);       \
+    H_(b, c, d, a, X6 , 23, 0x04881d05U);       \
+    H_(a, b, c, d, X9 ,  4, 0xd9d4d039U);       \
+    H_(d, a, b, c, X12, 11, 0xe6db99e5U);       \
+    H_(c, d, a, b, X15, 16, 0x1fa27cf8U);       \
+    H_(b, c, d, a, X2 , 23, 0xc4ac5665U);
+
+#define MD5_ROUND4(I_)                          \
+    I_(a, b, c, d, X0 ,  6, 0xf4292244U);       \
+    I_(d, a, b, c, X7 , 10, 0x432aff97U);       \
+    I_(c, d, a, b, X14, 15, 0xab9423a7U);       \
+    I_(b, c, d, a, X5 , 21, 0xfc93a039U);       \
+    I_(a, b, c, d, X12,  6, 0x655b59c3U);       \
+    I_(d, a, b, c, X3 , 10, 0x8f0ccc92U);       \
+    I_(c, d, a, b, X10, 15, 0xffeff47dU);       \
+    I_(b, c, d, a, X1 , 21, 0x85845dd1U);       \
+    I_(a, b, c, d, X8 ,  6, 0x6fa87e4fU);       \
+    I_(d, a, b, c, X15, 10, 0xfe2ce6e0U);       \
+    I_(c, d, a, b, X6 , 15, 0xa3014314U);       \
+    I_(b, c, d, a, X13, 21, 0x4e0811a1U);       \
+    I_(a, b, c, d, X4 ,  6, 0xf7537e82U);
+
+#define MD5_ROUND4_LAST(I_)                     \
+    I_(d, a, b, c, X11, 10, 0xbd3af235U);       \
+    I_(c, d, a, b, X2 , 15, 0x2ad7d2bbU);       \
+    I_(b, c, d, a, X9 , 21, 0xeb86d391U);
+
+#define MD5_NO_LABEL(n)
+#define MD5_STEPS(F_, G_, H_, I_) \
+    MD5_ROUND1(F_, MD5_NO_LABEL) MD5_ROUND2(G_) MD5_ROUND3(H_) MD5_ROUND4(I_) MD5_ROUND4_LAST(I_)
+
 /* 
     The four constant arrays below [AA, BB, CC, DD] represent 
     the first four paramaters for the above transformation functions.
@@ -94,12 +231,7 @@ const WORD DD[] = {
     Fifth paramater for the transformation functions.
     MM being the index of the uint32_t block that needs to be accessed
 */
-const WORD MM[] = {
-    0, 1,  2,  3,  4,  5,  6,  7,  8,  9, 10, 11, 12, 13, 14, 15,
-    1, 6, 11,  0,  5, 10, 15,  4,  9, 14,  3,  8, 13,  2,  7, 12,
-    5, 8, 11, 14,  1,  4,  7, 10, 13,  0,  3,  6,  9, 12, 15,  2,
-    0, 7, 14,  5, 12,  3, 10,  1,  8, 15,  6, 13,  4, 11,  2,  9
-};
+const WORD MM[] = MD5_MM_INIT;
 
 /* 
     Sixth paramater for the transformation functions.
@@ -108,12 +240,7 @@ const WORD MM[] = {
     Predefined constants for the MD5 Transform routine
     Specifies the per-round shift amounts
 */
-const WORD S[] = {
-    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
-    5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
-    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
-    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21
-};
+const WORD S[] = MD5_S_INIT;
 
 /*
     Seventh and final paramater for the transformation functions.
@@ -122,35 +249,18 @@ const WORD S[] = {
     Predefined hashing constants required for MD5
     Integer part of the sines of integers (in radians) * 2^32
 */
-const WORD T[] = {
-    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee,
-    0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
-    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be,
-    0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
-    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa,
-    0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
-    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed,
-    0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
-    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c,
-    0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
-    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05,
-    0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
-    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039,
-    0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
-    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1,
-    0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391
-};
+const WORD T[] = MD5_T_INIT;
 
 /* 
     https://tools.ietf.org/html/rfc1321 => Page 4
 
     Four 'Word' buffer initialized with hex values used in the Message Digest computation.
-    These will be manipulated on each round of the MD5 hash.
+    Each hash copies these into its own state which is then manipulated on each round.
 */
-WORD A = 0x67452301;
-WORD B = 0xefcdab89;
-WORD C = 0x98badcfe;
-WORD D = 0x10325476;
+const WORD A = MD5_IV_A;
+const WORD B = MD5_IV_B;
+const WORD C = MD5_IV_C;
+const WORD D = MD5_IV_D;
 
 /*
     All union members will share the same memory location
@@ -178,12 +288,109 @@ typedef enum {
     FINISH 
 } PADFLAG;
 
+/* ---------------------------- Statistics ----------------------------- 
+* --stats shows where a run's time goes. Each thread counts into its own
+* thread local MD5_STATS, so counting needs no atomics or locks, and hands
+* its totals over with md5_stats_flush() when it finishes. They're printed
+* per thread and summed when the program exits. With --stats off every hook
+* is one predictable branch on stats_enabled and the clock is never read */
+typedef struct {
+    const char *thread;   // "main", "worker" or "reader"
+    uint64_t bytes_read;  // Message bytes read or mapped
+    uint64_t read_calls;  // fread/read/pread/mmap calls
+    uint64_t blocks;      // Blocks compressed, one per lane for the multi-lane kernels
+    uint64_t pad_blocks;  // How many of those were padding blocks
+    uint64_t io_ns;       // Opening and reading, or waiting on the read-ahead thread
+    uint64_t compress_ns; // In the compression function
+    uint64_t output_ns;   // Formatting and printing digests
+} MD5_STATS;
+
+int stats_enabled = 0;
+int stats_json = 0;
+_Thread_local MD5_STATS md5_stats;
+
+/* Every thread's counters, added by md5_stats_flush() */
+MD5_STATS *stats_threads = NULL;
+size_t stats_nthreads = 0;
+#ifdef MD5_HAVE_PTHREAD
+pthread_mutex_t stats_lock = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+uint64_t md5_stats_now(void) {
+#ifdef MD5_HAVE_MMAP
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+#else
+    return 0;
+#endif
+}
+
+#define STATS_ADD(field, n) do { if (stats_enabled) md5_stats.field += (n); } while (0)
+#define STATS_START(t) uint64_t t = stats_enabled ? md5_stats_now() : 0
+#define STATS_STOP(field, t) do { if (stats_enabled) md5_stats.field += md5_stats_now() - (t); } while (0)
+
+/* Hand this thread's counters over, called as each thread finishes */
+void md5_stats_flush(const char *thread) {
+    if (!stats_enabled) {
+        return;
+    }
+#ifdef MD5_HAVE_PTHREAD
+    pthread_mutex_lock(&stats_lock);
+#endif
+    stats_threads = realloc(stats_threads, (stats_nthreads + 1) * sizeof(MD5_STATS));
+    md5_stats.thread = thread;
+    stats_threads[stats_nthreads++] = md5_stats;
+    memset(&md5_stats, 0, sizeof(md5_stats));
+#ifdef MD5_HAVE_PTHREAD
+    pthread_mutex_unlock(&stats_lock);
+#endif
+}
+
+/* Registered with atexit() by --stats, prints to stderr so digests on stdout stay clean */
+void md5_stats_report(void) {
+    MD5_STATS total = {"total", 0, 0, 0, 0, 0, 0, 0};
+
+    md5_stats_flush("main");
+    for (size_t i = 0; i <= stats_nthreads; i++) {
+        const MD5_STATS *t = (i < stats_nthreads) ? &stats_threads[i] : &total;
+        if (i < stats_nthreads) {
+            total.bytes_read += t->bytes_read;
+            total.read_calls += t->read_calls;
+            total.blocks += t->blocks;
+            total.pad_blocks += t->pad_blocks;
+            total.io_ns += t->io_ns;
+            total.compress_ns += t->compress_ns;
+            total.output_ns += t->output_ns;
+        }
+        if (stats_json) {
+            fprintf(stderr, "%s{\"thread\": \"%s\", \"bytes_read\": %" PRIu64 ", \"read_calls\": %" PRIu64
+                    ", \"blocks\": %" PRIu64 ", \"pad_blocks\": %" PRIu64 ", \"io_ns\": %" PRIu64
+                    ", \"compress_ns\": %" PRIu64 ", \"output_ns\": %" PRIu64 "}%s\n",
+                    i == 0 ? "{\"threads\": [\n  " : i == stats_nthreads ? "], \"total\": " : "  ",
+                    t->thread, t->bytes_read, t->read_calls, t->blocks, t->pad_blocks,
+                    t->io_ns, t->compress_ns, t->output_ns,
+                    i == stats_nthreads ? "}" : i + 1 < stats_nthreads ? "," : "");
+        } else {
+            if (i == 0) {
+                fprintf(stderr, "\n%-8s %14s %10s %12s %10s %10s %12s %10s\n", "thread", "bytes read",
+                        "reads", "blocks", "pad", "io ms", "compress ms", "output ms");
+            }
+            fprintf(stderr, "%-8s %14" PRIu64 " %10" PRIu64 " %12" PRIu64 " %10" PRIu64 " %10.2f %12.2f %10.2f\n",
+                    t->thread, t->bytes_read, t->read_calls, t->blocks, t->pad_blocks,
+                    t->io_ns / 1e6, t->compress_ns / 1e6, t->output_ns / 1e6);
+        }
+    }
+    free(stats_threads);
+}
+
 /* 
     Adapted From: https://stackoverflow.com/questions/17912978/printing-integers-as-a-set-of-4-bytes-arranged-in-little-endian
 
     Output the MD5 result in little endian
 */ 
 void output(WORD MD5_RES[]) {
+    STATS_START(t0);
     for (int i = 0; i < 4; ++i) {
         printf("%02x%02x%02x%02x", 
         (MD5_RES[i] >>  0) & 0xFF, 
@@ -191,10 +398,13 @@ void output(WORD MD5_RES[]) {
         (MD5_RES[i] >> 16) & 0xFF, 
         (MD5_RES[i] >> 24) & 0xFF);
     }
+    STATS_STOP(output_ns, t0);
 }
 
-/* --------------------- Perform MD5 on Blocks ----------------------- */
-void md5(BLOCK *M, WORD *MD5_RES) {
+/* ---------------- Perform MD5 on Blocks (Reference) ---------------- 
+* The original table driven loop, kept around as a readable reference and
+* as a baseline for comparing the unrolled kernel below against */
+void md5_reference(BLOCK *M, WORD *MD5_RES) {
     WORD a, b, c, d;
     /* Initialize hash value for this chunk */
     a = MD5_RES[0];
@@ -222,10 +432,58 @@ void md5(BLOCK *M, WORD *MD5_RES) {
     MD5_RES[3] += d;
 }
 
+/* --------------------- Perform MD5 on Blocks ----------------------- 
+* Fully unrolled compression function. a, b, c and d stay in locals for all
+* 64 steps, the shift amounts and sine constants are immediates and the
+* message words are loaded once up front, so nothing on the dependency chain
+* has to go through MD5_RES[] or the AA..T tables.
+*
+* md5_blocks() compresses (nblocks) consecutive 64 byte blocks straight out of
+* a buffer, keeping a, b, c and d in registers from one block to the next */
+void md5_blocks(WORD *MD5_RES, const BYTE *p, size_t nblocks) {
+    WORD a = MD5_RES[0];
+    WORD b = MD5_RES[1];
+    WORD c = MD5_RES[2];
+    WORD d = MD5_RES[3];
+    STATS_START(t0);
+    STATS_ADD(blocks, nblocks);
+
+    for (; nblocks > 0; nblocks--, p += 64) {
+        const WORD X0  = LOAD32(p +  0), X1  = LOAD32(p +  4), X2  = LOAD32(p +  8), X3  = LOAD32(p + 12);
+        const WORD X4  = LOAD32(p + 16), X5  = LOAD32(p + 20), X6  = LOAD32(p + 24), X7  = LOAD32(p + 28);
+        const WORD X8  = LOAD32(p + 32), X9  = LOAD32(p + 36), X10 = LOAD32(p + 40), X11 = LOAD32(p + 44);
+        const WORD X12 = LOAD32(p + 48), X13 = LOAD32(p + 52), X14 = LOAD32(p + 56), X15 = LOAD32(p + 60);
+        const WORD aa = a, bb = b, cc = c, dd = d;
+
+        MD5_STEPS(STEP_F, STEP_G, STEP_H, STEP_I)
+
+        /* Add this chunk's hash to result so far */
+        a += aa;
+        b += bb;
+        c += cc;
+        d += dd;
+    }
+
+    MD5_RES[0] = a;
+    MD5_RES[1] = b;
+    MD5_RES[2] = c;
+    MD5_RES[3] = d;
+    STATS_STOP(compress_ns, t0);
+}
+
+/* Single block entry point, as used by nextblock() driven callers */
+void md5(BLOCK *M, WORD *MD5_RES) {
+    md5_blocks(MD5_RES, M->eight, 1);
+}
+
 /* ----------------------- Read Block by Block ----------------------- */
 int nextblock(BLOCK *M, FILE *infile, uint64_t *nobits, PADFLAG *status) {
+  STATS_START(t0);
   size_t nobytesread = fread(&M->eight, 1, 64, infile);
   *nobits += nobytesread * 8;
+  STATS_STOP(io_ns, t0);
+  STATS_ADD(read_calls, 1);
+  STATS_ADD(bytes_read, nobytesread);
 
     /* Before stuff gets read in, need to check the value of status */  
     switch(*status) {
@@ -239,6 +497,7 @@ int nextblock(BLOCK *M, FILE *infile, uint64_t *nobits, PADFLAG *status) {
         }
         M->sixfour[7] = *nobits;
         *status = FINISH;
+        STATS_ADD(pad_blocks, 1);
         return 1;
         break;  
     default:
@@ -256,6 +515,7 @@ int nextblock(BLOCK *M, FILE *infile, uint64_t *nobits, PADFLAG *status) {
             ** Then append the size of the file in bits as a unsigned 64bit int */
             M->sixfour[7] = *nobits;
             *status = FINISH;
+            STATS_ADD(pad_blocks, 1);
         } 
         /* If theres 56 to 64 bytes read, need extra message block full of padding 
         ** Append 1 and add 64 bit integer to initial message block
@@ -268,238 +528,4274 @@ int nextblock(BLOCK *M, FILE *infile, uint64_t *nobits, PADFLAG *status) {
                 M->eight[i] = 0;
             }
             *status = PAD0;
+            STATS_ADD(pad_blocks, 1);
         }
         return 1;
     }
 }
 
-/* ----------------- Pass it a file, kick off hash ------------------- */
-void preMd5(FILE *infile) {
-    /* Block/chunk to be pre-processed */
-    BLOCK M;
-    uint64_t nobits = 0;
-    /* Read status of the current chunk */
-    PADFLAG status = READ;
-    /* Will store the hash result, A,B,C,D will be changed and manipulated throughout the hashing rounds */
-    WORD MD5_RES[] = {A, B, C, D};
+/* ----------------------- Pad the Final Bytes ------------------------ 
+* Bulk counterpart to nextblock(), used once all the full blocks have gone
+* through md5_blocks(). Pads the remaining (len < 64) bytes at (tail) with the
+* 1 bit, zeros and the message length in bits, one or two blocks' worth */
+void md5_tail(WORD *MD5_RES, const BYTE *tail, size_t len, uint64_t nobits) {
+    BLOCK M[2];
+    /* Only room for the length in this block if fewer than 56 bytes are left */
+    size_t noblocks = (len < 56) ? 1 : 2;
 
-    /* Read through all of the padded message blocks */
-    while (nextblock(&M, infile, &nobits, &status)) {
-        /* For each block, hash it */
-        md5(&M, MD5_RES);
-    }
-    output(MD5_RES);
+    memcpy(M[0].eight, tail, len);
+    M[0].eight[len] = 0x80;
+    memset(M[0].eight + len + 1, 0, noblocks * 64 - 8 - (len + 1));
+    M[noblocks - 1].sixfour[7] = nobits;
+    STATS_ADD(pad_blocks, noblocks);
+    md5_blocks(MD5_RES, M[0].eight, noblocks);
 }
 
-/* -------------------- Command Line Argument Outputs ------------------ 
-* Very dirty to look at this method, exists to clean up the main method */
-void cmd_line_display(int option) {
-    /* Multi-dimensional array to clean up test suite input & output */
-    const char* testFiles[5][3] = {
-        {"test-input/TestOne.txt",   "*EMPTY FILE*",               "d41d8cd98f00b204e9800998ecf8427e"},
-        {"test-input/TestTwo.txt",   "a",                          "0cc175b9c0f1b6a831c399e269772661"},
-        {"test-input/TestThree.txt", "abc",                        "900150983cd24fb0d6963f7d28e17f72"},
-        {"test-input/TestFour.txt",  "message digest",             "f96b697d7cb7938d525a2f31aaf161d0"},
-        {"test-input/TestFive.txt",  "abcdefghijklmnopqrstuvwxyz", "c3fcd3d76192e4007dfb496cca67e13b"}
-    };
+/* ------------------------ Streaming Context ------------------------- 
+* Everything needed to hash a message fed in pieces of any size, from memory
+* or anywhere else, with no globals and no heap. Each context is independent
+* so any number can be in use on any number of threads. Usage:
+*
+*     MD5_CTX ctx;
+*     md5_init(&ctx);
+*     md5_update(&ctx, data, len);   (as many times as needed)
+*     md5_final(&ctx, digest);       (16 bytes, in output order)
+*/
+typedef struct {
+    _Alignas(64) WORD state[4];
+    /* Message length so far, in bytes */
+    uint64_t nobytes;
+    /* Start of a block that isn't full yet, (buflen) bytes of it */
+    BYTE buf[64];
+    uint32_t buflen;
+} MD5_CTX;
 
-    /* Switch statement to help clean up the main method a bit, solely for output */
-    switch (option) {
-    case 0: // Case 0 - No command line arguments were entered
-        printf("\n*No command line argument specified, 'md5.exe --help' will list all valid command line arguments.\n");
-        printf("\nInput - 1: Perform MD5 on a File            ");
-        printf("\nInput - 2: Perform MD5 on a String        \n");
-        printf("\nChoose an option: ");
-        break;
-    case 1: // Case 1 - The argument --test was entered, prompting a suite of tests
-        printf("\n----------------- MD5 Test Suite ----------------\n");
-        printf("The following tests are outlined in Page 21 of the\nRequest for Comments MD5 Document.\nhttps://tools.ietf.org/html/rfc1321\n");
-        printf("-------------------------------------------------\n");
-        /* Loop once for each test */
-        for (int i = 0; i < 5; ++i) {
-            /* Print relevant information about the i'th test being carried out */
-            printf("Test Number: %d\nContent to Test: %s\nExpected Result: %s\n", i + 1, testFiles[i][1], testFiles[i][2]);
-            /* Open the i'th file */
-            FILE *infile = fopen(testFiles[i][0], "rb");
-            printf("Actual Result  : ");
-            /* Perform the MD5 hash on the content and close the file */
-            preMd5(infile);
-            fclose(infile);   
-            printf("\n-------------------------------------------------\n");
+void md5_init(MD5_CTX *ctx) {
+    ctx->state[0] = A;
+    ctx->state[1] = B;
+    ctx->state[2] = C;
+    ctx->state[3] = D;
+    ctx->nobytes = 0;
+    ctx->buflen = 0;
+}
+
+void md5_update(MD5_CTX *ctx, const void *data, size_t len) {
+    const BYTE *p = data;
+    size_t n;
+
+    ctx->nobytes += len;
+
+    /* Top up a partial block left over from last time first */
+    if (ctx->buflen) {
+        n = 64 - ctx->buflen < len ? 64 - ctx->buflen : len;
+        memcpy(ctx->buf + ctx->buflen, p, n);
+        ctx->buflen += n;
+        p += n;
+        len -= n;
+        if (ctx->buflen < 64) {
+            return;
         }
-        break;
-    case 2: // Case 2 - The argument --help was entered, prompting a helpful display
-        printf("\n--------------- Valid Command Line Argument Inputs ---------------- ");
-        printf("\n --help    | Displays helpful information for running the program.  ");
-        printf("\n --test    | Runs the test suite to ensure the MD5 output is valid. ");
-        printf("\n --explain | Brief high level overview of MD5, including a diagram. ");
-        printf("\n --hashfile <path_to_file> | Hashes the specified file.             ");
-        printf("\n --hashstring <string>     | Hashes a specified String.           \n");
-        printf("--------------- Examples of Executing Arguments ------------------    ");
-        printf("\n Hashing a String :     md5.exe --hashstring abc                    ");
-        printf("\n Hashing a File   :     md5.exe --hashfile test-input/TestOne.txt \n");
-        break;
-    case 3: // Case 3 - The argument --explain was entered, display information about MD5
-        printf("\n-------------------------------------------------------------------------\n");
-        printf("The MD5 hashing algorithm is a one-way cryptographic function that \n");
-        printf("accepts a message of any length as input and returns as output a \n");
-        printf("fixed-length digest value to be used for authenticating the original message.\n");
-        
-        printf("\nX (X1, X2, X3, ..... Xn)                                           \n");
-        printf("            +                                                        \n");
-        printf("            |  448 bits                                              \n");
-        printf("            |                                                        \n");
-        printf("            v                                                        \n");
-        printf("+-----------+----------+                    <-----------------------^\n");
-        printf("|                      |                    |                       |\n");
-        printf("|   Padding Process    |                    |                       |\n");
-        printf("|                      |                    |                       |\n");
-        printf("+-----------+----------+                    |                       ^\n");
-        printf("            |                   +-----------v------------+          |\n");
-        printf("            |       512 bits    |                        |          |\n");
-        printf("            +------------------>+  Compression Function  |          |\n");
-        printf("                                |                        |          |\n");
-        printf("                                +-----------+------------+          |\n");
-        printf("                                            |                       |\n");
-        printf("                                            |                       |\n");
-        printf("                                            |                       |\n");
-        printf("                                            +----------------------->\n");
-        printf("                                            |                        \n");
-        printf("                                            |                        \n");
-        printf("                                            |                        \n");
-        printf("                                            v                        \n");
-        printf("                                       128 bit hash                  \n");
-        printf("\nThe MD5 message digest hashing algorithm processes data in 512-bit blocks,\n");
-        printf("broken down into 16 words composed of 32 bits each. The output from MD5 is a \n");
-        printf("128-bit message digest value.\n");
-        printf("\nFor a more in depth overview see: https://github.com/farisNassif/FourthYear_TheoryOfAlgorithms");
-        break;
-    default:
-        break;
+        md5_blocks(ctx->state, ctx->buf, 1);
+        ctx->buflen = 0;
     }
+
+    /* Whole blocks straight from the caller's memory, keep the rest for later */
+    md5_blocks(ctx->state, p, len / 64);
+    memcpy(ctx->buf, p + (len & ~(size_t) 63), len & 63);
+    ctx->buflen = len & 63;
 }
 
-/* -------------------------- Main Method ---------------------------- */
-int main(int argc, char *argv[]) {
-    printf("------------------------------------------------------------------ ");
-    printf("\nAuthor :     Faris Nassif");
-    printf("\nModule :     Theory Of Algorithms");
-    printf("\nSummary:     A program that executes a MD5 Hash on a given input");
-    printf("\nGithub :     https://github.com/farisNassif/FourthYear_TheoryOfAlgorithms\n");
+/* Pad the message and write the 16 byte digest, low-order byte of A first */
+void md5_final(MD5_CTX *ctx, BYTE digest[16]) {
+    md5_tail(ctx->state, ctx->buf, ctx->buflen, ctx->nobytes * 8);
+    for (int i = 0; i < 16; i++) {
+        digest[i] = (BYTE) (ctx->state[i / 4] >> (8 * (i % 4)));
+    }
+}
 
-    /* Input vars */
-    int option;
-    /* Declaration of file/string inputs */
-    char fileName[100];
-    char inputString[50];
-    /* Long getopt options */
-    int c;
-    /* File input */
-    FILE *infile;
+/*
+    A context written out as MD5_STATE_SIZE bytes, so hashing can stop and
+    carry on later, in another process or on another machine: the magic
+    "MD5STATE", version, bytes in buf, message length so far, the chaining
+    words and the partial block. Numbers are little-endian whatever the host.
+*/
+#define MD5_STATE_MAGIC "MD5STATE"
+#define MD5_STATE_VERSION 1
+#define MD5_STATE_SIZE 104
 
-    /* User ran 'md5.exe' without any arguments, display menu */
-    if (argv[1] == NULL) {
-        /* List menu and provide some input options and information */
-        cmd_line_display(0);
-		scanf("%d", &option);
+void md5_export(const MD5_CTX *ctx, BYTE out[MD5_STATE_SIZE]) {
+    uint64_t fields[3] = { MD5_STATE_VERSION, ctx->buflen, ctx->nobytes };
 
-        /* User wants to input a file .. */
-        if (option == 1) {
-            printf("Enter a Filename: ");
-			scanf("%s", fileName);    
-            infile = fopen(fileName, "rb");
+    memcpy(out, MD5_STATE_MAGIC, 8);
+    for (int i = 0; i < 4; i++) {
+        out[8 + i] = (BYTE) (fields[0] >> (8 * i));
+        out[12 + i] = (BYTE) (fields[1] >> (8 * i));
+    }
+    for (int i = 0; i < 8; i++) {
+        out[16 + i] = (BYTE) (fields[2] >> (8 * i));
+    }
+    for (int i = 0; i < 16; i++) {
+        out[24 + i] = (BYTE) (ctx->state[i / 4] >> (8 * (i % 4)));
+    }
+    memcpy(out + 40, ctx->buf, 64);
+}
 
-            /* If invalid & file couldn't be found */
-            if (!infile) {
-                printf("Error: couldn't open file %s.\n", argv[1]);
-                return 1;
-            } 
-            /* Otherwise perform MD5 on the contents of the file */
-            else {
-                printf("Processing file contents ...\nMD5: ");
-                preMd5(infile);
-                fclose(infile);
-            }
-        } 
-        /* They gave a String, write it to a file then read it */
-        else if (option == 2) {
-            printf("Enter a String: ");
-            scanf("%s", inputString);
+/* Restore a context from md5_export(), 0 if (in) isn't a valid state */
+int md5_import(MD5_CTX *ctx, const BYTE in[MD5_STATE_SIZE]) {
+    uint32_t version = 0, buflen = 0;
+    uint64_t nobytes = 0;
+
+    for (int i = 3; i >= 0; i--) {
+        version = (version << 8) | in[8 + i];
+        buflen = (buflen << 8) | in[12 + i];
+    }
+    for (int i = 7; i >= 0; i--) {
+        nobytes = (nobytes << 8) | in[16 + i];
+    }
+    if (memcmp(in, MD5_STATE_MAGIC, 8) != 0 || version != MD5_STATE_VERSION || buflen != (nobytes & 63)) {
+        return 0;
+    }
+    for (int i = 0; i < 4; i++) {
+        ctx->state[i] = (WORD) in[24 + 4 * i] | (WORD) in[25 + 4 * i] << 8 |
+                        (WORD) in[26 + 4 * i] << 16 | (WORD) in[27 + 4 * i] << 24;
+    }
+    ctx->nobytes = nobytes;
+    ctx->buflen = buflen;
+    memcpy(ctx->buf, in + 40, 64);
+    return 1;
+}
 
-            /* Open new file */
-            infile = fopen("test-input/StringInput.txt", "w");
-            /* Write user input to the file */ 
-            fprintf(infile, "%s", inputString);
-            fclose(infile);
+/* ---------------------- Hash a Memory Buffer ------------------------ 
+* One shot hash of (len) bytes already in memory, e.g. a string from the
+* command line. Pure computation, no file or stdio involved */
+void md5_buffer(const void *data, size_t len, WORD *MD5_RES) {
+    MD5_RES[0] = A;
+    MD5_RES[1] = B;
+    MD5_RES[2] = C;
+    MD5_RES[3] = D;
+    md5_blocks(MD5_RES, data, len / 64);
+    md5_tail(MD5_RES, (const BYTE *) data + (len & ~(size_t) 63), len & 63, (uint64_t) len * 8);
+}
 
-            /* Open the file to read */
-            infile = fopen("test-input/StringInput.txt", "rb");
-            printf("Processing String ...\nMD5: ");
-            preMd5(infile);
-            fclose(infile);
-        } else {
-            printf("\nInvalid Input\nExiting ...\n");
+/* -------------------------- Read a Line ----------------------------- 
+* Reads one line of any length from (in) into a growing heap buffer, without
+* the trailing newline. Returns NULL at end of input, the caller frees it */
+char *read_line(FILE *in, size_t *len) {
+    size_t n = 0, cap = 64;
+    char *line = malloc(cap);
+    int ch;
+
+    while ((ch = getc(in)) != EOF && ch != '\n') {
+        if (n + 1 == cap) {
+            cap *= 2;
+            line = realloc(line, cap);
         }
-    } 
-    /* Else, a command line argument was detected */
-    else {
-        /* Long getopt() options, adapted from:
-        *  https://www.gnu.org/software/libc/manual/html_node/Getopt-Long-Option-Example.html */
-        static struct option long_options[] = {
-            {"help"      , no_argument      , 0, 'h'},
-            {"test"      , no_argument      , 0, 't'},
-            {"explain"   , no_argument      , 0, 'e'},
-            {"hashfile"  , required_argument, 0, 'f'},
-            {"hashstring", required_argument, 0, 's'},
-            {0           , 0                , 0,  0 }
-        };
+        line[n++] = (char) ch;
+    }
+    if (ch == EOF && n == 0) {
+        free(line);
+        return NULL;
+    }
+    /* Windows line endings */
+    if (n > 0 && line[n - 1] == '\r') {
+        n--;
+    }
+    line[n] = '\0';
+    if (len) {
+        *len = n;
+    }
+    return line;
+}
 
-        /* getopt_long stores the option index here */
-        int option_index = 0;
+/*
+    Size of the read buffer used when hashing files, full blocks are compressed
+    straight out of it so a 1 MiB read costs one fread() and no padding checks
+*/
+#define MD5_BUFSIZE (1 << 20)
 
-        c = getopt_long (argc, argv, "h:t:e:f:s", long_options, &option_index);
-        switch (c) {
-            case 'h':
-                /* Display some helpful information to the user */
-                cmd_line_display(2);
-                break;
-            case 't':
-                /* Will perform a suite of tests to verify correct output */
-                cmd_line_display(1);
-                break;
+/* Mappings at least this big are worth asking for transparent huge pages */
+#define MD5_HUGEPAGE (2 << 20)
 
-            case 'e':
-                /* Will print out some information about MD5 */
-                cmd_line_display(3);
-                break;
-            case 'f':
-                /* Attempt to open the file to be hashed */
-                infile = fopen(optarg, "rb");    
+/*
+    How md5_file() reads its input, set with --io
 
-                /* If invalid file input */
-                if (!infile) {
-                    printf("\nError: couldn't open file %s.\n", optarg);
-                    return 1;
-                } 
-                /* Otherwise perform MD5 on the contents of the file */
-                else {
-                    printf("\nProcessing file contents ...\nMD5: ");
-                    preMd5(infile);
-                    fclose(infile);
-                }                    
-                break;
-            case 's':
-                /* Open new file */
-                infile = fopen("test-input/StringInput.txt", "w");
-                /* Write user input to the file */ 
-                fprintf(infile, "%s", optarg);
-                fclose(infile);
+    IO_MMAP:   Map regular files, stream anything else (default)
+    IO_ASYNC:  Read regular files ahead on a second thread, stream anything else
+    IO_STREAM: Always fread() one buffer at a time
+*/
+typedef enum {
+    IO_MMAP,
+    IO_ASYNC,
+    IO_STREAM
+} IOMODE;
 
-                /* Open the file to read */
-                infile = fopen("test-input/StringInput.txt", "rb");
-                printf("\nProcessing String ...\nMD5: ");
-                preMd5(infile);
-                fclose(infile);
+IOMODE io_mode = IO_MMAP;
+
+/* ---------------------- Hash a Memory Mapping ----------------------- 
+* Regular files are mapped and compressed straight out of the page cache, so
+* the data is never copied into a userspace buffer. Only the last partial block
+* is staged by md5_tail(). Returns 0 without hashing anything for pipes, special
+* files, files smaller than one read buffer, or if the mapping fails, in which
+* case the caller streams the file instead. Like any mmap based reader, a file
+* truncated by someone else while it's being hashed raises SIGBUS */
+int md5_mapped(FILE *infile, WORD *MD5_RES) {
+#ifdef MD5_HAVE_MMAP
+    struct stat st;
+    int fd = fileno(infile);
+    size_t len;
+    BYTE *p;
+
+    if (fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size < MD5_BUFSIZE) {
+        return 0;
+    }
+    len = (size_t) st.st_size;
+    p = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (p == MAP_FAILED) {
+        return 0;
+    }
+    /* Pages are read in as they're touched, so with --stats that time counts as compression */
+    STATS_ADD(read_calls, 1);
+    STATS_ADD(bytes_read, len);
+
+    /* Ask for aggressive readahead, and huge pages where the filesystem supports them */
+    madvise(p, len, MADV_SEQUENTIAL);
+#ifdef MADV_HUGEPAGE
+    if (len >= MD5_HUGEPAGE) {
+        madvise(p, len, MADV_HUGEPAGE);
+    }
+#endif
+
+    md5_blocks(MD5_RES, p, len / 64);
+    md5_tail(MD5_RES, p + (len & ~(size_t) 63), len & 63, (uint64_t) len * 8);
+    munmap(p, len);
+    return 1;
+#else
+    (void) infile;
+    (void) MD5_RES;
+    return 0;
+#endif
+}
+
+/* ----------------------- Read-Ahead Pipeline ------------------------ 
+* For large files on fast storage, reading and hashing one after the other
+* leaves the device idle while a buffer is compressed and the core idle while
+* the next one is read. Here a reader thread keeps up to MD5_ASYNC_BUFS
+* aligned buffers filled with pread() ahead of the hashing thread, so buffer N
+* is compressed while N+1 .. N+k are in flight and throughput approaches the
+* slower of the two instead of their combined time */
+#define MD5_ASYNC_BUFS 4
+#define MD5_ASYNC_BUFSIZE (4 << 20)
+
+#ifdef MD5_HAVE_PTHREAD
+/*
+    Ring shared between the reader and the hasher. Slot i % MD5_ASYNC_BUFS holds
+    the i'th chunk of the file, (filled) is how many slots the hasher hasn't
+    consumed yet. A chunk shorter than MD5_ASYNC_BUFSIZE is the last one, and
+    (failed) says whether it ended at EOF or on a read error.
+*/
+typedef struct {
+    int fd;
+    BYTE *buf[MD5_ASYNC_BUFS];
+    size_t len[MD5_ASYNC_BUFS];
+    int filled;
+    int failed;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+} MD5_ASYNC;
+
+/* Fill (len) bytes at (offset), retrying short reads and EINTR. Returns fewer
+** than (len) only at EOF, and -1 on a read error */
+ssize_t pread_full(int fd, BYTE *buf, size_t len, off_t offset) {
+    size_t done = 0;
+    ssize_t n;
+
+    while (done < len) {
+        n = pread(fd, buf + done, len - done, offset + (off_t) done);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return -1;
+        }
+        if (n == 0) {
+            break;
+        }
+        done += (size_t) n;
+    }
+    return (ssize_t) done;
+}
+
+void *md5_async_reader(void *arg) {
+    MD5_ASYNC *R = arg;
+    off_t offset = 0;
+    ssize_t got;
+    size_t n;
+
+    for (int i = 0; ; i = (i + 1) % MD5_ASYNC_BUFS) {
+        /* Wait for the hasher to hand this slot back */
+        pthread_mutex_lock(&R->lock);
+        while (R->filled == MD5_ASYNC_BUFS) {
+            pthread_cond_wait(&R->cond, &R->lock);
+        }
+        pthread_mutex_unlock(&R->lock);
+
+        STATS_START(t0);
+        got = pread_full(R->fd, R->buf[i], MD5_ASYNC_BUFSIZE, offset);
+        n = got < 0 ? 0 : (size_t) got;
+        offset += (off_t) n;
+        STATS_STOP(io_ns, t0);
+        STATS_ADD(read_calls, 1);
+        STATS_ADD(bytes_read, n);
+
+        /* A failed read ends the file here, flagged so it isn't taken for EOF */
+        pthread_mutex_lock(&R->lock);
+        R->len[i] = n;
+        R->failed = got < 0;
+        R->filled++;
+        pthread_cond_signal(&R->cond);
+        pthread_mutex_unlock(&R->lock);
+
+        if (n < MD5_ASYNC_BUFSIZE) {
+            md5_stats_flush("reader");
+            return NULL;
+        }
+    }
+}
+#endif
+
+/*
+    Hash a regular file through the read-ahead pipeline. Returns 0 without
+    hashing anything if the file can't be read with pread() or the reader
+    thread can't be started, the caller then streams it instead, and -1 if
+    a read failed part way through the file.
+*/
+int md5_async(FILE *infile, WORD *MD5_RES) {
+#ifdef MD5_HAVE_PTHREAD
+    MD5_ASYNC R;
+    pthread_t reader;
+    struct stat st;
+    uint64_t nobytes = 0;
+    size_t n;
+    int i, ok = 1;
+
+    R.fd = fileno(infile);
+    if (fstat(R.fd, &st) != 0 || !S_ISREG(st.st_mode)) {
+        return 0;
+    }
+    for (i = 0; i < MD5_ASYNC_BUFS; i++) {
+        R.buf[i] = aligned_alloc(4096, MD5_ASYNC_BUFSIZE);
+        ok = ok && R.buf[i];
+    }
+    R.filled = 0;
+    R.failed = 0;
+    pthread_mutex_init(&R.lock, NULL);
+    pthread_cond_init(&R.cond, NULL);
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(R.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    if (ok && pthread_create(&reader, NULL, md5_async_reader, &R) == 0) {
+        for (i = 0; ; i = (i + 1) % MD5_ASYNC_BUFS) {
+            /* Wait for the reader to fill this slot */
+            STATS_START(t0);
+            pthread_mutex_lock(&R.lock);
+            while (R.filled == 0) {
+                pthread_cond_wait(&R.cond, &R.lock);
+            }
+            pthread_mutex_unlock(&R.lock);
+            STATS_STOP(io_ns, t0);
+
+            n = R.len[i];
+            nobytes += n;
+            if (n < MD5_ASYNC_BUFSIZE && R.failed) {
+                /* Never pad a prefix of the file into a digest */
+                ok = -1;
+                break;
+            }
+            md5_blocks(MD5_RES, R.buf[i], n / 64);
+            if (n < MD5_ASYNC_BUFSIZE) {
+                md5_tail(MD5_RES, R.buf[i] + (n & ~(size_t) 63), n & 63, nobytes * 8);
+                break;
+            }
+
+            /* Hand the slot back to the reader */
+            pthread_mutex_lock(&R.lock);
+            R.filled--;
+            pthread_cond_signal(&R.cond);
+            pthread_mutex_unlock(&R.lock);
+        }
+        pthread_join(reader, NULL);
+    } else {
+        ok = 0;
+    }
+
+    pthread_cond_destroy(&R.cond);
+    pthread_mutex_destroy(&R.lock);
+    for (i = 0; i < MD5_ASYNC_BUFS; i++) {
+        free(R.buf[i]);
+    }
+    return ok;
+#else
+    (void) infile;
+    (void) MD5_RES;
+    return 0;
+#endif
+}
+
+/* One MD5_BUFSIZE read buffer per thread, kept for the next file rather than allocated every time */
+BYTE *md5_read_buffer(void) {
+    static _Thread_local BYTE *buf = NULL;
+
+    if (!buf) {
+        buf = aligned_alloc(64, MD5_BUFSIZE);
+    }
+    return buf;
+}
+
+/* ---------------------- Hash a File's Contents ---------------------- 
+* Maps the file or reads it ahead on a second thread, depending on io_mode,
+* otherwise (or if that isn't possible) reads it in MD5_BUFSIZE chunks.
+* Returns 0 if a read failed, MD5_RES is then not the file's digest */
+int md5_file(FILE *infile, WORD *MD5_RES) {
+    BYTE *buf;
+    uint64_t nobytes = 0;
+    size_t nobytesread;
+    int async;
+
+    /* Will store the hash result, A,B,C,D will be changed and manipulated throughout the hashing rounds */
+    MD5_RES[0] = A;
+    MD5_RES[1] = B;
+    MD5_RES[2] = C;
+    MD5_RES[3] = D;
+
+    if (io_mode == IO_MMAP && md5_mapped(infile, MD5_RES)) {
+        return 1;
+    }
+    if (io_mode == IO_ASYNC && (async = md5_async(infile, MD5_RES)) != 0) {
+        return async > 0;
+    }
+
+    /* Compress everything up to the last partial block in place */
+    buf = md5_read_buffer();
+    for (;;) {
+        STATS_START(t0);
+        nobytesread = fread(buf, 1, MD5_BUFSIZE, infile);
+        STATS_STOP(io_ns, t0);
+        STATS_ADD(read_calls, 1);
+        STATS_ADD(bytes_read, nobytesread);
+
+        md5_blocks(MD5_RES, buf, nobytesread / 64);
+        nobytes += nobytesread;
+        if (nobytesread < MD5_BUFSIZE) {
+            break;
+        }
+    }
+
+    /* fread() stops short on an error just like at EOF */
+    if (ferror(infile)) {
+        return 0;
+    }
+
+    /* Only the tail needs to be padded */
+    md5_tail(MD5_RES, buf + (nobytesread & ~(size_t) 63), nobytesread & 63, nobytes * 8);
+    return 1;
+}
+
+/* ----------------------- Hash Standard Input ------------------------ 
+* --stdin (or --hashfile -) hashes whatever is piped in. A pipe hands back
+* however much the writer has produced so far, so every read(2) asks for the
+* rest of the buffer, EINTR is retried, and the whole blocks of each read are
+* compressed straight away while the writer refills the pipe. Only the bytes
+* past the last whole block are carried over to the next read.
+* Returns 0 if reading fails part way */
+int md5_fd(int fd, WORD *MD5_RES) {
+#ifdef MD5_HAVE_MMAP
+    BYTE *buf = md5_read_buffer();
+    uint64_t nobytes = 0;
+    size_t fill = 0;
+    ssize_t n;
+
+    MD5_RES[0] = A;
+    MD5_RES[1] = B;
+    MD5_RES[2] = C;
+    MD5_RES[3] = D;
+
+#ifdef F_SETPIPE_SZ
+    /* A 64KiB pipe means a context switch every 64KiB, ask for one as big as the buffer.
+    ** Fails harmlessly when fd isn't a pipe or the size is over the user's limit */
+    fcntl(fd, F_SETPIPE_SZ, MD5_BUFSIZE);
+#endif
+
+    for (;;) {
+        STATS_START(t0);
+        n = read(fd, buf + fill, MD5_BUFSIZE - fill);
+        STATS_STOP(io_ns, t0);
+        STATS_ADD(read_calls, 1);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n < 0) {
+            return 0;
+        }
+        if (n == 0) {
+            break;
+        }
+        fill += (size_t) n;
+        nobytes += (uint64_t) n;
+        STATS_ADD(bytes_read, n);
+
+        /* Compress the whole blocks, move the partial one to the front */
+        md5_blocks(MD5_RES, buf, fill / 64);
+        memmove(buf, buf + (fill & ~(size_t) 63), fill & 63);
+        fill &= 63;
+    }
+
+    md5_tail(MD5_RES, buf, fill, nobytes * 8);
+    return 1;
+#else
+    /* No read(2), stdio reads the stream just as well */
+    (void) fd;
+    return md5_file(stdin, MD5_RES);
+#endif
+}
+
+/* ----------------- Pass it a file, kick off hash ------------------- 
+* Returns 0, printing nothing, if the file couldn't be read */
+int preMd5(FILE *infile) {
+    WORD MD5_RES[4];
+
+    if (!md5_file(infile, MD5_RES)) {
+        return 0;
+    }
+    output(MD5_RES);
+    return 1;
+}
+
+/* --------------------------- Digest Cache --------------------------- 
+* Rehashing a tree where hardly anything has changed is mostly wasted reads.
+* --hashfile keeps the digest of each file it hashes in a cache keyed by
+* device, inode, size and the modification and change times in nanoseconds,
+* and a file whose stat(2) still matches its entry isn't read at all. Every
+* write to a file moves its ctime, which user space can't set back, so a
+* matching entry means the contents are still the ones that were hashed.
+*
+* The cache is one flat file, a header then entries sorted by device and
+* inode, which is mapped as is and binary searched in place. Digests hashed
+* during a run are merged in at the end and written to a temporary file that
+* is renamed over the old one, so a reader never sees half a cache. If two
+* runs overlap the later rename wins and the other's new entries are simply
+* hashed again next time. It's kept in native byte order, being a cache and
+* not something to copy between machines. --no-cache neither reads nor writes
+* it, --verify-cache rehashes everything, reports files whose cached digest
+* was wrong and rewrites those entries */
+typedef enum { CACHE_ON, CACHE_OFF, CACHE_VERIFY } CACHE_MODE;
+
+CACHE_MODE cache_mode = CACHE_ON;
+
+#ifdef MD5_HAVE_MMAP
+#define MD5_CACHE_MAGIC "MD5CACHE"
+#define MD5_CACHE_VERSION 1
+/* Files changed this close to being hashed aren't cached, a second write in
+** the same timestamp tick wouldn't show up in stat(2) */
+#define MD5_CACHE_RACY_NS 2000000000LL
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t entry_size;
+    uint64_t count;
+} MD5_CACHE_HEADER;
+
+typedef struct {
+    uint64_t dev;
+    uint64_t ino;
+    uint64_t size;
+    int64_t mtime_ns;
+    int64_t ctime_ns;
+    WORD MD5_RES[4];
+} MD5_CACHE_ENTRY;
+
+typedef struct {
+    char *path;                     // NULL while the cache isn't in use
+    void *map;                      // The cache file as it was when opened
+    size_t maplen;
+    const MD5_CACHE_ENTRY *entries; // Sorted by device and inode
+    size_t n;
+    MD5_CACHE_ENTRY *added;         // Hashed this run, merged in by md5_cache_close()
+    size_t nadded;
+    size_t cap;
+    atomic_size_t mismatched;       // Stale digests found by --verify-cache
+    pthread_mutex_t lock;
+} MD5_CACHE;
+
+MD5_CACHE md5_cache = { .lock = PTHREAD_MUTEX_INITIALIZER };
+
+/* Start replacing the file at (path) with a temporary one beside it, which
+** atomic_close() renames over it. NULL if it can't be created */
+FILE *atomic_open(const char *path, char **tmp) {
+    size_t len = strlen(path) + sizeof(".XXXXXX");
+    FILE *f = NULL;
+    int fd;
+
+    *tmp = malloc(len);
+    snprintf(*tmp, len, "%s.XXXXXX", path);
+    if ((fd = mkstemp(*tmp)) >= 0 && !(f = fdopen(fd, "wb"))) {
+        close(fd);
+        unlink(*tmp);
+    }
+    if (!f) {
+        free(*tmp);
+        *tmp = NULL;
+    }
+    return f;
+}
+
+/* Sync (f) and move it into place if (ok) and nothing failed, else throw it
+** away and leave the old file alone. Returns 0 if the file wasn't replaced */
+int atomic_close(FILE *f, char *tmp, const char *path, int ok) {
+    ok = ok && fflush(f) == 0 && fsync(fileno(f)) == 0;
+    ok = fclose(f) == 0 && ok;
+    ok = ok && rename(tmp, path) == 0;
+    if (!ok) {
+        unlink(tmp);
+    }
+    free(tmp);
+    return ok;
+}
+
+/* Fill in (e)'s key from (st) */
+void md5_cache_key(const struct stat *st, MD5_CACHE_ENTRY *e) {
+    e->dev = (uint64_t) st->st_dev;
+    e->ino = (uint64_t) st->st_ino;
+    e->size = (uint64_t) st->st_size;
+#ifdef __APPLE__
+    e->mtime_ns = (int64_t) st->st_mtimespec.tv_sec * 1000000000 + st->st_mtimespec.tv_nsec;
+    e->ctime_ns = (int64_t) st->st_ctimespec.tv_sec * 1000000000 + st->st_ctimespec.tv_nsec;
+#else
+    e->mtime_ns = (int64_t) st->st_mtim.tv_sec * 1000000000 + st->st_mtim.tv_nsec;
+    e->ctime_ns = (int64_t) st->st_ctim.tv_sec * 1000000000 + st->st_ctim.tv_nsec;
+#endif
+}
+
+/* Order entries by device then inode, qsort/bsearch style */
+int md5_cache_cmp(const void *x, const void *y) {
+    const MD5_CACHE_ENTRY *a = x, *b = y;
+
+    if (a->dev != b->dev) {
+        return a->dev < b->dev ? -1 : 1;
+    }
+    return a->ino < b->ino ? -1 : a->ino > b->ino;
+}
+
+/* Same file and unchanged since (e) was stored */
+int md5_cache_same(const MD5_CACHE_ENTRY *e, const MD5_CACHE_ENTRY *key) {
+    return e->dev == key->dev && e->ino == key->ino && e->size == key->size &&
+           e->mtime_ns == key->mtime_ns && e->ctime_ns == key->ctime_ns;
+}
+
+/* md5.cache in $XDG_CACHE_HOME or ~/.cache, NULL without either */
+char *md5_cache_default(void) {
+    const char *xdg = getenv("XDG_CACHE_HOME"), *home = getenv("HOME");
+    char *path;
+    size_t len;
+
+    if (xdg && *xdg) {
+        len = strlen(xdg) + sizeof("/md5.cache");
+        path = malloc(len);
+        snprintf(path, len, "%s/md5.cache", xdg);
+    } else if (home && *home) {
+        len = strlen(home) + sizeof("/.cache/md5.cache");
+        path = malloc(len);
+        snprintf(path, len, "%s/.cache", home);
+        mkdir(path, 0700);
+        snprintf(path, len, "%s/.cache/md5.cache", home);
+    } else {
+        return NULL;
+    }
+    return path;
+}
+
+/* Start using the cache at (path), or the default one if NULL. A missing or
+** unrecognised file reads as an empty cache and is replaced on close */
+void md5_cache_open(const char *path) {
+    struct stat st;
+    int fd;
+
+    md5_cache.path = path ? strdup(path) : md5_cache_default();
+    if (!md5_cache.path || (fd = open(md5_cache.path, O_RDONLY | O_CLOEXEC)) < 0) {
+        return;
+    }
+    if (fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(MD5_CACHE_HEADER)) {
+        size_t len = (size_t) st.st_size, body = len - sizeof(MD5_CACHE_HEADER);
+        void *map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        const MD5_CACHE_HEADER *h = map;
+
+        if (map != MAP_FAILED) {
+            if (memcmp(h->magic, MD5_CACHE_MAGIC, 8) == 0 && h->version == MD5_CACHE_VERSION &&
+                h->entry_size == sizeof(MD5_CACHE_ENTRY) && body % sizeof(MD5_CACHE_ENTRY) == 0 &&
+                h->count == body / sizeof(MD5_CACHE_ENTRY)) {
+                md5_cache.map = map;
+                md5_cache.maplen = len;
+                md5_cache.entries = (const MD5_CACHE_ENTRY *) (h + 1);
+                md5_cache.n = h->count;
+            } else {
+                munmap(map, len);
+            }
+        }
+    }
+    close(fd);
+}
+
+/* The entry for (key)'s file if it hasn't changed since, NULL otherwise */
+const MD5_CACHE_ENTRY *md5_cache_find(const MD5_CACHE_ENTRY *key) {
+    const MD5_CACHE_ENTRY *e;
+
+    if (!md5_cache.n) {
+        return NULL;
+    }
+    e = bsearch(key, md5_cache.entries, md5_cache.n, sizeof(MD5_CACHE_ENTRY), md5_cache_cmp);
+    return e && md5_cache_same(e, key) ? e : NULL;
+}
+
+/* Keep (e) for the next run, called from any worker */
+void md5_cache_add(const MD5_CACHE_ENTRY *e) {
+    pthread_mutex_lock(&md5_cache.lock);
+    if (md5_cache.nadded == md5_cache.cap) {
+        md5_cache.cap = md5_cache.cap ? md5_cache.cap * 2 : 256;
+        md5_cache.added = realloc(md5_cache.added, md5_cache.cap * sizeof(MD5_CACHE_ENTRY));
+    }
+    md5_cache.added[md5_cache.nadded++] = *e;
+    pthread_mutex_unlock(&md5_cache.lock);
+}
+
+/*
+    Merge this run's digests into the cache file and stop using it. Returns 0
+    if the new cache couldn't be written, the old one is left as it was.
+*/
+int md5_cache_close(void) {
+    MD5_CACHE_HEADER h = { .version = MD5_CACHE_VERSION, .entry_size = sizeof(MD5_CACHE_ENTRY) };
+    MD5_CACHE_ENTRY *out = NULL, *added = md5_cache.added;
+    size_t n = md5_cache.n, nadded = 0, i = 0, j = 0;
+    char *tmp;
+    FILE *f;
+    int ok = 1;
+
+    if (!md5_cache.path || !md5_cache.nadded) {
+        goto done;
+    }
+    memcpy(h.magic, MD5_CACHE_MAGIC, sizeof(h.magic));
+
+    /* A file listed twice was hashed twice, keep one of them */
+    qsort(added, md5_cache.nadded, sizeof(MD5_CACHE_ENTRY), md5_cache_cmp);
+    for (size_t k = 0; k < md5_cache.nadded; k++) {
+        if (!nadded || md5_cache_cmp(&added[nadded - 1], &added[k]) != 0) {
+            added[nadded++] = added[k];
+        } else {
+            added[nadded - 1] = added[k];
+        }
+    }
+
+    /* Both lists are sorted, new entries replace old ones for the same file */
+    out = malloc((n + nadded) * sizeof(MD5_CACHE_ENTRY));
+    while (i < n || j < nadded) {
+        int c = i == n ? 1 : j == nadded ? -1 : md5_cache_cmp(&md5_cache.entries[i], &added[j]);
+        if (c < 0) {
+            out[h.count++] = md5_cache.entries[i++];
+        } else {
+            i += c == 0;
+            out[h.count++] = added[j++];
+        }
+    }
+
+    ok = (f = atomic_open(md5_cache.path, &tmp)) != NULL &&
+         atomic_close(f, tmp, md5_cache.path, fwrite(&h, sizeof(h), 1, f) == 1 &&
+                      fwrite(out, sizeof(MD5_CACHE_ENTRY), h.count, f) == h.count);
+    if (!ok) {
+        fprintf(stderr, "Warning: couldn't write the digest cache %s.\n", md5_cache.path);
+    }
+
+done:
+    if (md5_cache.map) {
+        munmap(md5_cache.map, md5_cache.maplen);
+    }
+    free(out);
+    free(md5_cache.added);
+    free(md5_cache.path);
+    md5_cache.map = NULL;
+    md5_cache.entries = md5_cache.added = NULL;
+    md5_cache.n = md5_cache.nadded = md5_cache.cap = 0;
+    md5_cache.path = NULL;
+    return ok;
+}
+
+/*
+    Once the file at (path), keyed (key) when it was opened at (now), has been
+    hashed: warn if the cache had another digest for it, otherwise keep the
+    digest if (after), its key once read, shows nothing touched the file.
+*/
+void md5_cache_update(const char *path, MD5_CACHE_ENTRY *key, const MD5_CACHE_ENTRY *after,
+                      const struct timespec *now, const WORD *MD5_RES) {
+    const MD5_CACHE_ENTRY *hit;
+
+    if (!md5_cache.path) {
+        return;
+    }
+    hit = md5_cache_find(key);
+    if (hit && memcmp(hit->MD5_RES, MD5_RES, sizeof(hit->MD5_RES)) != 0) {
+        atomic_fetch_add(&md5_cache.mismatched, 1);
+        fprintf(stderr, "Warning: cached digest for %s was wrong.\n", path);
+    } else if (hit) {
+        return;
+    }
+    int64_t racy = (int64_t) now->tv_sec * 1000000000 + now->tv_nsec - MD5_CACHE_RACY_NS;
+    if (md5_cache_same(key, after) && key->mtime_ns < racy && key->ctime_ns < racy) {
+        memcpy(key->MD5_RES, MD5_RES, sizeof(key->MD5_RES));
+        md5_cache_add(key);
+    }
+}
+
+/* A small file read by md5_small_read(), waiting to be hashed */
+typedef struct {
+    MD5_CACHE_ENTRY key, after;
+    struct timespec now;
+    size_t len;
+} MD5_SMALL;
+
+/*
+    Digest of the file at (path), taken from the cache when the file hasn't
+    changed since it was stored. Returns 0 if the file couldn't be opened or
+    read.
+*/
+int md5_hash_path(const char *path, WORD *MD5_RES) {
+    MD5_CACHE_ENTRY key, after;
+    const MD5_CACHE_ENTRY *hit;
+    struct stat st;
+    struct timespec now;
+    FILE *infile;
+
+    STATS_START(t0);
+    /* A hit costs one stat(2), the file isn't even opened */
+    if (md5_cache.path && cache_mode == CACHE_ON && stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+        md5_cache_key(&st, &key);
+        if ((hit = md5_cache_find(&key)) != NULL) {
+            memcpy(MD5_RES, hit->MD5_RES, sizeof(hit->MD5_RES));
+            STATS_STOP(io_ns, t0);
+            return 1;
+        }
+    }
+    infile = fopen(path, "rb");
+    STATS_STOP(io_ns, t0);
+    if (!infile) {
+        return 0;
+    }
+    if (!md5_cache.path || fstat(fileno(infile), &st) != 0 || !S_ISREG(st.st_mode)) {
+        int read = md5_file(infile, MD5_RES);
+        fclose(infile);
+        return read;
+    }
+
+    /* Key the digest on the file that was actually opened, and only keep it
+    ** if nothing touched the file while it was being read */
+    md5_cache_key(&st, &key);
+    clock_gettime(CLOCK_REALTIME, &now);
+    if (!md5_file(infile, MD5_RES)) {
+        fclose(infile);
+        return 0;
+    }
+    if (fstat(fileno(infile), &st) == 0) {
+        md5_cache_key(&st, &after);
+    } else {
+        after = key;
+        after.dev = ~key.dev;
+    }
+    fclose(infile);
+
+    md5_cache_update(path, &key, &after, &now, MD5_RES);
+    return 1;
+}
+
+/*
+    The part of md5_hash_path() before hashing, for a regular file of at most
+    (max) bytes. Such a file is read whole into (buf), so several can be hashed
+    at once in SIMD lanes. Returns 1 with MD5_RES taken from the cache, 2 with
+    the file in (buf) and (S) ready for md5_cache_update() once it's hashed,
+    or 0 if it's bigger, not a regular file or couldn't be read, for
+    md5_hash_path() to deal with.
+*/
+int md5_small_read(const char *path, BYTE *buf, size_t max, MD5_SMALL *S, WORD *MD5_RES) {
+    const MD5_CACHE_ENTRY *hit;
+    struct stat st;
+    ssize_t got;
+    int fd;
+
+    STATS_START(t0);
+    if (md5_cache.path && cache_mode == CACHE_ON && stat(path, &st) == 0 && S_ISREG(st.st_mode)) {
+        md5_cache_key(&st, &S->key);
+        if ((hit = md5_cache_find(&S->key)) != NULL) {
+            memcpy(MD5_RES, hit->MD5_RES, sizeof(hit->MD5_RES));
+            STATS_STOP(io_ns, t0);
+            return 1;
+        }
+    }
+    fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || (uint64_t) st.st_size > max) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        STATS_STOP(io_ns, t0);
+        return 0;
+    }
+
+    md5_cache_key(&st, &S->key);
+    clock_gettime(CLOCK_REALTIME, &S->now);
+    got = pread_full(fd, buf, (size_t) st.st_size, 0);
+    if (got == (ssize_t) st.st_size && fstat(fd, &st) == 0) {
+        md5_cache_key(&st, &S->after);
+    } else {
+        S->after = S->key;
+        S->after.dev = ~S->key.dev;
+    }
+    close(fd);
+    STATS_STOP(io_ns, t0);
+    STATS_ADD(read_calls, 1);
+    STATS_ADD(bytes_read, got > 0 ? got : 0);
+
+    /* A read error, or a file that shrank, is left to md5_hash_path() */
+    if (got != (ssize_t) S->key.size) {
+        return 0;
+    }
+    S->len = (size_t) got;
+    return 2;
+}
+
+/* Stale entries found by --verify-cache */
+size_t md5_cache_mismatched(void) {
+    return atomic_load(&md5_cache.mismatched);
+}
+#else
+void md5_cache_open(const char *path) { (void) path; }
+int md5_cache_close(void) { return 1; }
+size_t md5_cache_mismatched(void) { return 0; }
+
+int md5_hash_path(const char *path, WORD *MD5_RES) {
+    FILE *infile = fopen(path, "rb");
+
+    int read;
+
+    if (!infile) {
+        return 0;
+    }
+    read = md5_file(infile, MD5_RES);
+    fclose(infile);
+    return read;
+}
+#endif
+
+/* ------------------------- Resumable Hashing ------------------------ 
+* --state <file> keeps a file's MD5_CTX between runs. Hashing an append only
+* log again only reads what was added since the state was saved, and a long
+* hash saves its state every MD5_STATE_CHECKPOINT bytes so it can carry on
+* after a crash. The state file is md5_export() followed by the device and
+* inode of the file hashed. A state for another file (a rotated log, say) or
+* for more bytes than the file now has is ignored and the file hashed from the
+* start. Rewriting a file in place without shrinking it can't be spotted this
+* way, --state is only for files that are appended to */
+#define MD5_STATE_CHECKPOINT ((uint64_t) 1 << 30)
+
+#ifdef MD5_HAVE_MMAP
+/* Save (ctx) for the file (st) to (statepath), replacing it atomically */
+int md5_state_save(const char *statepath, const MD5_CTX *ctx, const struct stat *st) {
+    BYTE out[MD5_STATE_SIZE + 16];
+    uint64_t id[2] = { (uint64_t) st->st_dev, (uint64_t) st->st_ino };
+    char *tmp;
+    FILE *f;
+
+    md5_export(ctx, out);
+    for (int i = 0; i < 16; i++) {
+        out[MD5_STATE_SIZE + i] = (BYTE) (id[i / 8] >> (8 * (i % 8)));
+    }
+    return (f = atomic_open(statepath, &tmp)) != NULL &&
+           atomic_close(f, tmp, statepath, fwrite(out, sizeof(out), 1, f) == 1);
+}
+
+/* Load the state in (statepath) into (ctx) if it belongs to the file (st) */
+int md5_state_load(const char *statepath, MD5_CTX *ctx, const struct stat *st) {
+    BYTE in[MD5_STATE_SIZE + 16];
+    uint64_t id[2] = { 0, 0 };
+    FILE *f = fopen(statepath, "rb");
+    int ok;
+
+    if (!f) {
+        return 0;
+    }
+    ok = fread(in, sizeof(in), 1, f) == 1 && md5_import(ctx, in);
+    fclose(f);
+    for (int i = 15; ok && i >= 0; i--) {
+        id[i / 8] = (id[i / 8] << 8) | in[MD5_STATE_SIZE + i];
+    }
+    return ok && id[0] == (uint64_t) st->st_dev && id[1] == (uint64_t) st->st_ino &&
+           ctx->nobytes <= (uint64_t) st->st_size;
+}
+
+/*
+    Hash the file at (path), carrying on from the state in (statepath) when
+    there's one for it, and save the state for next time. Returns 0 if the
+    file couldn't be read or the state couldn't be saved.
+*/
+int md5_resume(const char *path, const char *statepath, WORD *MD5_RES) {
+    BYTE *buf = md5_read_buffer();
+    MD5_CTX ctx;
+    struct stat st;
+    uint64_t checkpoint;
+    ssize_t n;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0 || fstat(fd, &st) != 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return 0;
+    }
+    if (!md5_state_load(statepath, &ctx, &st)) {
+        md5_init(&ctx);
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, (off_t) ctx.nobytes, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
+    /* Only what's past the saved length is read */
+    checkpoint = ctx.nobytes + MD5_STATE_CHECKPOINT;
+    for (;;) {
+        STATS_START(t0);
+        n = pread(fd, buf, MD5_BUFSIZE, (off_t) ctx.nobytes);
+        STATS_STOP(io_ns, t0);
+        STATS_ADD(read_calls, 1);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        STATS_ADD(bytes_read, n);
+        md5_update(&ctx, buf, (size_t) n);
+        if (ctx.nobytes >= checkpoint) {
+            md5_state_save(statepath, &ctx, &st);
+            checkpoint = ctx.nobytes + MD5_STATE_CHECKPOINT;
+        }
+    }
+    close(fd);
+    if (n < 0 || !md5_state_save(statepath, &ctx, &st)) {
+        return 0;
+    }
+
+    /* Pad a copy, the saved state is the unpadded one */
+    memcpy(MD5_RES, ctx.state, sizeof(ctx.state));
+    md5_tail(MD5_RES, ctx.buf, ctx.buflen, ctx.nobytes * 8);
+    return 1;
+}
+#else
+int md5_resume(const char *path, const char *statepath, WORD *MD5_RES) {
+    /* Nowhere to keep an inode, hash the whole file every time */
+    (void) statepath;
+    return md5_hash_path(path, MD5_RES);
+}
+#endif
+
+/* ---------------------- Many Files in Parallel ---------------------- 
+* --hashfile accepts any number of files and directories, directories are
+* walked recursively. Everything to hash is collected into one list of jobs up
+* front, the jobs are hashed on a pool of worker threads and the digests are
+* printed in list order as soon as each one (and everything before it) is done.
+* Output is therefore the same for any number of threads. The worker itself and
+* md5_many() come after the multi-lane kernels, which the worker feeds small
+* files to */
+#ifdef MD5_HAVE_PTHREAD
+
+/*
+    One file to hash. (done) is 0 while pending, 1 once MD5_RES holds the
+    digest and -1 if the file couldn't be opened, it's written by the worker
+    that hashed the file and read by the thread printing the results.
+*/
+typedef struct {
+    char *path;
+    WORD MD5_RES[4];
+    atomic_int done;
+    WORD expect[4];     // --check, the digest the manifest gives
+} MD5_JOB;
+
+typedef struct {
+    MD5_JOB *jobs;
+    size_t n;
+    size_t cap;
+} MD5_JOBS;
+
+/* Append (path) to the job list, which takes ownership of it */
+void jobs_add(MD5_JOBS *J, char *path) {
+    if (J->n == J->cap) {
+        J->cap = J->cap ? J->cap * 2 : 256;
+        J->jobs = realloc(J->jobs, J->cap * sizeof(MD5_JOB));
+    }
+    J->jobs[J->n].path = path;
+    atomic_init(&J->jobs[J->n].done, 0);
+    J->n++;
+}
+
+/* "dir" + "/" + "name", freshly allocated */
+char *path_join(const char *dir, const char *name) {
+    size_t ld = strlen(dir), ln = strlen(name);
+    char *path = malloc(ld + ln + 2);
+
+    memcpy(path, dir, ld);
+    path[ld] = '/';
+    memcpy(path + ld + 1, name, ln + 1);
+    return path;
+}
+
+#ifdef SYS_getdents64
+/* Raw directory entry as returned by getdents64(2) */
+typedef struct {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+} DIRENT64;
+
+typedef struct {
+    char *name;
+    unsigned char type;
+} MD5_DIRENT;
+
+int dirent_cmp(const void *x, const void *y) {
+    return strcmp(((const MD5_DIRENT *) x)->name, ((const MD5_DIRENT *) y)->name);
+}
+
+/*
+    Add every regular file below the open directory (dirfd) to the job list,
+    in name order so the output doesn't depend on the filesystem's order.
+    Entries are read in bulk with getdents64 and only stat'ed with fstatat when
+    the filesystem doesn't report their type. Symlinks to files are followed,
+    symlinks to directories are not, so the walk can't loop.
+*/
+void walk_dir(int dirfd, const char *path, MD5_JOBS *J) {
+    char buf[32768];
+    MD5_DIRENT *ents = NULL;
+    size_t nents = 0, cap = 0;
+    long nread;
+    struct stat st;
+
+    while ((nread = syscall(SYS_getdents64, dirfd, buf, sizeof(buf))) > 0) {
+        for (long off = 0; off < nread; ) {
+            DIRENT64 *d = (DIRENT64 *) (buf + off);
+            off += d->d_reclen;
+            if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0) {
+                continue;
+            }
+            if (nents == cap) {
+                cap = cap ? cap * 2 : 64;
+                ents = realloc(ents, cap * sizeof(MD5_DIRENT));
+            }
+            ents[nents].name = strdup(d->d_name);
+            ents[nents].type = d->d_type;
+            nents++;
+        }
+    }
+    qsort(ents, nents, sizeof(MD5_DIRENT), dirent_cmp);
+
+    for (size_t i = 0; i < nents; i++) {
+        unsigned char type = ents[i].type;
+
+        if (type == DT_UNKNOWN && fstatat(dirfd, ents[i].name, &st, AT_SYMLINK_NOFOLLOW) == 0) {
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : S_ISLNK(st.st_mode) ? DT_LNK : DT_UNKNOWN;
+        }
+        if (type == DT_LNK && fstatat(dirfd, ents[i].name, &st, 0) == 0 && S_ISREG(st.st_mode)) {
+            type = DT_REG;
+        }
+
+        if (type == DT_DIR) {
+            int fd = openat(dirfd, ents[i].name, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (fd >= 0) {
+                char *sub = path_join(path, ents[i].name);
+                walk_dir(fd, sub, J);
+                free(sub);
+                close(fd);
+            }
+        } else if (type == DT_REG) {
+            jobs_add(J, path_join(path, ents[i].name));
+        }
+        free(ents[i].name);
+    }
+    free(ents);
+}
+#endif
+
+/* Add (path) to the job list, or everything below it if it's a directory */
+void jobs_add_path(MD5_JOBS *J, const char *path) {
+#ifdef SYS_getdents64
+    struct stat st;
+
+    if (stat(path, &st) == 0 && S_ISDIR(st.st_mode)) {
+        int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (fd >= 0) {
+            /* Avoid "dir//file" when the path already ends in a slash */
+            size_t len = strlen(path);
+            char *dir = strdup(path);
+            while (len > 1 && dir[len - 1] == '/') {
+                dir[--len] = '\0';
+            }
+            walk_dir(fd, dir, J);
+            free(dir);
+            close(fd);
+            return;
+        }
+    }
+#endif
+    /* Anything else is hashed as is, or reported if it can't be opened */
+    jobs_add(J, strdup(path));
+}
+
+/*
+    Work stealing queue. Each worker starts with an equal, contiguous share of
+    the job list and takes jobs off the front of it. A worker whose share runs
+    out steals the back half of another worker's remaining share. The range is
+    packed into one word, lo in the low 32 bits and hi in the high 32 bits, so
+    owner and thieves agree on it with a single compare-and-swap.
+*/
+typedef struct {
+    _Alignas(64) _Atomic uint64_t range;
+} MD5_DEQUE;
+
+#define RANGE(lo, hi) (((uint64_t) (hi) << 32) | (uint32_t) (lo))
+
+typedef struct {
+    void *ctx;          // What the jobs are, MD5_JOBS for md5_worker()
+    MD5_DEQUE *queues;
+    int nthreads;
+    int id;
+} MD5_WORKER;
+
+/* Take the next job from the front of (q), -1 if it's empty */
+long deque_take(MD5_DEQUE *q) {
+    uint64_t r = atomic_load(&q->range);
+    while ((uint32_t) r < (uint32_t) (r >> 32)) {
+        if (atomic_compare_exchange_weak(&q->range, &r, RANGE((uint32_t) r + 1, r >> 32))) {
+            return (long) (uint32_t) r;
+        }
+    }
+    return -1;
+}
+
+/* Move the back half of (victim)'s jobs to (q), 0 if there was nothing to steal */
+int deque_steal(MD5_DEQUE *victim, MD5_DEQUE *q) {
+    uint64_t r = atomic_load(&victim->range);
+    while ((uint32_t) r < (uint32_t) (r >> 32)) {
+        uint32_t lo = (uint32_t) r, hi = (uint32_t) (r >> 32);
+        uint32_t mid = hi - (hi - lo + 1) / 2;
+        if (atomic_compare_exchange_weak(&victim->range, &r, RANGE(lo, mid))) {
+            atomic_store(&q->range, RANGE(mid, hi));
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* The next job for (W), from its own queue or stolen, -1 once there are none left */
+long worker_next(MD5_WORKER *W) {
+    MD5_DEQUE *own = &W->queues[W->id];
+    long i;
+
+    while ((i = deque_take(own)) < 0) {
+        /* Out of work, look for someone to steal from. Nothing is ever added, so
+        ** once every queue is empty the worker is finished */
+        int stolen = 0;
+        for (int k = 1; k < W->nthreads && !stolen; k++) {
+            stolen = deque_steal(&W->queues[(W->id + k) % W->nthreads], own);
+        }
+        if (!stolen) {
+            return -1;
+        }
+    }
+    return i;
+}
+
+typedef struct {
+    MD5_DEQUE *queues;
+    MD5_WORKER *workers;
+    pthread_t *threads;
+    int nthreads;
+} MD5_POOL;
+
+/* Start (nthreads) threads running (fn) over jobs 0 to (n) - 1, each given (ctx) in its MD5_WORKER */
+void pool_start(MD5_POOL *P, size_t n, int nthreads, void *(*fn)(void *), void *ctx) {
+    if (nthreads < 1) {
+        nthreads = 1;
+    }
+    P->nthreads = nthreads;
+    P->queues = aligned_alloc(64, nthreads * sizeof(MD5_DEQUE));
+    P->workers = malloc(nthreads * sizeof(MD5_WORKER));
+    P->threads = malloc(nthreads * sizeof(pthread_t));
+
+    /* Give each worker an equal share, then start them all */
+    for (int t = 0; t < nthreads; t++) {
+        atomic_init(&P->queues[t].range, RANGE(n * t / nthreads, n * (t + 1) / nthreads));
+    }
+    for (int t = 0; t < nthreads; t++) {
+        P->workers[t] = (MD5_WORKER) {ctx, P->queues, nthreads, t};
+        pthread_create(&P->threads[t], NULL, fn, &P->workers[t]);
+    }
+}
+
+/* Wait for every worker to run out of jobs */
+void pool_join(MD5_POOL *P) {
+    for (int t = 0; t < P->nthreads; t++) {
+        pthread_join(P->threads[t], NULL);
+    }
+    free(P->threads);
+    free(P->workers);
+    free(P->queues);
+}
+
+/* ------------------------ Check a Manifest -------------------------- 
+* --check <manifest> verifies every file listed in md5sum's format, either
+* "digest  path" (or "digest *path" for binary mode, the same thing here),
+* with md5sum's backslash escapes for names holding newlines, or the BSD style
+* "MD5 (path) = digest". Expected digests are decoded from hex once while the
+* manifest is read, so checking a file is one 16 byte comparison. Files are
+* checked on the worker pool above and each result is printed the moment it's
+* known, "path: OK" or "path: FAILED", so lines come out in completion order.
+* With --fail-fast the first failure stops the workers taking new files and
+* cuts short any file being read, read in MD5_BUFSIZE chunks for that reason
+* rather than through --io */
+atomic_int check_stop = 0;
+int check_fail_fast = 0;
+
+/* Decode 32 hex digits into (MD5_RES), in the order output() prints them. 0 if they aren't hex */
+int md5_unhex(const char *hex, WORD *MD5_RES) {
+    for (int i = 0; i < 16; i++) {
+        int hi = hex[2 * i], lo = hex[2 * i + 1];
+        hi = hi >= '0' && hi <= '9' ? hi - '0' : (hi | 0x20) >= 'a' && (hi | 0x20) <= 'f' ? (hi | 0x20) - 'a' + 10 : -1;
+        lo = lo >= '0' && lo <= '9' ? lo - '0' : (lo | 0x20) >= 'a' && (lo | 0x20) <= 'f' ? (lo | 0x20) - 'a' + 10 : -1;
+        if (hi < 0 || lo < 0) {
+            return 0;
+        }
+        if (i % 4 == 0) {
+            MD5_RES[i / 4] = 0;
+        }
+        MD5_RES[i / 4] |= (WORD) (hi << 4 | lo) << (8 * (i % 4));
+    }
+    return 1;
+}
+
+/*
+    Parse one manifest line into (expect) and a freshly allocated path,
+    NULL if the line isn't in either format.
+*/
+char *check_parse(char *line, WORD *expect) {
+    int escaped = line[0] == '\\';
+    size_t len;
+    char *name;
+
+    line += escaped;
+    len = strlen(line);
+    if (strncmp(line, "MD5 (", 5) == 0 && len > 5 + 4 + 32 && strncmp(line + len - 36, ") = ", 4) == 0) {
+        /* MD5 (path) = digest */
+        if (!md5_unhex(line + len - 32, expect)) {
+            return NULL;
+        }
+        line[len - 36] = '\0';
+        name = line + 5;
+    } else if (len > 34 && line[32] == ' ' && (line[33] == ' ' || line[33] == '*') && md5_unhex(line, expect)) {
+        /* digest  path */
+        name = line + 34;
+    } else {
+        return NULL;
+    }
+
+    name = strdup(name);
+    if (escaped) {
+        /* \\ and \n in the name, md5sum's way of writing backslashes and newlines */
+        char *r = name, *w = name;
+        while (*r) {
+            if (*r == '\\' && (r[1] == '\\' || r[1] == 'n' || r[1] == 'r')) {
+                *w++ = r[1] == 'n' ? '\n' : r[1] == 'r' ? '\r' : '\\';
+                r += 2;
+            } else {
+                *w++ = *r++;
+            }
+        }
+        *w = '\0';
+    }
+    return name;
+}
+
+/* Print "path: result" in one go. Like md5sum, a path with a line break in it
+** is escaped the way check_parse() reads it. Failures are flushed straight
+** away, so a log or pipe shows them as they happen rather than at exit */
+void check_report(const char *path, const char *result) {
+    size_t len = strlen(path);
+    char *line = malloc(2 * len + strlen(result) + 4), *w = line;
+
+    if (strpbrk(path, "\n\r")) {
+        *w++ = '\\';
+        for (const char *r = path; *r; r++) {
+            if (*r == '\\' || *r == '\n' || *r == '\r') {
+                *w++ = '\\';
+                *w++ = *r == '\n' ? 'n' : *r == '\r' ? 'r' : '\\';
+            } else {
+                *w++ = *r;
+            }
+        }
+    } else {
+        memcpy(w, path, len);
+        w += len;
+    }
+    sprintf(w, ": %s\n", result);
+    fputs(line, stdout);
+    if (strcmp(result, "OK") != 0) {
+        fflush(stdout);
+    }
+    free(line);
+}
+
+/* MD5 of the file at (path) read in chunks, giving up if --fail-fast is
+** triggered part way. 0 if it couldn't be read, -1 if it was stopped */
+int check_hash(const char *path, WORD *MD5_RES) {
+    BYTE *buf = md5_read_buffer();
+    MD5_CTX ctx;
+    ssize_t n;
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+
+    if (fd < 0) {
+        return 0;
+    }
+#ifdef POSIX_FADV_SEQUENTIAL
+    posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+    md5_init(&ctx);
+    for (;;) {
+        if (atomic_load_explicit(&check_stop, memory_order_relaxed)) {
+            close(fd);
+            return -1;
+        }
+        STATS_START(t0);
+        n = read(fd, buf, MD5_BUFSIZE);
+        STATS_STOP(io_ns, t0);
+        STATS_ADD(read_calls, 1);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            break;
+        }
+        STATS_ADD(bytes_read, n);
+        md5_update(&ctx, buf, (size_t) n);
+    }
+    close(fd);
+    if (n < 0) {
+        return 0;
+    }
+    memcpy(MD5_RES, ctx.state, sizeof(ctx.state));
+    md5_tail(MD5_RES, ctx.buf, ctx.buflen, ctx.nobytes * 8);
+    return 1;
+}
+
+void *check_worker(void *arg) {
+    MD5_WORKER *W = arg;
+    long i;
+
+    while (!atomic_load_explicit(&check_stop, memory_order_relaxed) && (i = worker_next(W)) >= 0) {
+        MD5_JOB *job = &((MD5_JOBS *) W->ctx)->jobs[i];
+        int read, ok;
+
+        if (check_fail_fast) {
+            read = check_hash(job->path, job->MD5_RES);
+        } else {
+            read = md5_hash_path(job->path, job->MD5_RES);
+        }
+        if (read < 0) {
+            break;
+        }
+        ok = read && memcmp(job->MD5_RES, job->expect, sizeof(job->expect)) == 0;
+        atomic_store_explicit(&job->done, ok ? 1 : -1, memory_order_release);
+
+        STATS_START(t0);
+        check_report(job->path, ok ? "OK" : read ? "FAILED" : "FAILED open or read");
+        STATS_STOP(output_ns, t0);
+        if (!ok && check_fail_fast) {
+            atomic_store(&check_stop, 1);
+        }
+    }
+    md5_stats_flush("worker");
+    return NULL;
+}
+
+/*
+    Verify every file listed in (manifest) on (nthreads) threads. Returns the
+    number of files that failed, or -1 if the manifest couldn't be read.
+*/
+long md5_check(FILE *manifest, int nthreads) {
+    MD5_JOBS J = {NULL, 0, 0};
+    MD5_POOL pool;
+    size_t improper = 0, lineno = 0;
+    long failed = 0, unread = 0;
+    char *line;
+
+    while ((line = read_line(manifest, NULL)) != NULL) {
+        WORD expect[4];
+        char *path = check_parse(line, expect);
+
+        lineno++;
+        if (path) {
+            jobs_add(&J, path);
+            memcpy(J.jobs[J.n - 1].expect, expect, sizeof(expect));
+        } else if (line[0] != '\0' && line[0] != '#') {
+            improper++;
+        }
+        free(line);
+    }
+    if (ferror(manifest)) {
+        return -1;
+    }
+    if (improper) {
+        fprintf(stderr, "Warning: %zu of %zu lines aren't properly formatted MD5 checksum lines.\n", improper, lineno);
+    }
+
+    pool_start(&pool, J.n, nthreads, check_worker, &J);
+    pool_join(&pool);
+
+    for (size_t i = 0; i < J.n; i++) {
+        int done = atomic_load(&J.jobs[i].done);
+        failed += done < 0;
+        unread += done == 0;
+        free(J.jobs[i].path);
+    }
+    free(J.jobs);
+    if (failed) {
+        fprintf(stderr, "Warning: %ld of %zu files did NOT match.\n", failed, J.n);
+    }
+    if (unread) {
+        fprintf(stderr, "Stopped after the first failure, %ld files not checked.\n", unread);
+    }
+    return failed + (improper && !J.n);
+}
+
+/* ------------------------- Duplicate Files -------------------------- 
+* --dupes walks the paths given like --hashfile and prints groups of files
+* with identical contents, reading as little as it can on the way:
+*
+*   1. stat(2) every file. Only files sharing a size with another can be
+*      duplicates, and a path to an inode already seen (a hard link, or a
+*      symlink the walk followed) is the same blob so it's dropped here.
+*   2. Hash the first and last MD5_DUPE_EDGE bytes of each remaining file.
+*      Files up to twice that are read whole, so this is their real digest.
+*   3. Files which still share a size and edge digest get a full MD5.
+*
+* Each pass runs on the worker pool with its files sorted by device and
+* inode, roughly their order on disk, and edge reads are marked random so the
+* kernel doesn't read ahead past them. Empty files are ignored. Groups are
+* printed biggest first as "digest  path" lines with a blank line between
+* groups, and a summary on stderr gives the bytes read against the total */
+#define MD5_DUPE_EDGE (64 << 10)
+
+typedef struct {
+    char *path;
+    uint64_t size;
+    uint64_t dev;
+    uint64_t ino;
+    WORD edge[4];       // MD5 of the first and last MD5_DUPE_EDGE bytes
+    WORD MD5_RES[4];    // Full digest, once (whole) is set
+    int whole;          // The file was small enough for edge to be the full digest
+    int ok;             // 0 once the file turns out unreadable, or not worth reading
+} MD5_DUPE;
+
+typedef struct {
+    MD5_DUPE **files;
+    _Atomic uint64_t bytes_read;
+} MD5_DUPES;
+
+int dupe_by_inode(const void *x, const void *y) {
+    const MD5_DUPE *a = *(MD5_DUPE * const *) x, *b = *(MD5_DUPE * const *) y;
+
+    if (a->dev != b->dev) {
+        return a->dev < b->dev ? -1 : 1;
+    }
+    if (a->ino != b->ino) {
+        return a->ino < b->ino ? -1 : 1;
+    }
+    /* Paths to the same inode in a fixed order, so the same one is kept every run */
+    return strcmp(a->path, b->path);
+}
+
+int dupe_by_size(const void *x, const void *y) {
+    const MD5_DUPE *a = *(MD5_DUPE * const *) x, *b = *(MD5_DUPE * const *) y;
+
+    if (a->size != b->size) {
+        return a->size < b->size ? 1 : -1;
+    }
+    return dupe_by_inode(x, y);
+}
+
+int dupe_by_edge(const void *x, const void *y) {
+    const MD5_DUPE *a = *(MD5_DUPE * const *) x, *b = *(MD5_DUPE * const *) y;
+    int c = a->size != b->size ? (a->size < b->size ? 1 : -1) : memcmp(a->edge, b->edge, sizeof(a->edge));
+
+    return c ? c : dupe_by_inode(x, y);
+}
+
+/* Biggest first, then by digest, then by path so the output is the same every run */
+int dupe_by_digest(const void *x, const void *y) {
+    const MD5_DUPE *a = *(MD5_DUPE * const *) x, *b = *(MD5_DUPE * const *) y;
+    int c = a->size != b->size ? (a->size < b->size ? 1 : -1) : memcmp(a->MD5_RES, b->MD5_RES, sizeof(a->MD5_RES));
+
+    return c ? c : strcmp(a->path, b->path);
+}
+
+void *dupe_stat_worker(void *arg) {
+    MD5_WORKER *W = arg;
+    MD5_DUPES *D = W->ctx;
+    struct stat st;
+    long i;
+
+    while ((i = worker_next(W)) >= 0) {
+        MD5_DUPE *f = D->files[i];
+        f->ok = stat(f->path, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0;
+        if (f->ok) {
+            f->size = (uint64_t) st.st_size;
+            f->dev = (uint64_t) st.st_dev;
+            f->ino = (uint64_t) st.st_ino;
+        }
+    }
+    return NULL;
+}
+
+void *dupe_edge_worker(void *arg) {
+    MD5_WORKER *W = arg;
+    MD5_DUPES *D = W->ctx;
+    BYTE *buf = md5_read_buffer();
+    long i;
+
+    while ((i = worker_next(W)) >= 0) {
+        MD5_DUPE *f = D->files[i];
+        size_t len = f->size <= 2 * MD5_DUPE_EDGE ? (size_t) f->size : 2 * MD5_DUPE_EDGE, got;
+        ssize_t head, tail = 0;
+        int fd = open(f->path, O_RDONLY | O_CLOEXEC);
+
+        if (fd < 0) {
+            f->ok = 0;
+            continue;
+        }
+#ifdef POSIX_FADV_RANDOM
+        posix_fadvise(fd, 0, 0, POSIX_FADV_RANDOM);
+#endif
+        STATS_START(t0);
+        if (len < 2 * MD5_DUPE_EDGE) {
+            head = pread_full(fd, buf, len, 0);
+        } else {
+            head = pread_full(fd, buf, MD5_DUPE_EDGE, 0);
+            tail = pread_full(fd, buf + MD5_DUPE_EDGE, MD5_DUPE_EDGE, (off_t) (f->size - MD5_DUPE_EDGE));
+        }
+        got = head < 0 || tail < 0 ? 0 : (size_t) (head + tail);
+        STATS_STOP(io_ns, t0);
+        STATS_ADD(read_calls, 1 + (len == 2 * MD5_DUPE_EDGE));
+        STATS_ADD(bytes_read, got);
+        close(fd);
+        atomic_fetch_add(&D->bytes_read, got);
+
+        /* A file that couldn't be read, or changed size since it was stat()ed, is left out */
+        if (got != len) {
+            f->ok = 0;
+            continue;
+        }
+        md5_buffer(buf, len, f->edge);
+        if (f->size <= 2 * MD5_DUPE_EDGE) {
+            memcpy(f->MD5_RES, f->edge, sizeof(f->edge));
+            f->whole = 1;
+        }
+    }
+    md5_stats_flush("worker");
+    return NULL;
+}
+
+void *dupe_full_worker(void *arg) {
+    MD5_WORKER *W = arg;
+    MD5_DUPES *D = W->ctx;
+    long i;
+
+    while ((i = worker_next(W)) >= 0) {
+        MD5_DUPE *f = D->files[i];
+
+        f->whole = md5_hash_path(f->path, f->MD5_RES);
+        f->ok = f->whole;
+        atomic_fetch_add(&D->bytes_read, f->whole ? f->size : 0);
+    }
+    md5_stats_flush("worker");
+    return NULL;
+}
+
+/* Run (fn) over the first (n) files of (D) on the pool, in inode order */
+void dupe_pass(MD5_DUPES *D, size_t n, int nthreads, void *(*fn)(void *)) {
+    MD5_POOL pool;
+
+    qsort(D->files, n, sizeof(MD5_DUPE *), dupe_by_inode);
+    pool_start(&pool, n, nthreads, fn, D);
+    pool_join(&pool);
+}
+
+/*
+    Keep the files of (files) which are in a run of two or more equal under
+    (cmp), moving them to the front. Returns how many there are.
+*/
+size_t dupe_keep_runs(MD5_DUPE **files, size_t n, int (*cmp)(const MD5_DUPE *, const MD5_DUPE *)) {
+    size_t kept = 0, i = 0, j;
+
+    while (i < n) {
+        for (j = i + 1; j < n && cmp(files[i], files[j]) == 0; j++);
+        if (j - i > 1) {
+            memmove(files + kept, files + i, (j - i) * sizeof(MD5_DUPE *));
+            kept += j - i;
+        }
+        i = j;
+    }
+    return kept;
+}
+
+/* 0 if (a) and (b) can't be told apart yet, for dupe_keep_runs() */
+int dupe_cmp_size(const MD5_DUPE *a, const MD5_DUPE *b) {
+    return a->size != b->size;
+}
+
+int dupe_cmp_edge(const MD5_DUPE *a, const MD5_DUPE *b) {
+    return a->size != b->size || memcmp(a->edge, b->edge, sizeof(a->edge)) != 0;
+}
+
+int dupe_cmp_digest(const MD5_DUPE *a, const MD5_DUPE *b) {
+    return a->size != b->size || memcmp(a->MD5_RES, b->MD5_RES, sizeof(a->MD5_RES)) != 0;
+}
+
+/* Drop files that failed the last pass, and all but the first path to each inode */
+size_t dupe_keep_ok(MD5_DUPE **files, size_t n) {
+    size_t kept = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        if (files[i]->ok && !(kept && files[kept - 1]->dev == files[i]->dev && files[kept - 1]->ino == files[i]->ino)) {
+            files[kept++] = files[i];
+        }
+    }
+    return kept;
+}
+
+/*
+    Print groups of identical files found under (paths) using (nthreads)
+    threads. Returns the number of groups found.
+*/
+size_t md5_dupes(char **paths, int npaths, int nthreads) {
+    MD5_JOBS J = {NULL, 0, 0};
+    MD5_DUPES D;
+    MD5_DUPE *all;
+    uint64_t total = 0, wasted = 0;
+    size_t n, groups = 0, extra = 0;
+
+    for (int i = 0; i < npaths; i++) {
+        jobs_add_path(&J, paths[i]);
+    }
+    all = calloc(J.n ? J.n : 1, sizeof(MD5_DUPE));
+    D.files = malloc((J.n ? J.n : 1) * sizeof(MD5_DUPE *));
+    atomic_init(&D.bytes_read, 0);
+    for (size_t i = 0; i < J.n; i++) {
+        all[i].path = J.jobs[i].path;
+        D.files[i] = &all[i];
+    }
+
+    /* 1. Sizes, only those shared by two or more inodes can hold duplicates */
+    dupe_pass(&D, J.n, nthreads, dupe_stat_worker);
+    n = dupe_keep_ok(D.files, J.n);
+    for (size_t i = 0; i < n; i++) {
+        total += D.files[i]->size;
+    }
+    qsort(D.files, n, sizeof(MD5_DUPE *), dupe_by_size);
+    n = dupe_keep_runs(D.files, n, dupe_cmp_size);
+
+    /* 2. First and last MD5_DUPE_EDGE bytes */
+    dupe_pass(&D, n, nthreads, dupe_edge_worker);
+    n = dupe_keep_ok(D.files, n);
+    qsort(D.files, n, sizeof(MD5_DUPE *), dupe_by_edge);
+    n = dupe_keep_runs(D.files, n, dupe_cmp_edge);
+
+    /* 3. Everything, for the files whose edges weren't already the whole file */
+    size_t big = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (!D.files[i]->whole) {
+            MD5_DUPE *f = D.files[big];
+            D.files[big++] = D.files[i];
+            D.files[i] = f;
+        }
+    }
+    dupe_pass(&D, big, nthreads, dupe_full_worker);
+    n = dupe_keep_ok(D.files, n);
+    qsort(D.files, n, sizeof(MD5_DUPE *), dupe_by_digest);
+    n = dupe_keep_runs(D.files, n, dupe_cmp_digest);
+
+    for (size_t i = 0; i < n; i++) {
+        if (i > 0 && dupe_cmp_digest(D.files[i - 1], D.files[i]) == 0) {
+            extra++;
+            wasted += D.files[i]->size;
+        } else if (i > 0) {
+            groups++;
+            printf("\n");
+        }
+        output(D.files[i]->MD5_RES);
+        STATS_START(t0);
+        printf("  %s\n", D.files[i]->path);
+        STATS_STOP(output_ns, t0);
+    }
+    groups += n > 0;
+
+    fprintf(stderr, "%zu groups, %zu duplicate files, %" PRIu64 " bytes in duplicates. "
+                    "Read %" PRIu64 " of %" PRIu64 " bytes (%.2f%%).\n", groups, extra, wasted,
+            atomic_load(&D.bytes_read), total, total ? 100.0 * atomic_load(&D.bytes_read) / total : 0.0);
+
+    for (size_t i = 0; i < J.n; i++) {
+        free(J.jobs[i].path);
+    }
+    free(J.jobs);
+    free(D.files);
+    free(all);
+    return groups;
+}
+#endif
+
+/* ------------------ Multi-Lane MD5 (Many Messages) ------------------ 
+* A single MD5 stream can't be vectorised since every step depends on the last,
+* but independent messages can. The engine below keeps one message per SIMD
+* lane, 4 lanes with SSE2, 8 with AVX2 and 16 with AVX-512. Each call
+* compresses one block for every active lane, lanes which have nothing left to
+* hash are masked out so their state is left untouched */
+#define MD5_MAX_LANES 16
+
+/*
+    Lane state in structure-of-arrays form. state[w][l] is chaining word w
+    (0 = A .. 3 = D) of lane l, X[w][l] is message word w of the block being
+    compressed for lane l. Aligned so each row is a single vector load.
+*/
+typedef struct {
+    _Alignas(64) WORD state[4][MD5_MAX_LANES];
+    _Alignas(64) WORD X[16][MD5_MAX_LANES];
+} MD5_LANES;
+
+/* Transpose the block for lane (l) into column (l) of the message words */
+void md5_lanes_load(MD5_LANES *L, int l, const BLOCK *M) {
+    for (int w = 0; w < 16; w++) {
+        L->X[w][l] = M->threetwo[w];
+    }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h> // SSE2, AVX2 and AVX-512 intrinsics
+
+/*
+    Step macros for the vector kernels, same shape as STEP_F .. STEP_I. SSE2 and
+    AVX2 have no rotate instruction so ROTL is two shifts and an OR, ONES has to be
+    in scope for the NOT in I.
+*/
+#define V4_ROTL(x,s) _mm_or_si128(_mm_slli_epi32(x, s), _mm_srli_epi32(x, 32 - (s)))
+#define V4_STEP(a,b,m,s,t,f) { a = _mm_add_epi32(a, _mm_add_epi32(m, _mm_set1_epi32((int)(t)))); \
+                               a = _mm_add_epi32(a, f); a = _mm_add_epi32(b, V4_ROTL(a, s)); }
+#define V4_F(a,b,c,d,m,s,t) V4_STEP(a, b, m, s, t, _mm_xor_si128(_mm_and_si128(_mm_xor_si128(c, d), b), d))
+#define V4_G(a,b,c,d,m,s,t) V4_STEP(a, b, m, s, t, _mm_add_epi32(_mm_andnot_si128(d, c), _mm_and_si128(d, b)))
+#define V4_H(a,b,c,d,m,s,t) V4_STEP(a, b, m, s, t, _mm_xor_si128(_mm_xor_si128(b, c), d))
+#define V4_I(a,b,c,d,m,s,t) V4_STEP(a, b, m, s, t, _mm_xor_si128(c, _mm_or_si128(b, _mm_xor_si128(d, ONES))))
+
+#define V8_ROTL(x,s) _mm256_or_si256(_mm256_slli_epi32(x, s), _mm256_srli_epi32(x, 32 - (s)))
+#define V8_STEP(a,b,m,s,t,f) { a = _mm256_add_epi32(a, _mm256_add_epi32(m, _mm256_set1_epi32((int)(t)))); \
+                               a = _mm256_add_epi32(a, f); a = _mm256_add_epi32(b, V8_ROTL(a, s)); }
+#define V8_F(a,b,c,d,m,s,t) V8_STEP(a, b, m, s, t, _mm256_xor_si256(_mm256_and_si256(_mm256_xor_si256(c, d), b), d))
+#define V8_G(a,b,c,d,m,s,t) V8_STEP(a, b, m, s, t, _mm256_add_epi32(_mm256_andnot_si256(d, c), _mm256_and_si256(d, b)))
+#define V8_H(a,b,c,d,m,s,t) V8_STEP(a, b, m, s, t, _mm256_xor_si256(_mm256_xor_si256(b, c), d))
+#define V8_I(a,b,c,d,m,s,t) V8_STEP(a, b, m, s, t, _mm256_xor_si256(c, _mm256_or_si256(b, _mm256_xor_si256(d, ONES))))
+
+/*
+    AVX-512 has a real rotate (VPROLD) and VPTERNLOGD evaluates any three input
+    boolean function in one instruction, the immediate being its truth table:
+    0xCA = select (x ? y : z), 0x96 = x ^ y ^ z, 0x39 = y ^ (x | ~z).
+    F is select(b, c, d) and G is select(d, b, c).
+*/
+#define V16_STEP(a,b,m,s,t,f) { a = _mm512_add_epi32(a, _mm512_add_epi32(m, _mm512_set1_epi32((int)(t)))); \
+                                a = _mm512_add_epi32(a, f); a = _mm512_add_epi32(b, _mm512_rol_epi32(a, s)); }
+#define V16_F(a,b,c,d,m,s,t) V16_STEP(a, b, m, s, t, _mm512_ternarylogic_epi32(b, c, d, 0xCA))
+#define V16_G(a,b,c,d,m,s,t) V16_STEP(a, b, m, s, t, _mm512_ternarylogic_epi32(d, b, c, 0xCA))
+#define V16_H(a,b,c,d,m,s,t) V16_STEP(a, b, m, s, t, _mm512_ternarylogic_epi32(b, c, d, 0x96))
+#define V16_I(a,b,c,d,m,s,t) V16_STEP(a, b, m, s, t, _mm512_ternarylogic_epi32(b, c, d, 0x39))
+
+/* Lanes 0 .. 3, (active) has bit l set for each lane that should be updated */
+void md5_x4_sse2(MD5_LANES *L, uint32_t active) {
+    const __m128i ONES = _mm_set1_epi32(-1);
+    const __m128i bits = _mm_set_epi32(8, 4, 2, 1);
+    const __m128i mask = _mm_cmpeq_epi32(_mm_and_si128(_mm_set1_epi32((int)active), bits), bits);
+
+    __m128i a = _mm_load_si128((const __m128i *) L->state[0]);
+    __m128i b = _mm_load_si128((const __m128i *) L->state[1]);
+    __m128i c = _mm_load_si128((const __m128i *) L->state[2]);
+    __m128i d = _mm_load_si128((const __m128i *) L->state[3]);
+    const __m128i a0 = a, b0 = b, c0 = c, d0 = d;
+
+    const __m128i X0  = _mm_load_si128((const __m128i *) L->X[0]),  X1  = _mm_load_si128((const __m128i *) L->X[1]);
+    const __m128i X2  = _mm_load_si128((const __m128i *) L->X[2]),  X3  = _mm_load_si128((const __m128i *) L->X[3]);
+    const __m128i X4  = _mm_load_si128((const __m128i *) L->X[4]),  X5  = _mm_load_si128((const __m128i *) L->X[5]);
+    const __m128i X6  = _mm_load_si128((const __m128i *) L->X[6]),  X7  = _mm_load_si128((const __m128i *) L->X[7]);
+    const __m128i X8  = _mm_load_si128((const __m128i *) L->X[8]),  X9  = _mm_load_si128((const __m128i *) L->X[9]);
+    const __m128i X10 = _mm_load_si128((const __m128i *) L->X[10]), X11 = _mm_load_si128((const __m128i *) L->X[11]);
+    const __m128i X12 = _mm_load_si128((const __m128i *) L->X[12]), X13 = _mm_load_si128((const __m128i *) L->X[13]);
+    const __m128i X14 = _mm_load_si128((const __m128i *) L->X[14]), X15 = _mm_load_si128((const __m128i *) L->X[15]);
+
+    MD5_STEPS(V4_F, V4_G, V4_H, V4_I)
+
+    /* Feed forward only where the lane is active, inactive lanes keep their state */
+    _mm_store_si128((__m128i *) L->state[0], _mm_add_epi32(a0, _mm_and_si128(a, mask)));
+    _mm_store_si128((__m128i *) L->state[1], _mm_add_epi32(b0, _mm_and_si128(b, mask)));
+    _mm_store_si128((__m128i *) L->state[2], _mm_add_epi32(c0, _mm_and_si128(c, mask)));
+    _mm_store_si128((__m128i *) L->state[3], _mm_add_epi32(d0, _mm_and_si128(d, mask)));
+}
+
+/* Lanes 0 .. 7 */
+__attribute__((target("avx2")))
+void md5_x8_avx2(MD5_LANES *L, uint32_t active) {
+    const __m256i ONES = _mm256_set1_epi32(-1);
+    const __m256i bits = _mm256_set_epi32(128, 64, 32, 16, 8, 4, 2, 1);
+    const __m256i mask = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32((int)active), bits), bits);
+
+    __m256i a = _mm256_load_si256((const __m256i *) L->state[0]);
+    __m256i b = _mm256_load_si256((const __m256i *) L->state[1]);
+    __m256i c = _mm256_load_si256((const __m256i *) L->state[2]);
+    __m256i d = _mm256_load_si256((const __m256i *) L->state[3]);
+    const __m256i a0 = a, b0 = b, c0 = c, d0 = d;
+
+    const __m256i X0  = _mm256_load_si256((const __m256i *) L->X[0]),  X1  = _mm256_load_si256((const __m256i *) L->X[1]);
+    const __m256i X2  = _mm256_load_si256((const __m256i *) L->X[2]),  X3  = _mm256_load_si256((const __m256i *) L->X[3]);
+    const __m256i X4  = _mm256_load_si256((const __m256i *) L->X[4]),  X5  = _mm256_load_si256((const __m256i *) L->X[5]);
+    const __m256i X6  = _mm256_load_si256((const __m256i *) L->X[6]),  X7  = _mm256_load_si256((const __m256i *) L->X[7]);
+    const __m256i X8  = _mm256_load_si256((const __m256i *) L->X[8]),  X9  = _mm256_load_si256((const __m256i *) L->X[9]);
+    const __m256i X10 = _mm256_load_si256((const __m256i *) L->X[10]), X11 = _mm256_load_si256((const __m256i *) L->X[11]);
+    const __m256i X12 = _mm256_load_si256((const __m256i *) L->X[12]), X13 = _mm256_load_si256((const __m256i *) L->X[13]);
+    const __m256i X14 = _mm256_load_si256((const __m256i *) L->X[14]), X15 = _mm256_load_si256((const __m256i *) L->X[15]);
+
+    MD5_STEPS(V8_F, V8_G, V8_H, V8_I)
+
+    _mm256_store_si256((__m256i *) L->state[0], _mm256_add_epi32(a0, _mm256_and_si256(a, mask)));
+    _mm256_store_si256((__m256i *) L->state[1], _mm256_add_epi32(b0, _mm256_and_si256(b, mask)));
+    _mm256_store_si256((__m256i *) L->state[2], _mm256_add_epi32(c0, _mm256_and_si256(c, mask)));
+    _mm256_store_si256((__m256i *) L->state[3], _mm256_add_epi32(d0, _mm256_and_si256(d, mask)));
+}
+
+/* Lanes 0 .. 15, the active bits are used directly as an AVX-512 write mask */
+__attribute__((target("avx512f")))
+void md5_x16_avx512(MD5_LANES *L, uint32_t active) {
+    const __mmask16 mask = (__mmask16) active;
+
+    __m512i a = _mm512_load_si512(L->state[0]);
+    __m512i b = _mm512_load_si512(L->state[1]);
+    __m512i c = _mm512_load_si512(L->state[2]);
+    __m512i d = _mm512_load_si512(L->state[3]);
+    const __m512i a0 = a, b0 = b, c0 = c, d0 = d;
+
+    const __m512i X0  = _mm512_load_si512(L->X[0]),  X1  = _mm512_load_si512(L->X[1]);
+    const __m512i X2  = _mm512_load_si512(L->X[2]),  X3  = _mm512_load_si512(L->X[3]);
+    const __m512i X4  = _mm512_load_si512(L->X[4]),  X5  = _mm512_load_si512(L->X[5]);
+    const __m512i X6  = _mm512_load_si512(L->X[6]),  X7  = _mm512_load_si512(L->X[7]);
+    const __m512i X8  = _mm512_load_si512(L->X[8]),  X9  = _mm512_load_si512(L->X[9]);
+    const __m512i X10 = _mm512_load_si512(L->X[10]), X11 = _mm512_load_si512(L->X[11]);
+    const __m512i X12 = _mm512_load_si512(L->X[12]), X13 = _mm512_load_si512(L->X[13]);
+    const __m512i X14 = _mm512_load_si512(L->X[14]), X15 = _mm512_load_si512(L->X[15]);
+
+    MD5_STEPS(V16_F, V16_G, V16_H, V16_I)
+
+    _mm512_store_si512(L->state[0], _mm512_mask_add_epi32(a0, mask, a0, a));
+    _mm512_store_si512(L->state[1], _mm512_mask_add_epi32(b0, mask, b0, b));
+    _mm512_store_si512(L->state[2], _mm512_mask_add_epi32(c0, mask, c0, c));
+    _mm512_store_si512(L->state[3], _mm512_mask_add_epi32(d0, mask, d0, d));
+}
+#endif
+
+/* Scalar stand-in with the same shape as the vector kernels, one lane at a time */
+void md5_x1_scalar(MD5_LANES *L, uint32_t active) {
+    BLOCK M;
+    WORD res[4];
+    for (int w = 0; w < 16; w++) {
+        M.threetwo[w] = L->X[w][0];
+    }
+    if (active & 1) {
+        for (int w = 0; w < 4; w++) res[w] = L->state[w][0];
+        md5(&M, res);
+        for (int w = 0; w < 4; w++) L->state[w][0] = res[w];
+    }
+}
+
+typedef void (*MD5_LANES_FN)(MD5_LANES *L, uint32_t active);
+
+/* Pick the widest kernel this CPU can run, (*lanes) receives its lane count */
+MD5_LANES_FN md5_lanes_kernel(int *lanes) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        *lanes = 16;
+        return md5_x16_avx512;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        *lanes = 8;
+        return md5_x8_avx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        *lanes = 4;
+        return md5_x4_sse2;
+    }
+#endif
+    *lanes = 1;
+    return md5_x1_scalar;
+}
+
+/*
+    Hash (lanes) messages of (len) bytes each, stored back to back from (buf),
+    one per lane. The equal length case of md5_multi_with(), every lane has
+    the same number of blocks so all of them stay active until the padding
+    blocks at the end.
+*/
+void md5_lanes_buffers(MD5_LANES_FN kernel, int lanes, const BYTE *buf, size_t len, WORD (*MD5_RES)[4]) {
+    MD5_LANES L;
+    BLOCK tail[MD5_MAX_LANES][2];
+    const uint32_t all = (uint32_t) ((1ull << lanes) - 1);
+    size_t rem = len & 63, notail = (rem < 56) ? 1 : 2;
+
+    for (int l = 0; l < lanes; l++) {
+        L.state[0][l] = A; L.state[1][l] = B; L.state[2][l] = C; L.state[3][l] = D;
+    }
+
+    for (size_t b = 0; b < len / 64; b++) {
+        for (int l = 0; l < lanes; l++) {
+            const BYTE *p = buf + l * len + 64 * b;
+            for (int w = 0; w < 16; w++) {
+                L.X[w][l] = LOAD32(p + 4 * w);
+            }
+        }
+        kernel(&L, all);
+    }
+
+    /* The padded tail, laid out as md5_tail() does it */
+    for (int l = 0; l < lanes; l++) {
+        memset(tail[l], 0, sizeof(tail[l]));
+        memcpy(tail[l][0].eight, buf + l * len + (len & ~(size_t) 63), rem);
+        tail[l][0].eight[rem] = 0x80;
+        tail[l][notail - 1].sixfour[7] = (uint64_t) len * 8;
+    }
+    for (size_t t = 0; t < notail; t++) {
+        for (int l = 0; l < lanes; l++) {
+            md5_lanes_load(&L, l, &tail[l][t]);
+        }
+        kernel(&L, all);
+    }
+
+    for (int l = 0; l < lanes; l++) {
+        for (int w = 0; w < 4; w++) MD5_RES[l][w] = L.state[w][l];
+    }
+}
+
+/* ----------------------------- HMAC-MD5 ------------------------------ 
+* HMAC(K, m) = MD5((K ^ opad) || MD5((K ^ ipad) || m)), with the key padded
+* to a block (or hashed first if it's longer than one). The two key blocks
+* are the same for every message, so md5_hmac_key() compresses them once
+* into the chaining values they leave behind and every message only pays for
+* its own blocks plus the one outer block. md5_hmac_lanes() runs many messages
+* for the same key side by side on the multi-lane kernels above, each lane
+* going through its message's blocks, its padding and then its outer block
+* before taking the next message */
+
+/* A message in memory */
+typedef struct {
+    const BYTE *p;
+    size_t len;
+} MD5_RECORD;
+
+/* The chaining values after each key block, all a key is needed for from then on */
+typedef struct {
+    WORD inner[4]; // After K ^ ipad
+    WORD outer[4]; // After K ^ opad
+} MD5_HMAC_KEY;
+
+void md5_hmac_key(MD5_HMAC_KEY *K, const BYTE *key, size_t len) {
+    BYTE k[64] = {0};
+    BLOCK M;
+
+    /* A key longer than a block is replaced by its digest */
+    if (len > 64) {
+        WORD MD5_RES[4];
+        md5_buffer(key, len, MD5_RES);
+        memcpy(k, MD5_RES, 16);
+    } else {
+        memcpy(k, key, len);
+    }
+
+    K->inner[0] = K->outer[0] = A;
+    K->inner[1] = K->outer[1] = B;
+    K->inner[2] = K->outer[2] = C;
+    K->inner[3] = K->outer[3] = D;
+    for (int i = 0; i < 64; i++) M.eight[i] = k[i] ^ 0x36;
+    md5(&M, K->inner);
+    for (int i = 0; i < 64; i++) M.eight[i] = k[i] ^ 0x5c;
+    md5(&M, K->outer);
+}
+
+/* Read all of a file into memory with a terminating zero, NULL if it can't be read */
+BYTE *md5_read_file(const char *path, size_t *len) {
+    FILE *in = fopen(path, "rb");
+    size_t cap = 1 << 16, got;
+    BYTE *data;
+
+    if (!in) {
+        return NULL;
+    }
+    data = malloc(cap + 1);
+    *len = 0;
+    while ((got = fread(data + *len, 1, cap - *len, in)) > 0) {
+        *len += got;
+        if (*len == cap) {
+            cap *= 2;
+            data = realloc(data, cap + 1);
+        }
+    }
+    fclose(in);
+    data[*len] = '\0';
+    return data;
+}
+
+/* The outer block, the inner digest padded as the tail of a 64 + 16 byte message */
+void md5_hmac_outer_block(BLOCK *M, const WORD *inner) {
+    memset(M->eight, 0, 64);
+    memcpy(M->threetwo, inner, 16);
+    M->eight[16] = 0x80;
+    M->sixfour[7] = (64 + 16) * 8;
+}
+
+/* HMAC of (len) bytes at (data) under the key (K) */
+void md5_hmac(const MD5_HMAC_KEY *K, const void *data, size_t len, WORD *MD5_RES) {
+    WORD inner[4];
+    BLOCK M;
+
+    memcpy(inner, K->inner, sizeof(inner));
+    md5_blocks(inner, data, len / 64);
+    md5_tail(inner, (const BYTE *) data + (len & ~(size_t) 63), len & 63, (uint64_t) (64 + len) * 8);
+
+    md5_hmac_outer_block(&M, inner);
+    memcpy(MD5_RES, K->outer, 16);
+    md5(&M, MD5_RES);
+}
+
+/*
+    Block (b) of (R) once its whole blocks are used up, padding included, laid
+    out as md5_tail() would for a message of (nobits) bits in all. For the
+    inner hash that's the key block plus the message.
+*/
+void md5_record_block(BLOCK *M, const MD5_RECORD *R, size_t b, size_t nblocks, uint64_t nobits) {
+    size_t start = 64 * b;
+
+    memset(M->eight, 0, 64);
+    if (start <= R->len) {
+        memcpy(M->eight, R->p + start, R->len - start);
+        M->eight[R->len - start] = 0x80;
+    }
+    if (b == nblocks - 1) {
+        M->sixfour[7] = nobits;
+    }
+}
+
+/*
+    HMAC of (n) messages under the same key, MD5_RES[i] receives that of R[i].
+    Each lane runs one message at a time: its full blocks straight from memory,
+    one or two padding blocks, then the outer block once its state holds the
+    inner digest. Messages of different lengths just finish at different times
+    and the lane moves on to the next one.
+*/
+void md5_hmac_lanes(MD5_LANES_FN kernel, int lanes, const MD5_HMAC_KEY *K, const MD5_RECORD *R, size_t n,
+                    WORD (*MD5_RES)[4]) {
+    MD5_LANES L;
+    BLOCK M;
+    size_t job[MD5_MAX_LANES], b[MD5_MAX_LANES], nblocks[MD5_MAX_LANES], next = 0;
+    uint32_t active = 0;
+
+    for (int l = 0; l < lanes; l++) {
+        job[l] = SIZE_MAX;
+    }
+
+    for (;;) {
+        for (int l = 0; l < lanes; l++) {
+            /* The outer block has been through, this lane's message is done */
+            if (job[l] != SIZE_MAX && b[l] > nblocks[l]) {
+                for (int w = 0; w < 4; w++) MD5_RES[job[l]][w] = L.state[w][l];
+                job[l] = SIZE_MAX;
+            }
+            if (job[l] == SIZE_MAX) {
+                if (next == n) {
+                    active &= ~(1u << l);
+                    continue;
+                }
+                job[l] = next++;
+                b[l] = 0;
+                nblocks[l] = (R[job[l]].len + 8) / 64 + 1;
+                for (int w = 0; w < 4; w++) L.state[w][l] = K->inner[w];
+                active |= 1u << l;
+            }
+
+            const MD5_RECORD *r = &R[job[l]];
+            if (64 * (b[l] + 1) <= r->len) {
+                const BYTE *p = r->p + 64 * b[l];
+                for (int w = 0; w < 16; w++) {
+                    L.X[w][l] = LOAD32(p + 4 * w);
+                }
+            } else if (b[l] < nblocks[l]) {
+                md5_record_block(&M, r, b[l], nblocks[l], (uint64_t) (64 + r->len) * 8);
+                md5_lanes_load(&L, l, &M);
+            } else {
+                WORD inner[4] = { L.state[0][l], L.state[1][l], L.state[2][l], L.state[3][l] };
+                md5_hmac_outer_block(&M, inner);
+                md5_lanes_load(&L, l, &M);
+                for (int w = 0; w < 4; w++) L.state[w][l] = K->outer[w];
+            }
+            b[l]++;
+        }
+        if (!active) {
+            break;
+        }
+        STATS_START(t0);
+        kernel(&L, active);
+        STATS_STOP(compress_ns, t0);
+        STATS_ADD(blocks, __builtin_popcount(active));
+    }
+}
+
+/* ----------------------- Small Files in Lanes ----------------------- 
+* One small file hashed on its own costs a few blocks of compression and a
+* round of setup either side. md5_many() below runs the --hashfile job list on
+* the worker pool, and each worker gathers up to one file per lane of those
+* no bigger than MD5_LANE_FILE, reads each whole, and hashes them together on
+* the multi-lane kernels. Bigger files, and anything that isn't a regular
+* file, are hashed on their own through md5_hash_path() as before */
+#define MD5_LANE_FILE (64 << 10)
+
+/*
+    Hash (n) independent messages in memory, MD5_RES[i] receives the digest of
+    R[i]. Each lane runs one message at a time, its whole blocks straight from
+    memory then one or two padding blocks, and is handed the next message as
+    soon as it's done. Once the queue runs dry the lane is masked out until the
+    slowest lane is done. md5_multi_with() runs a specific kernel, md5_multi()
+    the widest one available.
+*/
+void md5_multi_with(MD5_LANES_FN kernel, int lanes, const MD5_RECORD *R, size_t n, WORD (*MD5_RES)[4]) {
+    MD5_LANES L;
+    BLOCK M;
+    size_t job[MD5_MAX_LANES], b[MD5_MAX_LANES], nblocks[MD5_MAX_LANES], next = 0;
+    uint32_t active = 0;
+
+    for (int l = 0; l < lanes; l++) {
+        job[l] = SIZE_MAX;
+    }
+
+    for (;;) {
+        for (int l = 0; l < lanes; l++) {
+            /* The last padding block has been through, this lane's message is done */
+            if (job[l] != SIZE_MAX && b[l] == nblocks[l]) {
+                for (int w = 0; w < 4; w++) MD5_RES[job[l]][w] = L.state[w][l];
+                job[l] = SIZE_MAX;
+            }
+            if (job[l] == SIZE_MAX) {
+                if (next == n) {
+                    active &= ~(1u << l);
+                    continue;
+                }
+                job[l] = next++;
+                b[l] = 0;
+                nblocks[l] = (R[job[l]].len + 8) / 64 + 1;
+                L.state[0][l] = A; L.state[1][l] = B; L.state[2][l] = C; L.state[3][l] = D;
+                active |= 1u << l;
+            }
+
+            const MD5_RECORD *r = &R[job[l]];
+            if (64 * (b[l] + 1) <= r->len) {
+                const BYTE *p = r->p + 64 * b[l];
+                for (int w = 0; w < 16; w++) {
+                    L.X[w][l] = LOAD32(p + 4 * w);
+                }
+            } else {
+                md5_record_block(&M, r, b[l], nblocks[l], (uint64_t) r->len * 8);
+                md5_lanes_load(&L, l, &M);
+            }
+            b[l]++;
+        }
+        if (!active) {
+            break;
+        }
+        STATS_START(t0);
+        kernel(&L, active);
+        STATS_STOP(compress_ns, t0);
+        STATS_ADD(blocks, __builtin_popcount(active));
+    }
+}
+
+void md5_multi(const MD5_RECORD *R, size_t n, WORD (*MD5_RES)[4]) {
+    int lanes;
+    MD5_LANES_FN kernel = md5_lanes_kernel(&lanes);
+    md5_multi_with(kernel, lanes, R, n, MD5_RES);
+}
+
+#ifdef MD5_HAVE_PTHREAD
+/*
+    Work through the --hashfile jobs, gathering small files for the lanes and
+    hashing the rest as they come. Each worker has its own lane buffers.
+*/
+void *md5_worker(void *arg) {
+    MD5_WORKER *W = arg;
+    MD5_JOBS *J = W->ctx;
+    MD5_SMALL S[MD5_MAX_LANES];
+    MD5_RECORD R[MD5_MAX_LANES];
+    WORD MD5_RES[MD5_MAX_LANES][4];
+    long job[MD5_MAX_LANES], i = 0;
+    int lanes, k;
+    MD5_LANES_FN kernel = md5_lanes_kernel(&lanes);
+    BYTE *buf = malloc((size_t) lanes * MD5_LANE_FILE);
+
+    while (i >= 0) {
+        /* Up to one small file per lane, anything else is hashed straight away */
+        for (k = 0; k < lanes && (i = worker_next(W)) >= 0; ) {
+            MD5_JOB *j = &J->jobs[i];
+            BYTE *p = buf + (size_t) k * MD5_LANE_FILE;
+            int got = buf ? md5_small_read(j->path, p, MD5_LANE_FILE, &S[k], j->MD5_RES) : 0;
+
+            if (got == 2) {
+                R[k] = (MD5_RECORD) { p, S[k].len };
+                job[k++] = i;
+                continue;
+            }
+            int done = got || md5_hash_path(j->path, j->MD5_RES) ? 1 : -1;
+            atomic_store_explicit(&j->done, done, memory_order_release);
+        }
+
+        /* Then the small ones all at once */
+        md5_multi_with(kernel, lanes, R, (size_t) k, MD5_RES);
+        for (int l = 0; l < k; l++) {
+            MD5_JOB *j = &J->jobs[job[l]];
+            memcpy(j->MD5_RES, MD5_RES[l], sizeof(j->MD5_RES));
+            md5_cache_update(j->path, &S[l].key, &S[l].after, &S[l].now, j->MD5_RES);
+            atomic_store_explicit(&j->done, 1, memory_order_release);
+        }
+    }
+    free(buf);
+    md5_stats_flush("worker");
+    return NULL;
+}
+
+/*
+    Hash every file in (paths), descending into directories, on (nthreads)
+    threads and print "digest  path" lines in order. Returns the number of
+    files which couldn't be opened.
+*/
+int md5_many(char **paths, int npaths, int nthreads) {
+    MD5_JOBS J = {NULL, 0, 0};
+    MD5_POOL pool;
+    struct timespec pause = {0, 50000};
+    int failed = 0;
+
+    for (int i = 0; i < npaths; i++) {
+        jobs_add_path(&J, paths[i]);
+    }
+    pool_start(&pool, J.n, nthreads, md5_worker, &J);
+
+    /* Print results in order as they complete, no lock needed as each job is
+    ** only written by the one worker that hashed it */
+    for (size_t i = 0; i < J.n; i++) {
+        int done;
+        while ((done = atomic_load_explicit(&J.jobs[i].done, memory_order_acquire)) == 0) {
+            nanosleep(&pause, NULL);
+        }
+        if (done < 0) {
+            printf("Error: couldn't read file %s.\n", J.jobs[i].path);
+            failed++;
+        } else {
+            output(J.jobs[i].MD5_RES);
+            STATS_START(t0);
+            printf("  %s\n", J.jobs[i].path);
+            STATS_STOP(output_ns, t0);
+        }
+    }
+
+    pool_join(&pool);
+    for (size_t i = 0; i < J.n; i++) {
+        free(J.jobs[i].path);
+    }
+    free(J.jobs);
+    return failed;
+}
+#endif
+
+/* -------------------- Batches of Short Records ---------------------- 
+* --batch hashes every record of a file (or - for standard input) and prints
+* one digest per line, in order. Records are lines without their newline, or
+* with --records u32 each one is a 32-bit little-endian length followed by
+* that many bytes. Most records are short keys which fit in a single padded
+* block (MD5_ONE_BLOCK bytes or less), those are packed one per lane into the
+* one-block kernels below, anything longer goes through md5_buffer() */
+#define MD5_ONE_BLOCK 55
+
+typedef enum { RECORDS_LINES, RECORDS_U32 } RECORDS;
+
+/*
+    Pad a short record into lane (l) the way md5_tail() would: the bytes, 0x80,
+    zeros and the length in bits in word 14. Word 15 is left out, the length of
+    a one block message never reaches it.
+*/
+void md5_lanes_load_short(MD5_LANES *L, int l, const BYTE *p, size_t len) {
+    BLOCK M;
+
+    memset(M.eight, 0, 56);
+    memcpy(M.eight, p, len);
+    M.eight[len] = 0x80;
+    for (int w = 0; w < 14; w++) {
+        L->X[w][l] = M.threetwo[w];
+    }
+    L->X[14][l] = (WORD) len * 8;
+}
+
+/*
+    One-block kernels, every lane is hashed from scratch. The chaining values
+    start as the constants A .. D and X15 is always zero, so the compiler folds
+    them into the first steps, the constant adds and the feed forward. Unused
+    lanes are hashed too and their result ignored, which is cheaper than masking.
+*/
+#if defined(__x86_64__) || defined(__i386__)
+void md5_x4_sse2_one(MD5_LANES *L) {
+    const __m128i ONES = _mm_set1_epi32(-1);
+    __m128i a = _mm_set1_epi32((int) A), b = _mm_set1_epi32((int) B);
+    __m128i c = _mm_set1_epi32((int) C), d = _mm_set1_epi32((int) D);
+
+    const __m128i X0  = _mm_load_si128((const __m128i *) L->X[0]),  X1  = _mm_load_si128((const __m128i *) L->X[1]);
+    const __m128i X2  = _mm_load_si128((const __m128i *) L->X[2]),  X3  = _mm_load_si128((const __m128i *) L->X[3]);
+    const __m128i X4  = _mm_load_si128((const __m128i *) L->X[4]),  X5  = _mm_load_si128((const __m128i *) L->X[5]);
+    const __m128i X6  = _mm_load_si128((const __m128i *) L->X[6]),  X7  = _mm_load_si128((const __m128i *) L->X[7]);
+    const __m128i X8  = _mm_load_si128((const __m128i *) L->X[8]),  X9  = _mm_load_si128((const __m128i *) L->X[9]);
+    const __m128i X10 = _mm_load_si128((const __m128i *) L->X[10]), X11 = _mm_load_si128((const __m128i *) L->X[11]);
+    const __m128i X12 = _mm_load_si128((const __m128i *) L->X[12]), X13 = _mm_load_si128((const __m128i *) L->X[13]);
+    const __m128i X14 = _mm_load_si128((const __m128i *) L->X[14]), X15 = _mm_setzero_si128();
+
+    MD5_STEPS(V4_F, V4_G, V4_H, V4_I)
+
+    _mm_store_si128((__m128i *) L->state[0], _mm_add_epi32(a, _mm_set1_epi32((int) A)));
+    _mm_store_si128((__m128i *) L->state[1], _mm_add_epi32(b, _mm_set1_epi32((int) B)));
+    _mm_store_si128((__m128i *) L->state[2], _mm_add_epi32(c, _mm_set1_epi32((int) C)));
+    _mm_store_si128((__m128i *) L->state[3], _mm_add_epi32(d, _mm_set1_epi32((int) D)));
+}
+
+__attribute__((target("avx2")))
+void md5_x8_avx2_one(MD5_LANES *L) {
+    const __m256i ONES = _mm256_set1_epi32(-1);
+    __m256i a = _mm256_set1_epi32((int) A), b = _mm256_set1_epi32((int) B);
+    __m256i c = _mm256_set1_epi32((int) C), d = _mm256_set1_epi32((int) D);
+
+    const __m256i X0  = _mm256_load_si256((const __m256i *) L->X[0]),  X1  = _mm256_load_si256((const __m256i *) L->X[1]);
+    const __m256i X2  = _mm256_load_si256((const __m256i *) L->X[2]),  X3  = _mm256_load_si256((const __m256i *) L->X[3]);
+    const __m256i X4  = _mm256_load_si256((const __m256i *) L->X[4]),  X5  = _mm256_load_si256((const __m256i *) L->X[5]);
+    const __m256i X6  = _mm256_load_si256((const __m256i *) L->X[6]),  X7  = _mm256_load_si256((const __m256i *) L->X[7]);
+    const __m256i X8  = _mm256_load_si256((const __m256i *) L->X[8]),  X9  = _mm256_load_si256((const __m256i *) L->X[9]);
+    const __m256i X10 = _mm256_load_si256((const __m256i *) L->X[10]), X11 = _mm256_load_si256((const __m256i *) L->X[11]);
+    const __m256i X12 = _mm256_load_si256((const __m256i *) L->X[12]), X13 = _mm256_load_si256((const __m256i *) L->X[13]);
+    const __m256i X14 = _mm256_load_si256((const __m256i *) L->X[14]), X15 = _mm256_setzero_si256();
+
+    MD5_STEPS(V8_F, V8_G, V8_H, V8_I)
+
+    _mm256_store_si256((__m256i *) L->state[0], _mm256_add_epi32(a, _mm256_set1_epi32((int) A)));
+    _mm256_store_si256((__m256i *) L->state[1], _mm256_add_epi32(b, _mm256_set1_epi32((int) B)));
+    _mm256_store_si256((__m256i *) L->state[2], _mm256_add_epi32(c, _mm256_set1_epi32((int) C)));
+    _mm256_store_si256((__m256i *) L->state[3], _mm256_add_epi32(d, _mm256_set1_epi32((int) D)));
+}
+
+__attribute__((target("avx512f")))
+void md5_x16_avx512_one(MD5_LANES *L) {
+    __m512i a = _mm512_set1_epi32((int) A), b = _mm512_set1_epi32((int) B);
+    __m512i c = _mm512_set1_epi32((int) C), d = _mm512_set1_epi32((int) D);
+
+    const __m512i X0  = _mm512_load_si512(L->X[0]),  X1  = _mm512_load_si512(L->X[1]);
+    const __m512i X2  = _mm512_load_si512(L->X[2]),  X3  = _mm512_load_si512(L->X[3]);
+    const __m512i X4  = _mm512_load_si512(L->X[4]),  X5  = _mm512_load_si512(L->X[5]);
+    const __m512i X6  = _mm512_load_si512(L->X[6]),  X7  = _mm512_load_si512(L->X[7]);
+    const __m512i X8  = _mm512_load_si512(L->X[8]),  X9  = _mm512_load_si512(L->X[9]);
+    const __m512i X10 = _mm512_load_si512(L->X[10]), X11 = _mm512_load_si512(L->X[11]);
+    const __m512i X12 = _mm512_load_si512(L->X[12]), X13 = _mm512_load_si512(L->X[13]);
+    const __m512i X14 = _mm512_load_si512(L->X[14]), X15 = _mm512_setzero_si512();
+
+    MD5_STEPS(V16_F, V16_G, V16_H, V16_I)
+
+    _mm512_store_si512(L->state[0], _mm512_add_epi32(a, _mm512_set1_epi32((int) A)));
+    _mm512_store_si512(L->state[1], _mm512_add_epi32(b, _mm512_set1_epi32((int) B)));
+    _mm512_store_si512(L->state[2], _mm512_add_epi32(c, _mm512_set1_epi32((int) C)));
+    _mm512_store_si512(L->state[3], _mm512_add_epi32(d, _mm512_set1_epi32((int) D)));
+}
+#endif
+
+void md5_x1_scalar_one(MD5_LANES *L) {
+    WORD a = A, b = B, c = C, d = D;
+
+    const WORD X0  = L->X[0][0],  X1  = L->X[1][0],  X2  = L->X[2][0],  X3  = L->X[3][0];
+    const WORD X4  = L->X[4][0],  X5  = L->X[5][0],  X6  = L->X[6][0],  X7  = L->X[7][0];
+    const WORD X8  = L->X[8][0],  X9  = L->X[9][0],  X10 = L->X[10][0], X11 = L->X[11][0];
+    const WORD X12 = L->X[12][0], X13 = L->X[13][0], X14 = L->X[14][0], X15 = 0;
+
+    MD5_STEPS(STEP_F, STEP_G, STEP_H, STEP_I)
+
+    L->state[0][0] = a + A;
+    L->state[1][0] = b + B;
+    L->state[2][0] = c + C;
+    L->state[3][0] = d + D;
+}
+
+typedef void (*MD5_ONE_FN)(MD5_LANES *L);
+
+/* Same choice as md5_lanes_kernel() */
+MD5_ONE_FN md5_one_kernel(int *lanes) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        *lanes = 16;
+        return md5_x16_avx512_one;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        *lanes = 8;
+        return md5_x8_avx2_one;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        *lanes = 4;
+        return md5_x4_sse2_one;
+    }
+#endif
+    *lanes = 1;
+    return md5_x1_scalar_one;
+}
+
+/* Write a digest as 32 hex digits, in the same byte order as output() */
+void md5_hex(const WORD *MD5_RES, char *out) {
+    static const char digits[] = "0123456789abcdef";
+
+    for (int i = 0; i < 16; i++) {
+        BYTE x = (BYTE) (MD5_RES[i / 4] >> (8 * (i % 4)));
+        out[2 * i] = digits[x >> 4];
+        out[2 * i + 1] = digits[x & 15];
+    }
+}
+
+/* Hash (n) records, digest i is written as a line of 33 characters at out + 33 * i */
+void md5_records(MD5_ONE_FN kernel, int lanes, const MD5_RECORD *R, size_t n, char *out) {
+    MD5_LANES L;
+    WORD MD5_RES[4];
+    size_t job[MD5_MAX_LANES];
+    int k = 0;
+
+    for (size_t i = 0; i <= n; i++) {
+        /* Run the kernel once every lane is loaded, and for whatever is left at the end */
+        if (k == lanes || (i == n && k > 0)) {
+            STATS_START(t0);
+            kernel(&L);
+            STATS_STOP(compress_ns, t0);
+            STATS_ADD(blocks, k);
+            STATS_ADD(pad_blocks, k);
+            for (int l = 0; l < k; l++) {
+                for (int w = 0; w < 4; w++) MD5_RES[w] = L.state[w][l];
+                md5_hex(MD5_RES, out + 33 * job[l]);
+                out[33 * job[l] + 32] = '\n';
+            }
+            k = 0;
+        }
+        if (i == n) {
+            break;
+        }
+
+        if (R[i].len > MD5_ONE_BLOCK) {
+            md5_buffer(R[i].p, R[i].len, MD5_RES);
+            md5_hex(MD5_RES, out + 33 * i);
+            out[33 * i + 32] = '\n';
+        } else {
+            md5_lanes_load_short(&L, k, R[i].p, R[i].len);
+            job[k++] = i;
+        }
+    }
+}
+
+/*
+    Hash every record read from (infile), printing one digest per line. The
+    input is read in large chunks, each chunk's complete records are hashed and
+    printed together and an incomplete last record is carried over to the next
+    chunk, the buffer doubling whenever a single record doesn't fit. Given an
+    (hmac) key each line is the record's HMAC-MD5 under it instead.
+    Returns 0 if the input ends part way through a --records u32 record.
+*/
+int md5_batch(FILE *infile, RECORDS format, const MD5_HMAC_KEY *hmac) {
+    size_t cap = MD5_BUFSIZE, fill = 0, nread, pos, n, maxrec = 0;
+    BYTE *buf = malloc(cap);
+    MD5_RECORD *R = NULL;
+    WORD (*MD5_RES)[4] = NULL;
+    char *out = NULL;
+    int lanes, hmac_lanes, eof = 0, ok = 1;
+    MD5_ONE_FN kernel = md5_one_kernel(&lanes);
+    MD5_LANES_FN hmac_kernel = md5_lanes_kernel(&hmac_lanes);
+
+    while (!eof) {
+        STATS_START(t0);
+        nread = fread(buf + fill, 1, cap - fill, infile);
+        STATS_STOP(io_ns, t0);
+        STATS_ADD(read_calls, 1);
+        STATS_ADD(bytes_read, nread);
+        fill += nread;
+        eof = (fill < cap);
+
+        /* Split off every complete record */
+        pos = 0;
+        n = 0;
+        for (;;) {
+            const BYTE *p = buf + pos, *end;
+            size_t len;
+
+            if (format == RECORDS_LINES) {
+                if (pos == fill) {
+                    break;
+                }
+                end = memchr(p, '\n', fill - pos);
+                if (!end && !eof) {
+                    break;
+                }
+                /* A last line without a newline is still a record */
+                len = end ? (size_t) (end - p) : fill - pos;
+                pos += len + (end != NULL);
+            } else {
+                if (fill - pos < 4 || fill - pos - 4 < (size_t) LOAD32(p)) {
+                    ok = ok && !(eof && pos < fill);
+                    /* Make room for a record bigger than the buffer */
+                    if (fill - pos >= 4 && (size_t) LOAD32(p) + 4 > cap) {
+                        maxrec = (size_t) LOAD32(p) + 4;
+                    }
+                    break;
+                }
+                len = LOAD32(p);
+                p += 4;
+                pos += 4 + len;
+            }
+
+            if (n % 4096 == 0) {
+                R = realloc(R, (n + 4096) * sizeof(MD5_RECORD));
+                out = realloc(out, (n + 4096) * 33);
+                if (hmac) {
+                    MD5_RES = realloc(MD5_RES, (n + 4096) * sizeof(*MD5_RES));
+                }
+            }
+            R[n].p = p;
+            R[n].len = len;
+            n++;
+        }
+
+        if (hmac) {
+            md5_hmac_lanes(hmac_kernel, hmac_lanes, hmac, R, n, MD5_RES);
+            for (size_t i = 0; i < n; i++) {
+                md5_hex(MD5_RES[i], out + 33 * i);
+                out[33 * i + 32] = '\n';
+            }
+        } else {
+            md5_records(kernel, lanes, R, n, out);
+        }
+        STATS_START(t1);
+        fwrite(out, 33, n, stdout);
+        STATS_STOP(output_ns, t1);
+
+        /* Carry the incomplete record over, growing the buffer if it fills it */
+        memmove(buf, buf + pos, fill - pos);
+        fill -= pos;
+        if (!eof && (fill == cap || maxrec > cap)) {
+            while (cap < fill + 1 || cap < maxrec) {
+                cap *= 2;
+            }
+            buf = realloc(buf, cap);
+        }
+    }
+
+    free(buf);
+    free(R);
+    free(MD5_RES);
+    free(out);
+    return ok && !ferror(infile);
+}
+
+/* ------------------------- Candidate Search -------------------------- 
+* --audit <hashes> looks for the passwords behind unsalted MD5 password
+* hashes, for sanctioned audits of legacy systems and CTF practice. The
+* candidates are every word of --wordlist, every string matching --mask, or
+* every word followed by every string matching the mask. A mask is literal
+* characters and the classes ?l (a-z), ?u (A-Z), ?d (0-9), ?s (printable
+* symbols and space), ?a (all of those) and ?? for a question mark.
+*
+* Every candidate fits in one block, 55 bytes or less, and for a given word
+* only the bytes under the mask change. So the block is built once per word,
+* each lane only has the message words the mask covers rewritten, and the
+* steps of round 1 before the first of those words are run once per word to
+* a midstate the kernel starts from, jumping into round 1 part way. After step
+* 60 (a) is already the first digest word, it's looked up in a bitmap of the
+* targets' first words and unless some lane hits, the last three steps and
+* the full comparison are skipped. Hits are checked against the sorted
+* targets with a binary search, so one pass checks every target. Jobs of
+* MD5_AUDIT_CHUNK candidates (or MD5_AUDIT_WORDS words without a mask) are
+* spread over the worker pool. Found passwords print as "digest:password"
+* and the candidates tried per second go to stderr at the end */
+#ifdef MD5_HAVE_PTHREAD
+#define MD5_AUDIT_CHUNK (1 << 20)
+#define MD5_AUDIT_WORDS 4096
+
+/* Set bits for the first digest words of the targets, (mask) + 1 bits long */
+typedef struct {
+    uint32_t *bits;
+    uint32_t mask;
+} MD5_FILTER;
+
+/*
+    Finish one block per lane from the midstate (mid), reached after the
+    first (from) steps. Returns a bit per lane whose first word passed
+    (filter), only those lanes have their digest in L->state.
+*/
+typedef uint32_t (*MD5_SEARCH_FN)(MD5_LANES *L, const WORD *mid, int from, const MD5_FILTER *filter);
+
+/* Round 1 steps become case labels, each falls through to the next */
+#define MD5_CASE(n) case n:
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wimplicit-fallthrough"
+
+#if defined(__x86_64__) || defined(__i386__)
+uint32_t md5_x4_sse2_search(MD5_LANES *L, const WORD *mid, int from, const MD5_FILTER *filter) {
+    const __m128i ONES = _mm_set1_epi32(-1);
+    __m128i a = _mm_set1_epi32((int) mid[0]), b = _mm_set1_epi32((int) mid[1]);
+    __m128i c = _mm_set1_epi32((int) mid[2]), d = _mm_set1_epi32((int) mid[3]);
+    _Alignas(16) WORD first[4];
+    uint32_t hit = 0;
+
+    const __m128i X0  = _mm_load_si128((const __m128i *) L->X[0]),  X1  = _mm_load_si128((const __m128i *) L->X[1]);
+    const __m128i X2  = _mm_load_si128((const __m128i *) L->X[2]),  X3  = _mm_load_si128((const __m128i *) L->X[3]);
+    const __m128i X4  = _mm_load_si128((const __m128i *) L->X[4]),  X5  = _mm_load_si128((const __m128i *) L->X[5]);
+    const __m128i X6  = _mm_load_si128((const __m128i *) L->X[6]),  X7  = _mm_load_si128((const __m128i *) L->X[7]);
+    const __m128i X8  = _mm_load_si128((const __m128i *) L->X[8]),  X9  = _mm_load_si128((const __m128i *) L->X[9]);
+    const __m128i X10 = _mm_load_si128((const __m128i *) L->X[10]), X11 = _mm_load_si128((const __m128i *) L->X[11]);
+    const __m128i X12 = _mm_load_si128((const __m128i *) L->X[12]), X13 = _mm_load_si128((const __m128i *) L->X[13]);
+    const __m128i X14 = _mm_load_si128((const __m128i *) L->X[14]), X15 = _mm_setzero_si128();
+
+    switch (from) {
+        MD5_ROUND1(V4_F, MD5_CASE)
+    }
+    MD5_ROUND2(V4_G) MD5_ROUND3(V4_H) MD5_ROUND4(V4_I)
+
+    /* No gather in SSE2, four lookups */
+    _mm_store_si128((__m128i *) first, _mm_add_epi32(a, _mm_set1_epi32((int) A)));
+    for (int l = 0; l < 4; l++) {
+        WORD i = first[l] & filter->mask;
+        hit |= (filter->bits[i >> 5] >> (i & 31) & 1) << l;
+    }
+    if (!hit) {
+        return 0;
+    }
+
+    MD5_ROUND4_LAST(V4_I)
+    _mm_store_si128((__m128i *) L->state[0], _mm_add_epi32(a, _mm_set1_epi32((int) A)));
+    _mm_store_si128((__m128i *) L->state[1], _mm_add_epi32(b, _mm_set1_epi32((int) B)));
+    _mm_store_si128((__m128i *) L->state[2], _mm_add_epi32(c, _mm_set1_epi32((int) C)));
+    _mm_store_si128((__m128i *) L->state[3], _mm_add_epi32(d, _mm_set1_epi32((int) D)));
+    return hit;
+}
+
+__attribute__((target("avx2")))
+uint32_t md5_x8_avx2_search(MD5_LANES *L, const WORD *mid, int from, const MD5_FILTER *filter) {
+    const __m256i ONES = _mm256_set1_epi32(-1);
+    __m256i a = _mm256_set1_epi32((int) mid[0]), b = _mm256_set1_epi32((int) mid[1]);
+    __m256i c = _mm256_set1_epi32((int) mid[2]), d = _mm256_set1_epi32((int) mid[3]);
+    __m256i first, i, bits;
+    uint32_t hit;
+
+    const __m256i X0  = _mm256_load_si256((const __m256i *) L->X[0]),  X1  = _mm256_load_si256((const __m256i *) L->X[1]);
+    const __m256i X2  = _mm256_load_si256((const __m256i *) L->X[2]),  X3  = _mm256_load_si256((const __m256i *) L->X[3]);
+    const __m256i X4  = _mm256_load_si256((const __m256i *) L->X[4]),  X5  = _mm256_load_si256((const __m256i *) L->X[5]);
+    const __m256i X6  = _mm256_load_si256((const __m256i *) L->X[6]),  X7  = _mm256_load_si256((const __m256i *) L->X[7]);
+    const __m256i X8  = _mm256_load_si256((const __m256i *) L->X[8]),  X9  = _mm256_load_si256((const __m256i *) L->X[9]);
+    const __m256i X10 = _mm256_load_si256((const __m256i *) L->X[10]), X11 = _mm256_load_si256((const __m256i *) L->X[11]);
+    const __m256i X12 = _mm256_load_si256((const __m256i *) L->X[12]), X13 = _mm256_load_si256((const __m256i *) L->X[13]);
+    const __m256i X14 = _mm256_load_si256((const __m256i *) L->X[14]), X15 = _mm256_setzero_si256();
+
+    switch (from) {
+        MD5_ROUND1(V8_F, MD5_CASE)
+    }
+    MD5_ROUND2(V8_G) MD5_ROUND3(V8_H) MD5_ROUND4(V8_I)
+
+    /* Gather the bitmap word for each lane and test its bit */
+    first = _mm256_add_epi32(a, _mm256_set1_epi32((int) A));
+    i = _mm256_and_si256(first, _mm256_set1_epi32((int) filter->mask));
+    bits = _mm256_i32gather_epi32((const int *) filter->bits, _mm256_srli_epi32(i, 5), 4);
+    bits = _mm256_and_si256(_mm256_srlv_epi32(bits, _mm256_and_si256(i, _mm256_set1_epi32(31))), _mm256_set1_epi32(1));
+    hit = (uint32_t) _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpeq_epi32(bits, _mm256_set1_epi32(1))));
+    if (!hit) {
+        return 0;
+    }
+
+    MD5_ROUND4_LAST(V8_I)
+    _mm256_store_si256((__m256i *) L->state[0], first);
+    _mm256_store_si256((__m256i *) L->state[1], _mm256_add_epi32(b, _mm256_set1_epi32((int) B)));
+    _mm256_store_si256((__m256i *) L->state[2], _mm256_add_epi32(c, _mm256_set1_epi32((int) C)));
+    _mm256_store_si256((__m256i *) L->state[3], _mm256_add_epi32(d, _mm256_set1_epi32((int) D)));
+    return hit;
+}
+
+__attribute__((target("avx512f")))
+uint32_t md5_x16_avx512_search(MD5_LANES *L, const WORD *mid, int from, const MD5_FILTER *filter) {
+    __m512i a = _mm512_set1_epi32((int) mid[0]), b = _mm512_set1_epi32((int) mid[1]);
+    __m512i c = _mm512_set1_epi32((int) mid[2]), d = _mm512_set1_epi32((int) mid[3]);
+    __m512i first, i, bits;
+    __mmask16 hit;
+
+    const __m512i X0  = _mm512_load_si512(L->X[0]),  X1  = _mm512_load_si512(L->X[1]);
+    const __m512i X2  = _mm512_load_si512(L->X[2]),  X3  = _mm512_load_si512(L->X[3]);
+    const __m512i X4  = _mm512_load_si512(L->X[4]),  X5  = _mm512_load_si512(L->X[5]);
+    const __m512i X6  = _mm512_load_si512(L->X[6]),  X7  = _mm512_load_si512(L->X[7]);
+    const __m512i X8  = _mm512_load_si512(L->X[8]),  X9  = _mm512_load_si512(L->X[9]);
+    const __m512i X10 = _mm512_load_si512(L->X[10]), X11 = _mm512_load_si512(L->X[11]);
+    const __m512i X12 = _mm512_load_si512(L->X[12]), X13 = _mm512_load_si512(L->X[13]);
+    const __m512i X14 = _mm512_load_si512(L->X[14]), X15 = _mm512_setzero_si512();
+
+    switch (from) {
+        MD5_ROUND1(V16_F, MD5_CASE)
+    }
+    MD5_ROUND2(V16_G) MD5_ROUND3(V16_H) MD5_ROUND4(V16_I)
+
+    first = _mm512_add_epi32(a, _mm512_set1_epi32((int) A));
+    i = _mm512_and_si512(first, _mm512_set1_epi32((int) filter->mask));
+    bits = _mm512_i32gather_epi32(_mm512_srli_epi32(i, 5), filter->bits, 4);
+    hit = _mm512_test_epi32_mask(_mm512_srlv_epi32(bits, _mm512_and_si512(i, _mm512_set1_epi32(31))),
+                                 _mm512_set1_epi32(1));
+    if (!hit) {
+        return 0;
+    }
+
+    MD5_ROUND4_LAST(V16_I)
+    _mm512_store_si512(L->state[0], first);
+    _mm512_store_si512(L->state[1], _mm512_add_epi32(b, _mm512_set1_epi32((int) B)));
+    _mm512_store_si512(L->state[2], _mm512_add_epi32(c, _mm512_set1_epi32((int) C)));
+    _mm512_store_si512(L->state[3], _mm512_add_epi32(d, _mm512_set1_epi32((int) D)));
+    return hit;
+}
+#endif
+
+uint32_t md5_x1_scalar_search(MD5_LANES *L, const WORD *mid, int from, const MD5_FILTER *filter) {
+    WORD a = mid[0], b = mid[1], c = mid[2], d = mid[3], first, i;
+
+    const WORD X0  = L->X[0][0],  X1  = L->X[1][0],  X2  = L->X[2][0],  X3  = L->X[3][0];
+    const WORD X4  = L->X[4][0],  X5  = L->X[5][0],  X6  = L->X[6][0],  X7  = L->X[7][0];
+    const WORD X8  = L->X[8][0],  X9  = L->X[9][0],  X10 = L->X[10][0], X11 = L->X[11][0];
+    const WORD X12 = L->X[12][0], X13 = L->X[13][0], X14 = L->X[14][0], X15 = 0;
+
+    switch (from) {
+        MD5_ROUND1(STEP_F, MD5_CASE)
+    }
+    MD5_ROUND2(STEP_G) MD5_ROUND3(STEP_H) MD5_ROUND4(STEP_I)
+
+    first = a + A;
+    i = first & filter->mask;
+    if (!(filter->bits[i >> 5] >> (i & 31) & 1)) {
+        return 0;
+    }
+
+    MD5_ROUND4_LAST(STEP_I)
+    L->state[0][0] = first;
+    L->state[1][0] = b + B;
+    L->state[2][0] = c + C;
+    L->state[3][0] = d + D;
+    return 1;
+}
+#pragma GCC diagnostic pop
+
+/* Same choice as md5_lanes_kernel() */
+MD5_SEARCH_FN md5_search_kernel(int *lanes) {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        *lanes = 16;
+        return md5_x16_avx512_search;
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        *lanes = 8;
+        return md5_x8_avx2_search;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        *lanes = 4;
+        return md5_x4_sse2_search;
+    }
+#endif
+    *lanes = 1;
+    return md5_x1_scalar_search;
+}
+
+/* Chaining registers after the first (from) steps, which only read words below (from) */
+void md5_search_midstate(const WORD *X, int from, WORD *mid) {
+    mid[0] = A;
+    mid[1] = B;
+    mid[2] = C;
+    mid[3] = D;
+    for (int i = 0; i < from; i++) {
+        FF(mid[AA[i]], mid[BB[i]], mid[CC[i]], mid[DD[i]], X[MM[i]], S[i], T[i]);
+    }
+}
+
+/* The characters each position of a mask can take */
+typedef struct {
+    const char *set[MD5_ONE_BLOCK];
+    int size[MD5_ONE_BLOCK];
+    char literal[MD5_ONE_BLOCK][2];
+    int n;
+} MD5_MASK;
+
+/* Parse (mask) into (M), 0 if it's malformed or longer than a block allows */
+int md5_mask_parse(const char *mask, MD5_MASK *M) {
+    static const char lower[] = "abcdefghijklmnopqrstuvwxyz", upper[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ";
+    static const char digits[] = "0123456789", symbols[] = " !\"#$%&'()*+,-./:;<=>?@[\\]^_`{|}~";
+    static const char all[] = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789"
+                              " !\"#$%&'()*+,-./:;<=>?@[\\]^_`{|}~";
+    const char *set;
+
+    for (M->n = 0; *mask; M->n++) {
+        if (M->n == MD5_ONE_BLOCK) {
+            return 0;
+        }
+        if (*mask == '?') {
+            switch (mask[1]) {
+                case 'l': set = lower; break;
+                case 'u': set = upper; break;
+                case 'd': set = digits; break;
+                case 's': set = symbols; break;
+                case 'a': set = all; break;
+                case '?': set = "?"; break;
+                default: return 0;
+            }
+            mask += 2;
+        } else {
+            M->literal[M->n][0] = *mask++;
+            M->literal[M->n][1] = '\0';
+            set = M->literal[M->n];
+        }
+        M->set[M->n] = set;
+        M->size[M->n] = (int) strlen(set);
+    }
+    return 1;
+}
+
+typedef struct {
+    char **words;           // Wordlist, or one empty word for a mask on its own
+    size_t nwords;
+    MD5_MASK mask;
+    uint64_t keyspace;      // Strings matching the mask
+    uint64_t chunks;        // Jobs per word
+    WORD (*targets)[4];     // Sorted digests being looked for
+    size_t ntargets;
+    atomic_char *found;
+    MD5_FILTER filter;
+    MD5_SEARCH_FN kernel;
+    int lanes;
+    _Atomic uint64_t tried;
+    atomic_size_t nfound;
+    atomic_int stop;
+} MD5_AUDIT;
+
+int md5_audit_cmp(const void *x, const void *y) {
+    return memcmp(x, y, sizeof(WORD[4]));
+}
+
+/* Check the lanes in (hit) against the targets and print any passwords found */
+void md5_audit_hits(MD5_AUDIT *T, MD5_LANES *L, uint32_t hit, const size_t *len) {
+    for (int l = 0; hit; l++, hit >>= 1) {
+        WORD digest[4] = { L->state[0][l], L->state[1][l], L->state[2][l], L->state[3][l] };
+        WORD (*t)[4];
+        char line[33 + MD5_ONE_BLOCK + 2];
+
+        if (!(hit & 1) || !(t = bsearch(digest, T->targets, T->ntargets, sizeof(WORD[4]), md5_audit_cmp))) {
+            continue;
+        }
+        if (atomic_exchange(&T->found[t - T->targets], 1)) {
+            continue;
+        }
+
+        /* The password is still in the lane's message words */
+        md5_hex(digest, line);
+        line[32] = ':';
+        for (size_t i = 0; i < len[l]; i++) {
+            line[33 + i] = (char) (L->X[i / 4][l] >> (8 * (i % 4)));
+        }
+        line[33 + len[l]] = '\n';
+        line[34 + len[l]] = '\0';
+        fputs(line, stdout);
+        fflush(stdout);
+        if (atomic_fetch_add(&T->nfound, 1) + 1 == T->ntargets) {
+            atomic_store(&T->stop, 1);
+        }
+    }
+}
+
+/* A job of a word followed by candidates (start) to (end) of the mask */
+void md5_audit_mask(MD5_AUDIT *T, MD5_LANES *L, const char *word, uint64_t start, uint64_t end) {
+    size_t wlen = strlen(word), len = wlen + T->mask.n, lens[MD5_MAX_LANES];
+    int pos[MD5_ONE_BLOCK], from = (int) (wlen / 4), last = (int) ((len - 1) / 4);
+    BLOCK M;
+    WORD mid[4];
+    uint64_t k, rest;
+
+    /* The block as far as it's the same for every candidate */
+    memset(M.eight, 0, 64);
+    memcpy(M.eight, word, wlen);
+    M.eight[len] = 0x80;
+    M.threetwo[14] = (WORD) len * 8;
+    for (int w = 0; w < 16; w++) {
+        for (int l = 0; l < T->lanes; l++) {
+            L->X[w][l] = M.threetwo[w];
+        }
+    }
+    for (int l = 0; l < T->lanes; l++) {
+        lens[l] = len;
+    }
+    md5_search_midstate(M.threetwo, from, mid);
+
+    /* Candidate (start) as a number in mixed radix, last position fastest */
+    rest = start;
+    for (int p = T->mask.n - 1; p >= 0; p--) {
+        pos[p] = (int) (rest % (uint64_t) T->mask.size[p]);
+        rest /= (uint64_t) T->mask.size[p];
+        M.eight[wlen + p] = (BYTE) T->mask.set[p][pos[p]];
+    }
+
+    for (k = start; k < end && !atomic_load_explicit(&T->stop, memory_order_relaxed); ) {
+        int n = end - k < (uint64_t) T->lanes ? (int) (end - k) : T->lanes;
+
+        for (int l = 0; l < n; l++) {
+            for (int w = from; w <= last; w++) {
+                L->X[w][l] = M.threetwo[w];
+            }
+            /* Next candidate, only the positions that roll over are rewritten */
+            for (int p = T->mask.n - 1; p >= 0; p--) {
+                if (++pos[p] < T->mask.size[p]) {
+                    M.eight[wlen + p] = (BYTE) T->mask.set[p][pos[p]];
+                    break;
+                }
+                pos[p] = 0;
+                M.eight[wlen + p] = (BYTE) T->mask.set[p][0];
+            }
+        }
+        uint32_t hit = T->kernel(L, mid, from, &T->filter) & (uint32_t) ((1ull << n) - 1);
+        if (hit) {
+            md5_audit_hits(T, L, hit, lens);
+        }
+        k += (uint64_t) n;
+    }
+    atomic_fetch_add(&T->tried, k - start);
+}
+
+/* A job of words (start) to (end) of the wordlist, as they are */
+void md5_audit_words(MD5_AUDIT *T, MD5_LANES *L, size_t start, size_t end) {
+    static const WORD iv[4] = { A, B, C, D };
+    size_t lens[MD5_MAX_LANES], k;
+
+    for (k = start; k < end && !atomic_load_explicit(&T->stop, memory_order_relaxed); ) {
+        int n = end - k < (size_t) T->lanes ? (int) (end - k) : T->lanes;
+
+        for (int l = 0; l < n; l++) {
+            lens[l] = strlen(T->words[k + l]);
+            md5_lanes_load_short(L, l, (const BYTE *) T->words[k + l], lens[l]);
+        }
+        uint32_t hit = T->kernel(L, iv, 0, &T->filter) & (uint32_t) ((1ull << n) - 1);
+        if (hit) {
+            md5_audit_hits(T, L, hit, lens);
+        }
+        k += (size_t) n;
+    }
+    atomic_fetch_add(&T->tried, k - start);
+}
+
+void *md5_audit_worker(void *arg) {
+    MD5_WORKER *W = arg;
+    MD5_AUDIT *T = W->ctx;
+    MD5_LANES *L = aligned_alloc(64, sizeof(MD5_LANES));
+    long j;
+
+    while (!atomic_load(&T->stop) && (j = worker_next(W)) >= 0) {
+        if (T->mask.n == 0) {
+            size_t start = (size_t) j * MD5_AUDIT_WORDS;
+            md5_audit_words(T, L, start, start + MD5_AUDIT_WORDS < T->nwords ? start + MD5_AUDIT_WORDS : T->nwords);
+        } else {
+            uint64_t start = (uint64_t) j % T->chunks * MD5_AUDIT_CHUNK;
+            uint64_t end = start + MD5_AUDIT_CHUNK < T->keyspace ? start + MD5_AUDIT_CHUNK : T->keyspace;
+            md5_audit_mask(T, L, T->words[(uint64_t) j / T->chunks], start, end);
+        }
+    }
+    free(L);
+    return NULL;
+}
+
+/* Read a whole file into memory and split it into lines, NULL if it can't be read */
+char *md5_read_lines(const char *path, char ***lines, size_t *n) {
+    size_t len, cap_lines = 1024;
+    char *text = (char *) md5_read_file(path, &len), *p, *eol;
+
+    if (!text) {
+        return NULL;
+    }
+    *n = 0;
+    *lines = malloc(cap_lines * sizeof(char *));
+    for (p = text; p < text + len; p = eol + 1) {
+        if (!(eol = memchr(p, '\n', text + len - p))) {
+            eol = text + len;
+        }
+        *eol = '\0';
+        if (eol > p && eol[-1] == '\r') {
+            eol[-1] = '\0';
+        }
+        if (*n == cap_lines) {
+            cap_lines *= 2;
+            *lines = realloc(*lines, cap_lines * sizeof(char *));
+        }
+        (*lines)[(*n)++] = p;
+    }
+    return text;
+}
+
+/*
+    Look for the passwords behind the MD5 hashes in (hashfile), trying the
+    words in (wordlist) and/or the strings matching (mask). Returns 1 if the
+    search ran, 0 on bad input.
+*/
+int md5_audit(const char *hashfile, const char *wordlist, const char *mask, int nthreads) {
+    MD5_AUDIT T;
+    MD5_POOL pool;
+    char **lines = NULL, *hashtext, *wordtext = NULL, *empty = "";
+    size_t nlines = 0, skipped = 0, unique = 1, kept = 0, bits;
+    uint64_t jobs, t0, ns;
+    int ok = 0;
+
+    memset(&T, 0, sizeof(T));
+    if (!wordlist && !mask) {
+        printf("Error: --audit needs a --wordlist, a --mask or both.\n");
+        return 0;
+    }
+    if (mask && !md5_mask_parse(mask, &T.mask)) {
+        printf("Error: bad --mask %s, expected literals and ?l ?u ?d ?s ?a ??, %d characters at most.\n",
+               mask, MD5_ONE_BLOCK);
+        return 0;
+    }
+    T.keyspace = 1;
+    for (int p = 0; p < T.mask.n; p++) {
+        if (T.keyspace > UINT64_MAX / (uint64_t) T.mask.size[p]) {
+            printf("Error: --mask %s has more than 2^64 candidates.\n", mask);
+            return 0;
+        }
+        T.keyspace *= (uint64_t) T.mask.size[p];
+    }
+    T.chunks = (T.keyspace + MD5_AUDIT_CHUNK - 1) / MD5_AUDIT_CHUNK;
+
+    /* The targets, sorted for bsearch() with duplicates removed */
+    if (!(hashtext = md5_read_lines(hashfile, &lines, &nlines))) {
+        printf("Error: couldn't read file %s.\n", hashfile);
+        return 0;
+    }
+    T.targets = malloc((nlines ? nlines : 1) * sizeof(WORD[4]));
+    for (size_t i = 0; i < nlines; i++) {
+        if (strlen(lines[i]) >= 32 && md5_unhex(lines[i], T.targets[T.ntargets])) {
+            T.ntargets++;
+        } else if (lines[i][0]) {
+            skipped++;
+        }
+    }
+    free(lines);
+    free(hashtext);
+    if (skipped) {
+        fprintf(stderr, "Warning: %zu lines of %s don't start with an MD5 digest.\n", skipped, hashfile);
+    }
+    if (!T.ntargets) {
+        printf("Error: no MD5 digests in %s.\n", hashfile);
+        goto done;
+    }
+    qsort(T.targets, T.ntargets, sizeof(WORD[4]), md5_audit_cmp);
+    for (size_t i = 1; i < T.ntargets; i++) {
+        if (md5_audit_cmp(T.targets[i], T.targets[unique - 1]) != 0) {
+            memcpy(T.targets[unique++], T.targets[i], sizeof(WORD[4]));
+        }
+    }
+    T.ntargets = unique;
+    T.found = calloc(T.ntargets, sizeof(atomic_char));
+
+    /* About 64 bits per target so few misses get past the filter, from 8KiB to 16MiB */
+    for (bits = 1 << 16; bits < 64 * T.ntargets && bits < ((size_t) 1 << 27); bits <<= 1);
+    T.filter.mask = (uint32_t) (bits - 1);
+    T.filter.bits = calloc(bits / 32, sizeof(uint32_t));
+    for (size_t i = 0; i < T.ntargets; i++) {
+        WORD b = T.targets[i][0] & T.filter.mask;
+        T.filter.bits[b >> 5] |= 1u << (b & 31);
+    }
+
+    /* Words that leave room for the mask within one block */
+    if (wordlist) {
+        if (!(wordtext = md5_read_lines(wordlist, &T.words, &T.nwords))) {
+            printf("Error: couldn't read file %s.\n", wordlist);
+            goto done;
+        }
+        for (size_t i = 0; i < T.nwords; i++) {
+            if (strlen(T.words[i]) + (size_t) T.mask.n <= MD5_ONE_BLOCK) {
+                T.words[kept++] = T.words[i];
+            }
+        }
+        if (kept < T.nwords) {
+            fprintf(stderr, "Warning: %zu words are too long to try, candidates are %d bytes at most.\n",
+                    T.nwords - kept, MD5_ONE_BLOCK);
+        }
+        T.nwords = kept;
+    } else {
+        T.words = &empty;
+        T.nwords = 1;
+    }
+
+    /* Job numbers have to fit the pool's 32-bit ranges */
+    if (T.mask.n && T.nwords && T.chunks >= UINT32_MAX / T.nwords) {
+        printf("Error: too many candidates for one run, split the wordlist or the mask.\n");
+        goto done;
+    }
+    jobs = T.mask.n ? T.nwords * T.chunks : (T.nwords + MD5_AUDIT_WORDS - 1) / MD5_AUDIT_WORDS;
+    T.kernel = md5_search_kernel(&T.lanes);
+
+    t0 = md5_stats_now();
+    pool_start(&pool, (size_t) jobs, nthreads, md5_audit_worker, &T);
+    pool_join(&pool);
+    ns = md5_stats_now() - t0;
+
+    fprintf(stderr, "%" PRIu64 " candidates in %.3f s, %.0f candidates/s on %d threads x %d lanes. "
+                    "Found %zu of %zu hashes.\n", atomic_load(&T.tried), ns / 1e9,
+            ns ? atomic_load(&T.tried) * 1e9 / ns : 0.0, nthreads < 1 ? 1 : nthreads, T.lanes,
+            atomic_load(&T.nfound), T.ntargets);
+    ok = 1;
+
+done:
+    if (wordtext) {
+        free(T.words);
+        free(wordtext);
+    }
+    free(T.targets);
+    free((void *) T.found);
+    free(T.filter.bits);
+    return ok;
+}
+#endif
+
+/* ----------------------------- Benchmark ----------------------------- 
+* --bench times every MD5 implementation in this file over a sweep of message
+* sizes: the reference loop, the unrolled kernel, each multi-lane kernel the
+* CPU supports, the one-block kernels for short records and, from 64KiB up,
+* whole files through each io_mode. Every case is run once to warm up, then
+* timed for at least MD5_BENCH_MIN_REPS samples, each sample repeating the case
+* enough times to take MD5_BENCH_SAMPLE_NS. The median and p99 per call are
+* reported as GB/s, cycles/byte and digests/s, printed as a table and written
+* as JSON (bench-md5.json, or --json <path>) so two builds can be diffed.
+* Cycles are TSC ticks, the nominal clock, not the core clock under turbo */
+#define MD5_BENCH_MIN_REPS 5
+#define MD5_BENCH_MAX_REPS 1000
+#define MD5_BENCH_SAMPLE_NS 20000.0
+#define MD5_BENCH_CASE_NS 200000000.0
+#define MD5_BENCH_FILE_MIN (64 << 10)
+#define MD5_BENCH_LANES_MAX (16 << 20)
+
+#ifdef MD5_HAVE_MMAP
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h> // __rdtsc
+#define md5_bench_ticks() __rdtsc()
+#else
+#define md5_bench_ticks() 0
+#endif
+
+/*
+    Hardware counters for --bench --perf, read with perf_event_open() around
+    each case's timed samples. Every event is opened on its own rather than as
+    a group, so a CPU or VM without, say, stall counters still reports the
+    rest, and counts are scaled by enabled/running time in case the kernel had
+    to multiplex them. Anything that can't be opened is reported as null/-,
+    and without a PMU (or with perf_event_paranoid too high) --perf just says
+    so and the report is wall time and TSC only.
+*/
+#define MD5_PERF_EVENTS 7
+enum { PERF_CYCLES, PERF_INSTRUCTIONS, PERF_BRANCH_MISSES, PERF_L1D_MISSES, PERF_LLC_MISSES,
+       PERF_FRONTEND_STALLS, PERF_BACKEND_STALLS };
+
+typedef struct {
+    int fd[MD5_PERF_EVENTS];        // -1 for events that couldn't be opened
+    double count[MD5_PERF_EVENTS];  // Per call over the last case, < 0 if not counted
+    int open;                       // How many fds are open
+} MD5_PERF;
+
+int bench_perf = 0;
+MD5_PERF md5_perf;
+
+#ifdef MD5_HAVE_PERF
+void md5_perf_open(MD5_PERF *P) {
+    static const struct { uint32_t type; uint64_t config; } events[MD5_PERF_EVENTS] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                              (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_FRONTEND },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_BACKEND },
+    };
+    struct perf_event_attr attr;
+
+    P->open = 0;
+    for (int e = 0; e < MD5_PERF_EVENTS; e++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[e].type;
+        attr.config = events[e].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        P->fd[e] = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        P->open += P->fd[e] >= 0;
+    }
+}
+
+void md5_perf_start(MD5_PERF *P) {
+    for (int e = 0; e < MD5_PERF_EVENTS; e++) {
+        if (P->fd[e] >= 0) {
+            ioctl(P->fd[e], PERF_EVENT_IOC_RESET, 0);
+            ioctl(P->fd[e], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+}
+
+/* Stop counting and store each event's count divided by (calls) */
+void md5_perf_stop(MD5_PERF *P, double calls) {
+    uint64_t v[3]; // value, time enabled, time running
+
+    for (int e = 0; e < MD5_PERF_EVENTS; e++) {
+        P->count[e] = -1;
+        if (P->fd[e] >= 0) {
+            ioctl(P->fd[e], PERF_EVENT_IOC_DISABLE, 0);
+            if (read(P->fd[e], v, sizeof(v)) == sizeof(v) && v[2] > 0) {
+                P->count[e] = (double) v[0] * ((double) v[1] / v[2]) / calls;
+            }
+        }
+    }
+}
+
+void md5_perf_close(MD5_PERF *P) {
+    for (int e = 0; e < MD5_PERF_EVENTS; e++) {
+        if (P->fd[e] >= 0) {
+            close(P->fd[e]);
+        }
+    }
+    P->open = 0;
+}
+#else
+void md5_perf_open(MD5_PERF *P) { P->open = 0; }
+void md5_perf_start(MD5_PERF *P) { (void) P; }
+void md5_perf_stop(MD5_PERF *P, double calls) { (void) calls; for (int e = 0; e < MD5_PERF_EVENTS; e++) P->count[e] = -1; }
+void md5_perf_close(MD5_PERF *P) { (void) P; }
+#endif
+
+/* count[e] per KiB of input, and stalls as a share of cycles. < 0 where it can't be worked out */
+double md5_perf_ratio(double x, double per) {
+    return (x >= 0 && per > 0) ? x / per : -1;
+}
+
+/* A metric for the table, "-" if it wasn't counted */
+void md5_perf_column(double x, const char *format) {
+    if (x < 0) {
+        printf(" %8s", "-");
+    } else {
+        printf(format, x);
+    }
+}
+
+/* And for the JSON report, null if it wasn't counted */
+void md5_perf_json(FILE *json, const char *name, double x, int last) {
+    if (x < 0) {
+        fprintf(json, "\"%s\": null%s", name, last ? "" : ", ");
+    } else {
+        fprintf(json, "\"%s\": %.4f%s", name, x, last ? "" : ", ");
+    }
+}
+
+/* One case to time, (run) hashes (count) messages of (len) bytes once */
+typedef struct MD5_BENCH {
+    const char *impl;
+    const char *source; // "memory" or "file"
+    void (*run)(struct MD5_BENCH *bench);
+    const BYTE *buf;
+    size_t len;
+    int count;
+    MD5_LANES_FN lanes_fn;
+    MD5_ONE_FN one_fn;
+    int lanes;
+    MD5_RECORD *records;
+    char *out;
+    const char *path;
+    IOMODE io;
+} MD5_BENCH;
+
+/* Somewhere for digests to go so the compiler can't drop the work */
+volatile WORD md5_bench_sink;
+
+double md5_bench_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+/* md5_reference() over a buffer, one block at a time as the original program did */
+void md5_bench_reference(MD5_BENCH *bench) {
+    WORD MD5_RES[4] = { A, B, C, D };
+    BLOCK M[2];
+    size_t len = bench->len, rem = len & 63, noblocks = (rem < 56) ? 1 : 2;
+
+    for (size_t b = 0; b < len / 64; b++) {
+        memcpy(M[0].eight, bench->buf + 64 * b, 64);
+        md5_reference(&M[0], MD5_RES);
+    }
+    memset(M, 0, sizeof(M));
+    memcpy(M[0].eight, bench->buf + (len & ~(size_t) 63), rem);
+    M[0].eight[rem] = 0x80;
+    M[noblocks - 1].sixfour[7] = (uint64_t) len * 8;
+    for (size_t b = 0; b < noblocks; b++) {
+        md5_reference(&M[b], MD5_RES);
+    }
+    md5_bench_sink = MD5_RES[0];
+}
+
+void md5_bench_unrolled(MD5_BENCH *bench) {
+    WORD MD5_RES[4];
+    md5_buffer(bench->buf, bench->len, MD5_RES);
+    md5_bench_sink = MD5_RES[0];
+}
+
+void md5_bench_lanes(MD5_BENCH *bench) {
+    WORD MD5_RES[MD5_MAX_LANES][4];
+    md5_lanes_buffers(bench->lanes_fn, bench->lanes, bench->buf, bench->len, MD5_RES);
+    md5_bench_sink = MD5_RES[0][0];
+}
+
+void md5_bench_one(MD5_BENCH *bench) {
+    md5_records(bench->one_fn, bench->lanes, bench->records, bench->count, bench->out);
+    md5_bench_sink = (WORD) bench->out[0];
+}
+
+void md5_bench_file(MD5_BENCH *bench) {
+    WORD MD5_RES[4];
+    FILE *infile = fopen(bench->path, "rb");
+
+    if (infile) {
+        io_mode = bench->io;
+        md5_file(infile, MD5_RES);
+        fclose(infile);
+        md5_bench_sink = MD5_RES[0];
+    }
+}
+
+int md5_bench_cmp(const void *x, const void *y) {
+    double a = *(const double *) x, b = *(const double *) y;
+    return (a > b) - (a < b);
+}
+
+/*
+    Warm up, pick how many calls make a sample and how many samples fit in
+    MD5_BENCH_CASE_NS, time them and report one row. (first) is 0 for the
+    first row of the JSON array.
+*/
+void md5_bench_case(MD5_BENCH *bench, FILE *json, int first, double *tsc_ns, double *tsc_ticks) {
+    static double ns[MD5_BENCH_MAX_REPS], ticks[MD5_BENCH_MAX_REPS];
+    double t0, warm, bytes = (double) bench->len * bench->count;
+    uint64_t c0;
+    long inner;
+    int reps;
+
+    t0 = md5_bench_now();
+    bench->run(bench);
+    warm = md5_bench_now() - t0;
+    if (warm < 1) {
+        warm = 1;
+    }
+    inner = (warm < MD5_BENCH_SAMPLE_NS) ? (long) (MD5_BENCH_SAMPLE_NS / warm) + 1 : 1;
+    reps = (int) (MD5_BENCH_CASE_NS / (warm * inner));
+    reps = reps < MD5_BENCH_MIN_REPS ? MD5_BENCH_MIN_REPS : reps > MD5_BENCH_MAX_REPS ? MD5_BENCH_MAX_REPS : reps;
+
+    /* Counters run across all the samples, so they cost one ioctl per case */
+    if (md5_perf.open) {
+        md5_perf_start(&md5_perf);
+    }
+    for (int r = 0; r < reps; r++) {
+        t0 = md5_bench_now();
+        c0 = md5_bench_ticks();
+        for (long i = 0; i < inner; i++) {
+            bench->run(bench);
+        }
+        ticks[r] = (double) (md5_bench_ticks() - c0) / inner;
+        ns[r] = (md5_bench_now() - t0) / inner;
+        *tsc_ns += ns[r];
+        *tsc_ticks += ticks[r];
+    }
+    if (md5_perf.open) {
+        md5_perf_stop(&md5_perf, (double) reps * inner);
+    }
+    qsort(ns, reps, sizeof(double), md5_bench_cmp);
+    qsort(ticks, reps, sizeof(double), md5_bench_cmp);
+
+    double median = ns[reps / 2], p99 = ns[(reps * 99) / 100];
+    double gbps = bytes / median, cpb = bytes > 0 ? ticks[reps / 2] / bytes : 0;
+    double dps = bench->count * 1e9 / median;
+
+    printf("%-14s %-6s %11zu %4d %10.3f %9.2f %12.0f %12.0f %12.0f", bench->impl, bench->source,
+           bench->len, bench->count, gbps, cpb, dps, median, p99);
+    fprintf(json, "%s    {\"impl\": \"%s\", \"source\": \"%s\", \"size\": %zu, \"messages\": %d, "
+                  "\"reps\": %d, \"calls_per_rep\": %ld, \"median_ns\": %.1f, \"p99_ns\": %.1f, "
+                  "\"gb_per_s\": %.4f, \"cycles_per_byte\": %.4f, \"digests_per_s\": %.1f, \"perf\": ",
+            first ? "" : ",\n", bench->impl, bench->source, bench->len, bench->count,
+            reps, inner, median, p99, gbps, cpb, dps);
+
+    if (md5_perf.open) {
+        const double *n = md5_perf.count, kib = bytes / 1024;
+        double ipc = md5_perf_ratio(n[PERF_INSTRUCTIONS], n[PERF_CYCLES]);
+        double core_cpb = md5_perf_ratio(n[PERF_CYCLES], bytes);
+        double br = md5_perf_ratio(n[PERF_BRANCH_MISSES], kib), l1d = md5_perf_ratio(n[PERF_L1D_MISSES], kib);
+        double llc = md5_perf_ratio(n[PERF_LLC_MISSES], kib);
+        double fe = md5_perf_ratio(n[PERF_FRONTEND_STALLS] * 100, n[PERF_CYCLES]);
+        double be = md5_perf_ratio(n[PERF_BACKEND_STALLS] * 100, n[PERF_CYCLES]);
+
+        md5_perf_column(core_cpb, " %8.2f");
+        md5_perf_column(ipc, " %8.2f");
+        md5_perf_column(br, " %8.2f");
+        md5_perf_column(l1d, " %8.2f");
+        md5_perf_column(llc, " %8.3f");
+        md5_perf_column(fe, " %7.1f%%");
+        md5_perf_column(be, " %7.1f%%");
+        fprintf(json, "{");
+        md5_perf_json(json, "core_cycles_per_byte", core_cpb, 0);
+        md5_perf_json(json, "ipc", ipc, 0);
+        md5_perf_json(json, "branch_misses_per_kib", br, 0);
+        md5_perf_json(json, "l1d_misses_per_kib", l1d, 0);
+        md5_perf_json(json, "llc_misses_per_kib", llc, 0);
+        md5_perf_json(json, "frontend_stall_pct", fe, 0);
+        md5_perf_json(json, "backend_stall_pct", be, 1);
+        fprintf(json, "}}");
+    } else {
+        fprintf(json, "null}");
+    }
+    printf("\n");
+    fflush(stdout);
+}
+#endif
+
+/* Parse a --bench size limit like 4096, 64K, 16M or 1G */
+size_t md5_bench_size(const char *arg) {
+    char *end;
+    size_t n = (size_t) strtoull(arg, &end, 10);
+
+    switch (*end) {
+        case 'G': case 'g': n <<= 10; /* fall through */
+        case 'M': case 'm': n <<= 10; /* fall through */
+        case 'K': case 'k': n <<= 10; break;
+        default: break;
+    }
+    return n;
+}
+
+/*
+    Run the whole sweep, every size up to (maxsize) bytes. Returns 0 if the
+    buffers, the scratch file or the JSON report couldn't be created.
+*/
+int md5_bench(size_t maxsize, const char *jsonpath) {
+#ifdef MD5_HAVE_MMAP
+    static const size_t sizes[] = {
+        0, 16, 55, 64, 256, 1 << 10, 4 << 10, 64 << 10, 1 << 20, 16 << 20, 256 << 20, 1 << 30
+    };
+    struct {
+        const char *impl;
+        MD5_LANES_FN lanes_fn;
+        MD5_ONE_FN one_fn;
+        int lanes;
+        int supported;
+    } kernels[] = {
+        { "lanes-scalar",  md5_x1_scalar,  md5_x1_scalar_one,  1,  1 },
+#if defined(__x86_64__) || defined(__i386__)
+        { "lanes-sse2",    md5_x4_sse2,    md5_x4_sse2_one,    4,  __builtin_cpu_supports("sse2") },
+        { "lanes-avx2",    md5_x8_avx2,    md5_x8_avx2_one,    8,  __builtin_cpu_supports("avx2") },
+        { "lanes-avx512",  md5_x16_avx512, md5_x16_avx512_one, 16, __builtin_cpu_supports("avx512f") },
+#endif
+    };
+    const int nokernels = sizeof(kernels) / sizeof(kernels[0]);
+    const IOMODE iomodes[] = { IO_MMAP, IO_ASYNC, IO_STREAM };
+    const char *ionames[] = { "file-mmap", "file-async", "file-stream" };
+    char path[] = "md5-bench-XXXXXX";
+    size_t lanesize = maxsize < MD5_BENCH_LANES_MAX ? maxsize : MD5_BENCH_LANES_MAX;
+    size_t bufsize = MD5_MAX_LANES * (lanesize > 64 ? lanesize : 64);
+    double tsc_ns = 0, tsc_ticks = 0;
+    int first = 1, fd;
+    char name[32];
+    MD5_BENCH bench;
+    IOMODE saved = io_mode;
+    FILE *json;
+    BYTE *buf;
+
+    if (bufsize < maxsize) {
+        bufsize = maxsize;
+    }
+    buf = aligned_alloc(64, (bufsize + 63) & ~(size_t) 63);
+    json = fopen(jsonpath, "w");
+    if (!buf || !json) {
+        free(buf);
+        if (json) {
+            fclose(json);
+        }
+        return 0;
+    }
+    for (size_t i = 0; i < bufsize; i++) {
+        buf[i] = (BYTE) (i * 2654435761u >> 13);
+    }
+
+    if (bench_perf) {
+        md5_perf_open(&md5_perf);
+        if (!md5_perf.open) {
+            printf("Hardware counters unavailable (no PMU, or perf_event_paranoid too high), timing only.\n");
+        }
+    }
+    fprintf(json, "{\n  \"tool\": \"md5\",\n  \"format\": 1,\n  \"results\": [\n");
+    printf("%-14s %-6s %11s %4s %10s %9s %12s %12s %12s", "impl", "source", "size", "msgs",
+           "GB/s", "cyc/byte", "digests/s", "median ns", "p99 ns");
+    if (md5_perf.open) {
+        printf(" %8s %8s %8s %8s %8s %8s %8s", "core c/B", "IPC", "brm/KiB", "L1D/KiB", "LLC/KiB",
+               "fe stall", "be stall");
+    }
+    printf("\n");
+
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]) && sizes[s] <= maxsize; s++) {
+        memset(&bench, 0, sizeof(bench));
+        bench.buf = buf;
+        bench.len = sizes[s];
+        bench.count = 1;
+        bench.source = "memory";
+
+        bench.impl = "reference";
+        bench.run = md5_bench_reference;
+        md5_bench_case(&bench, json, first, &tsc_ns, &tsc_ticks);
+        first = 0;
+
+        bench.impl = "unrolled";
+        bench.run = md5_bench_unrolled;
+        md5_bench_case(&bench, json, first, &tsc_ns, &tsc_ticks);
+
+        for (int k = 0; k < nokernels; k++) {
+            if (!kernels[k].supported) {
+                continue;
+            }
+            bench.lanes_fn = kernels[k].lanes_fn;
+            bench.one_fn = kernels[k].one_fn;
+            bench.lanes = kernels[k].lanes;
+
+            /* One message per lane, (lanes) of them side by side */
+            if (sizes[s] <= MD5_BENCH_LANES_MAX) {
+                bench.impl = kernels[k].impl;
+                bench.run = md5_bench_lanes;
+                bench.count = kernels[k].lanes;
+                md5_bench_case(&bench, json, first, &tsc_ns, &tsc_ticks);
+            }
+
+            /* Short records through the one-block kernel, a --batch chunk's worth */
+            if (sizes[s] <= MD5_ONE_BLOCK) {
+                bench.count = 4096;
+                bench.records = malloc(bench.count * sizeof(MD5_RECORD));
+                bench.out = malloc(bench.count * 33);
+                for (int i = 0; i < bench.count; i++) {
+                    bench.records[i].p = buf + (i % MD5_MAX_LANES) * 64;
+                    bench.records[i].len = sizes[s];
+                }
+                snprintf(name, sizeof(name), "one-%s", kernels[k].impl + strlen("lanes-"));
+                bench.impl = name;
+                bench.run = md5_bench_one;
+                md5_bench_case(&bench, json, first, &tsc_ns, &tsc_ticks);
+                free(bench.records);
+                free(bench.out);
+                bench.records = NULL;
+            }
+            bench.count = 1;
+        }
+
+        /* The same bytes from a file, through each way of reading it */
+        if (sizes[s] >= MD5_BENCH_FILE_MIN) {
+            fd = mkstemp(path);
+            if (fd < 0 || pwrite(fd, buf, sizes[s], 0) != (ssize_t) sizes[s]) {
+                printf("Error: couldn't write the scratch file %s.\n", path);
+                if (fd >= 0) {
+                    close(fd);
+                    unlink(path);
+                }
+                fclose(json);
+                free(buf);
+                return 0;
+            }
+            close(fd);
+            bench.path = path;
+            bench.source = "file";
+            bench.run = md5_bench_file;
+            for (int m = 0; m < 3; m++) {
+                bench.impl = ionames[m];
+                bench.io = iomodes[m];
+                md5_bench_case(&bench, json, first, &tsc_ns, &tsc_ticks);
+            }
+            unlink(path);
+            strcpy(path, "md5-bench-XXXXXX");
+        }
+    }
+
+    fprintf(json, "\n  ],\n  \"tsc_ghz\": %.4f,\n  \"perf_events\": %d\n}\n",
+            tsc_ns > 0 ? tsc_ticks / tsc_ns : 0, md5_perf.open);
+    fclose(json);
+    free(buf);
+    md5_perf_close(&md5_perf);
+    io_mode = saved;
+    printf("Report written to %s\n", jsonpath);
+    return 1;
+#else
+    (void) maxsize;
+    (void) jsonpath;
+    printf("Error: --bench needs a POSIX system.\n");
+    return 0;
+#endif
+}
+
+/* -------------------- Command Line Argument Outputs ------------------ 
+* Very dirty to look at this method, exists to clean up the main method */
+void cmd_line_display(int option) {
+    /* Multi-dimensional array to clean up test suite input & output */
+    const char* testFiles[5][3] = {
+        {"test-input/TestOne.txt",   "*EMPTY FILE*",               "d41d8cd98f00b204e9800998ecf8427e"},
+        {"test-input/TestTwo.txt",   "a",                          "0cc175b9c0f1b6a831c399e269772661"},
+        {"test-input/TestThree.txt", "abc",                        "900150983cd24fb0d6963f7d28e17f72"},
+        {"test-input/TestFour.txt",  "message digest",             "f96b697d7cb7938d525a2f31aaf161d0"},
+        {"test-input/TestFive.txt",  "abcdefghijklmnopqrstuvwxyz", "c3fcd3d76192e4007dfb496cca67e13b"}
+    };
+
+    /* Switch statement to help clean up the main method a bit, solely for output */
+    switch (option) {
+    case 0: // Case 0 - No command line arguments were entered
+        printf("\n*No command line argument specified, 'md5.exe --help' will list all valid command line arguments.\n");
+        printf("\nInput - 1: Perform MD5 on a File            ");
+        printf("\nInput - 2: Perform MD5 on a String        \n");
+        printf("\nChoose an option: ");
+        break;
+    case 1: // Case 1 - The argument --test was entered, prompting a suite of tests
+        printf("\n----------------- MD5 Test Suite ----------------\n");
+        printf("The following tests are outlined in Page 21 of the\nRequest for Comments MD5 Document.\nhttps://tools.ietf.org/html/rfc1321\n");
+        printf("-------------------------------------------------\n");
+        /* Loop once for each test */
+        for (int i = 0; i < 5; ++i) {
+            /* Print relevant information about the i'th test being carried out */
+            printf("Test Number: %d\nContent to Test: %s\nExpected Result: %s\n", i + 1, testFiles[i][1], testFiles[i][2]);
+            /* Open the i'th file */
+            FILE *infile = fopen(testFiles[i][0], "rb");
+            printf("Actual Result  : ");
+            /* Perform the MD5 hash on the content and close the file */
+            preMd5(infile);
+            fclose(infile);   
+            printf("\n-------------------------------------------------\n");
+        }
+        break;
+    case 2: // Case 2 - The argument --help was entered, prompting a helpful display
+        printf("\n--------------- Valid Command Line Argument Inputs ---------------- ");
+        printf("\n --help    | Displays helpful information for running the program.  ");
+        printf("\n --test    | Runs the test suite to ensure the MD5 output is valid. ");
+        printf("\n --explain | Brief high level overview of MD5, including a diagram. ");
+        printf("\n --hashfile <path> [...]   | Hashes files, directories recursively. ");
+        printf("\n --hashstring <string>     | Hashes a specified String.             ");
+        printf("\n --stdin, -                | Hashes standard input.                 ");
+        printf("\n --batch <path|->          | One digest per line (record) of input. ");
+        printf("\n --records <lines|u32>     | --batch records: lines or u32 length.  ");
+        printf("\n --hmac <keyfile>          | HMAC-MD5 for --batch and --hashstring. ");
+        printf("\n --bench[=max size]        | Times every kernel, e.g. --bench=64M.  ");
+        printf("\n --json <path>             | Where --bench writes its JSON report.   ");
+        printf("\n --perf                    | Adds IPC, misses and stalls to --bench.");
+        printf("\n --cache <path>            | Digest cache for --hashfile.            ");
+        printf("\n --no-cache                | Hashes every file, cache left alone.    ");
+        printf("\n --verify-cache            | Rehashes everything, checks the cache.  ");
+        printf("\n --state <file>            | Resumes --hashfile from a saved state.  ");
+        printf("\n --check <manifest>        | Verifies files listed md5sum style.     ");
+        printf("\n --fail-fast               | --check stops at the first failure.     ");
+        printf("\n --dupes <path> [path ..]  | Groups of identical files, read sparely.");
+        printf("\n --audit <hashes>          | Authorized audit of MD5 password hashes.");
+        printf("\n --wordlist <file>         | --audit candidates, one per line.       ");
+        printf("\n --mask <mask>             | --audit candidates, ?l?u?d?s?a, appended.");
+        printf("\n --stats[=table|json]      | I/O vs compute counters, to stderr.    ");
+        printf("\n --io <mmap|async|stream>  | How files are read, mmap by default.   ");
+        printf("\n --threads <n>             | Threads used for several files.      \n");
+        printf("--------------- Examples of Executing Arguments ------------------    ");
+        printf("\n Hashing a String :     md5.exe --hashstring abc                    ");
+        printf("\n Hashing a File   :     md5.exe --hashfile test-input/TestOne.txt \n");
+        break;
+    case 3: // Case 3 - The argument --explain was entered, display information about MD5
+        printf("\n-------------------------------------------------------------------------\n");
+        printf("The MD5 hashing algorithm is a one-way cryptographic function that \n");
+        printf("accepts a message of any length as input and returns as output a \n");
+        printf("fixed-length digest value to be used for authenticating the original message.\n");
+        
+        printf("\nX (X1, X2, X3, ..... Xn)                                           \n");
+        printf("            +                                                        \n");
+        printf("            |  448 bits                                              \n");
+        printf("            |                                                        \n");
+        printf("            v                                                        \n");
+        printf("+-----------+----------+                    <-----------------------^\n");
+        printf("|                      |                    |                       |\n");
+        printf("|   Padding Process    |                    |                       |\n");
+        printf("|                      |                    |                       |\n");
+        printf("+-----------+----------+                    |                       ^\n");
+        printf("            |                   +-----------v------------+          |\n");
+        printf("            |       512 bits    |                        |          |\n");
+        printf("            +------------------>+  Compression Function  |          |\n");
+        printf("                                |                        |          |\n");
+        printf("                                +-----------+------------+          |\n");
+        printf("                                            |                       |\n");
+        printf("                                            |                       |\n");
+        printf("                                            |                       |\n");
+        printf("                                            +----------------------->\n");
+        printf("                                            |                        \n");
+        printf("                                            |                        \n");
+        printf("                                            |                        \n");
+        printf("                                            v                        \n");
+        printf("                                       128 bit hash                  \n");
+        printf("\nThe MD5 message digest hashing algorithm processes data in 512-bit blocks,\n");
+        printf("broken down into 16 words composed of 32 bits each. The output from MD5 is a \n");
+        printf("128-bit message digest value.\n");
+        printf("\nFor a more in depth overview see: https://github.com/farisNassif/FourthYear_TheoryOfAlgorithms");
+        break;
+    default:
+        break;
+    }
+}
+
+/* -------------------------- Main Method ---------------------------- 
+* Built with -DMD5_NO_MAIN everything above can be linked into another
+* program instead, see digest.hpp */
+#ifndef MD5_NO_MAIN
+int main(int argc, char *argv[]) {
+    printf("------------------------------------------------------------------ ");
+    printf("\nAuthor :     Faris Nassif");
+    printf("\nModule :     Theory Of Algorithms");
+    printf("\nSummary:     A program that executes a MD5 Hash on a given input");
+    printf("\nGithub :     https://github.com/farisNassif/FourthYear_TheoryOfAlgorithms\n");
+
+    /* Input vars */
+    int option;
+    /* Declaration of file/string inputs, any length */
+    char *fileName;
+    char *inputString;
+    size_t inputLength;
+    WORD MD5_RES[4];
+    /* Long getopt options */
+    int c;
+    /* File input */
+    FILE *infile;
+
+    /* User ran 'md5.exe' without any arguments, display menu */
+    if (argv[1] == NULL) {
+        /* List menu and provide some input options and information */
+        cmd_line_display(0);
+		if (scanf("%d", &option) != 1) {
+            option = 0;
+        }
+        /* Skip the rest of the line the option was typed on */
+        while ((c = getchar()) != '\n' && c != EOF);
+
+        /* User wants to input a file .. */
+        if (option == 1) {
+            printf("Enter a Filename: ");
+            fileName = read_line(stdin, NULL);
+            infile = fileName ? fopen(fileName, "rb") : NULL;
+
+            /* If invalid & file couldn't be found */
+            if (!infile) {
+                printf("Error: couldn't open file %s.\n", fileName ? fileName : "");
+                free(fileName);
+                return 1;
+            } 
+            /* Otherwise perform MD5 on the contents of the file */
+            else {
+                printf("Processing file contents ...\nMD5: ");
+                if (!preMd5(infile)) {
+                    printf("\nError: couldn't read file %s.\n", fileName);
+                    fclose(infile);
+                    free(fileName);
+                    return 1;
+                }
+                fclose(infile);
+                free(fileName);
+            }
+        } 
+        /* They gave a String, hash the whole line straight from memory */
+        else if (option == 2) {
+            printf("Enter a String: ");
+            inputString = read_line(stdin, &inputLength);
+            if (!inputString) {
+                inputString = calloc(1, 1);
+                inputLength = 0;
+            }
+
+            printf("Processing String ...\nMD5: ");
+            md5_buffer(inputString, inputLength, MD5_RES);
+            output(MD5_RES);
+            free(inputString);
+        } else {
+            printf("\nInvalid Input\nExiting ...\n");
+        }
+    } 
+    /* Else, a command line argument was detected */
+    else {
+        /* Long getopt() options, adapted from:
+        *  https://www.gnu.org/software/libc/manual/html_node/Getopt-Long-Option-Example.html */
+        static struct option long_options[] = {
+            {"help"      , no_argument      , 0, 'h'},
+            {"test"      , no_argument      , 0, 't'},
+            {"explain"   , no_argument      , 0, 'e'},
+            {"hashfile"  , required_argument, 0, 'f'},
+            {"hashstring", required_argument, 0, 's'},
+            {"io"        , required_argument, 0, 'i'},
+            {"threads"   , required_argument, 0, 'j'},
+            {"stdin"     , no_argument      , 0, 'I'},
+            {"batch"     , required_argument, 0, 'b'},
+            {"records"   , required_argument, 0, 'r'},
+            {"bench"     , optional_argument, 0, 'B'},
+            {"json"      , required_argument, 0, 'J'},
+            {"stats"     , optional_argument, 0, 'S'},
+            {"perf"      , no_argument      , 0, 'P'},
+            {"cache"     , required_argument, 0, 'c'},
+            {"no-cache"  , no_argument      , 0, 'N'},
+            {"verify-cache", no_argument    , 0, 'V'},
+            {"state"     , required_argument, 0, 'R'},
+            {"check"     , required_argument, 0, 'k'},
+            {"fail-fast" , no_argument      , 0, 'F'},
+            {"dupes"     , required_argument, 0, 'D'},
+            {"audit"     , required_argument, 0, 'A'},
+            {"wordlist"  , required_argument, 0, 'w'},
+            {"mask"      , required_argument, 0, 'm'},
+            {"hmac"      , required_argument, 0, 'H'},
+            {0           , 0                , 0,  0 }
+        };
+
+        /* getopt_long stores the option index here */
+        int option_index = 0;
+
+        /* The first action given (--hashfile, --test ..) and its argument, it runs once
+        ** every option has been read so options like --io apply regardless of order */
+        int action = 0;
+        char *action_arg = NULL;
+        /* Hash several files on one thread per core unless told otherwise */
+        int nthreads = 1;
+        /* How --batch splits its input */
+        RECORDS records = RECORDS_LINES;
+        /* Where --bench writes its report */
+        const char *jsonpath = "bench-md5.json";
+        /* The digest cache for --hashfile, NULL for the default one */
+        const char *cachepath = NULL;
+        /* Where --hashfile keeps its state between runs, NULL for none */
+        const char *statepath = NULL;
+        /* The candidates --audit tries */
+        const char *wordlist = NULL, *mask = NULL;
+        /* The key file for HMACs, NULL for plain digests */
+        const char *hmacpath = NULL;
+        MD5_HMAC_KEY hmac;
+#ifdef MD5_HAVE_PTHREAD
+        nthreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+#endif
+
+        while ((c = getopt_long(argc, argv, "htef:s:", long_options, &option_index)) != -1) {
+            switch (c) {
+                case 'i':
+                    /* Choose how files are read */
+                    if (strcmp(optarg, "mmap") == 0) {
+                        io_mode = IO_MMAP;
+                    } else if (strcmp(optarg, "async") == 0) {
+                        io_mode = IO_ASYNC;
+                    } else if (strcmp(optarg, "stream") == 0) {
+                        io_mode = IO_STREAM;
+                    } else {
+                        printf("\nError: unknown --io mode %s, expected mmap, async or stream.\n", optarg);
+                        return 1;
+                    }
+                    break;
+                case 'j':
+                    /* Number of worker threads when hashing several files */
+                    nthreads = atoi(optarg);
+                    break;
+                case 'J':
+                    jsonpath = optarg;
+                    break;
+                case 'P':
+                    /* Hardware counters in --bench */
+                    bench_perf = 1;
+                    break;
+                case 'c':
+                    cachepath = optarg;
+                    break;
+                case 'N':
+                    /* Hash every file, and leave the cache alone */
+                    cache_mode = CACHE_OFF;
+                    break;
+                case 'V':
+                    /* Hash every file and check the cache against it */
+                    cache_mode = CACHE_VERIFY;
+                    break;
+                case 'R':
+                    statepath = optarg;
+                    break;
+                case 'F':
+                    /* --check stops at the first failure */
+                    check_fail_fast = 1;
+                    break;
+                case 'w':
+                    wordlist = optarg;
+                    break;
+                case 'm':
+                    mask = optarg;
+                    break;
+                case 'H':
+                    hmacpath = optarg;
+                    break;
+                case 'S':
+                    /* Count reads, blocks and time spent, printed to stderr at exit */
+                    if (optarg && strcmp(optarg, "json") == 0) {
+                        stats_json = 1;
+                    } else if (optarg && strcmp(optarg, "table") != 0) {
+                        printf("\nError: unknown --stats format %s, expected table or json.\n", optarg);
+                        return 1;
+                    }
+                    if (!stats_enabled) {
+                        stats_enabled = 1;
+                        atexit(md5_stats_report);
+                    }
+                    break;
+                case 'r':
+                    /* Record format for --batch */
+                    if (strcmp(optarg, "lines") == 0) {
+                        records = RECORDS_LINES;
+                    } else if (strcmp(optarg, "u32") == 0) {
+                        records = RECORDS_U32;
+                    } else {
+                        printf("\nError: unknown --records format %s, expected lines or u32.\n", optarg);
+                        return 1;
+                    }
+                    break;
+                case 'h':
+                case 't':
+                case 'e':
+                case 'f':
+                case 's':
+                case 'I':
+                case 'b':
+                case 'B':
+                case 'k':
+                case 'D':
+                case 'A':
+                    if (!action) {
+                        action = c;
+                        action_arg = optarg;
+                    }
+                    break;
+                default:
+                    abort();
+            }
+        }
+
+        /* The key is read from a file so it stays out of the process list */
+        if (hmacpath) {
+            size_t keylen;
+            BYTE *key = md5_read_file(hmacpath, &keylen);
+            if (!key) {
+                printf("\nError: couldn't read key file %s.\n", hmacpath);
+                return 1;
+            }
+            if (action != 'b' && action != 's') {
+                printf("\nError: --hmac works with --batch and --hashstring.\n");
+                free(key);
+                return 1;
+            }
+            md5_hmac_key(&hmac, key, keylen);
+            memset(key, 0, keylen);
+            free(key);
+        }
+
+        /* A lone '-', given on its own or to --hashfile, is standard input like md5sum */
+        if (action == 'f' && optind == argc && strcmp(action_arg, "-") == 0) {
+            action = 'I';
+        }
+        if (!action && optind == argc - 1 && strcmp(argv[optind], "-") == 0) {
+            action = 'I';
+        }
+
+        switch (action) {
+            case 0:
+                /* Only modifiers were given, nothing to run */
+                cmd_line_display(2);
+                break;
+            case 'h':
+                /* Display some helpful information to the user */
+                cmd_line_display(2);
+                break;
+            case 't':
+                /* Will perform a suite of tests to verify correct output */
+                cmd_line_display(1);
+                break;
+
+            case 'e':
+                /* Will print out some information about MD5 */
+                cmd_line_display(3);
+                break;
+            case 'I':
+                printf("\nProcessing standard input ...\nMD5: ");
+                if (!md5_fd(0, MD5_RES)) {
+                    printf("\nError: couldn't read standard input.\n");
+                    return 1;
+                }
+                output(MD5_RES);
+                break;
+            case 'f':
+                if (statepath) {
+                    /* One file, picking up where the last run stopped */
+                    if (optind < argc) {
+                        printf("\nError: --state takes a single file.\n");
+                        return 1;
+                    }
+                    if (!md5_resume(action_arg, statepath, MD5_RES)) {
+                        printf("\nError: couldn't hash file %s or save its state to %s.\n", action_arg, statepath);
+                        return 1;
+                    }
+                    printf("\nProcessing file contents ...\nMD5: ");
+                    output(MD5_RES);
+                    break;
+                }
+                if (cache_mode != CACHE_OFF) {
+                    md5_cache_open(cachepath);
+                }
+#ifdef MD5_HAVE_PTHREAD
+                /* More than one path, or a directory, hash them all in parallel.
+                ** getopt_long() has moved the extra paths to the end of argv */
+                {
+                    struct stat st;
+                    if (optind < argc || (stat(action_arg, &st) == 0 && S_ISDIR(st.st_mode))) {
+                        int npaths = argc - optind + 1;
+                        char **paths = malloc(npaths * sizeof(char *));
+                        paths[0] = action_arg;
+                        memcpy(paths + 1, argv + optind, (npaths - 1) * sizeof(char *));
+                        printf("\n");
+                        int failed = md5_many(paths, npaths, nthreads);
+                        free(paths);
+                        md5_cache_close();
+                        return failed || md5_cache_mismatched() ? 1 : 0;
+                    }
+                }
+#endif
+                /* Hash the file, or take its digest from the cache */
+                if (!md5_hash_path(action_arg, MD5_RES)) {
+                    md5_cache_close();
+                    printf("\nError: couldn't read file %s.\n", action_arg);
+                    return 1;
+                }
+                printf("\nProcessing file contents ...\nMD5: ");
+                output(MD5_RES);
+                md5_cache_close();
+                if (md5_cache_mismatched()) {
+                    printf("\n");
+                    return 1;
+                }
+                break;
+            case 'b':
+                /* One digest per record, '-' reads them from standard input */
+                infile = strcmp(action_arg, "-") == 0 ? stdin : fopen(action_arg, "rb");
+                if (!infile) {
+                    printf("\nError: couldn't open file %s.\n", action_arg);
+                    return 1;
+                }
+                printf("\n");
+                if (!md5_batch(infile, records, hmacpath ? &hmac : NULL)) {
+                    printf("Error: couldn't read every record from %s.\n", action_arg);
+                    return 1;
+                }
+                if (infile != stdin) {
+                    fclose(infile);
+                }
+                return 0;
+            case 'D':
+#ifdef MD5_HAVE_PTHREAD
+                /* Groups of identical files under every path given */
+                {
+                    int npaths = argc - optind + 1;
+                    char **paths = malloc(npaths * sizeof(char *));
+                    paths[0] = action_arg;
+                    memcpy(paths + 1, argv + optind, (npaths - 1) * sizeof(char *));
+                    printf("\n");
+                    md5_dupes(paths, npaths, nthreads);
+                    free(paths);
+                    return 0;
+                }
+#else
+                printf("\nError: --dupes needs threads, which this build doesn't have.\n");
+                return 1;
+#endif
+            case 'A':
+#ifdef MD5_HAVE_PTHREAD
+                /* Look for the passwords behind a file of hashes */
+                printf("\n");
+                fflush(stdout);
+                return md5_audit(action_arg, wordlist, mask, nthreads) ? 0 : 1;
+#else
+                printf("\nError: --audit needs threads, which this build doesn't have.\n");
+                return 1;
+#endif
+            case 'k':
+#ifdef MD5_HAVE_PTHREAD
+                /* Verify the files a manifest lists, '-' reads it from standard input */
+                {
+                    FILE *manifest = strcmp(action_arg, "-") == 0 ? stdin : fopen(action_arg, "r");
+                    long failed;
+
+                    if (!manifest) {
+                        printf("\nError: couldn't open file %s.\n", action_arg);
+                        return 1;
+                    }
+                    printf("\n");
+                    fflush(stdout);
+                    failed = md5_check(manifest, nthreads);
+                    if (manifest != stdin) {
+                        fclose(manifest);
+                    }
+                    if (failed < 0) {
+                        printf("Error: couldn't read %s.\n", action_arg);
+                    }
+                    return failed ? 1 : 0;
+                }
+#else
+                printf("\nError: --check needs threads, which this build doesn't have.\n");
+                return 1;
+#endif
+            case 'B':
+                /* Time every implementation, sizes up to 1GiB unless given a limit */
+                printf("\n");
+                return md5_bench(action_arg ? md5_bench_size(action_arg) : (size_t) 1 << 30, jsonpath) ? 0 : 1;
+            case 's':
+                /* Hash the argument's bytes where they are */
+                if (hmacpath) {
+                    printf("\nProcessing String ...\nHMAC-MD5: ");
+                    md5_hmac(&hmac, action_arg, strlen(action_arg), MD5_RES);
+                } else {
+                    printf("\nProcessing String ...\nMD5: ");
+                    md5_buffer(action_arg, strlen(action_arg), MD5_RES);
+                }
+                output(MD5_RES);
                 break;                   
             default:
                 abort();   
@@ -508,3 +4804,4 @@ int main(int argc, char *argv[]) {
     printf("\n");
     return 0;
 }
+#endif
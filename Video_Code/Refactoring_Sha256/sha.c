@@ -3,40 +3,47 @@
 // Summary:     A program that executes a MD5 Hash on a given input 
 
 #include <stdio.h> // Input/Output
+#include <stdlib.h> // malloc/free
 #include <stdint.h> // Req for uint(x) unsigned int
 #include <inttypes.h> // Includes formatters for output
+#include <string.h> // memcpy/memset for the bulk block reader
+#include <endian.h> // htobe64/be32toh
+#include <pthread.h> // Tree mode worker threads
+#include <stdatomic.h> // Tree mode leaf counter
+#include <unistd.h> // pread/sysconf
+#include <fcntl.h> // open
+#include <errno.h> // EINTR
+#include <sys/stat.h> // fstat, for the size of a file in tree mode
+#include <time.h> // clock_gettime for --bench
+#include "../../Program/digest_tables.h" // K and H0, shared with digest.hpp
+#ifdef __linux__
+#include <sys/syscall.h> // perf_event_open for --bench --perf
+#include <sys/ioctl.h> // PERF_EVENT_IOC_*
+#include <linux/perf_event.h> // perf_event_attr
+#define SHA_HAVE_PERF
+#endif
 
 /* 
     Definition of a word as per the specification
     Section 2.1
 */
 #define WORD uint32_t
+#define BYTE uint8_t
 
 /*
     Page 11 - 4.2.2
     Constants representing the first 32 bits of the fractional parts of
     the cube roots of mthe first sixty four prime numbers required for the algorithim.
-    
-    The 0x prefix denotes the number succeeding it is being written in hex
-*/
-const WORD K[] = {
-  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5,
-  0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
-  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3,
-  0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
-  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc,
-  0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
-  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7,
-  0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
-  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13,
-  0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
-  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3,
-  0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
-  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5,
-  0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
-  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208,
-  0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
-};
+    The values themselves are in Program/digest_tables.h.
+*/
+const WORD K[] = SHA256_K_INIT;
+
+/*
+    Section 5.3.3
+    Initial hash value, the first 32 bits of the fractional parts of the
+    square roots of the first eight prime numbers.
+*/
+const WORD H0[] = SHA256_H0_INIT;
 
 // ----------------------- Function Definitions ------------------------ 
 
@@ -203,63 +210,2945 @@ int nextblock(BLOCK *M, FILE *infile, uint64_t *nobits, PADFLAG *status) {
   return 1;
 }
 
-uint64_t swap_endian(uint64_t x) {
-    uint64_t mask[8];
-    mask[0] = 0xff;
-    for(int i = 0; i < 8; i++) {
-        mask[i] = mask[0] << (8 * i);
-    }
+// ------------------------ Bulk Block Hashing -------------------------
 
-    uint64_t y = 
-       (x >> 56) & mask[0]
-    ^ ((x >> 40) & mask[1])     
-    ^ ((x >> 24) & mask[2])
-    ^ ((x >> 8)  & mask[3])
-    ^ ((x << 24) & mask[4])
-    ^ ((x << 16) & mask[5])
-    ^ ((x << 8)  & mask[6])
-    ^ ((x << 48) & mask[7]);
+/*
+    Number of blocks read from the file per call to nextblocks(), 64 KiB.
+    The buffer gets two extra blocks so the padding always fits.
+*/
+#define SHA_BUFBLOCKS 1024
 
-    return y;
+/*
+    Multi-block version of nextblock() for the bulk backends below.
+    Reads up to (maxblocks) blocks of raw message bytes into (buf), leaving them
+    big-endian, and pads the final partial block (plus a second all-padding block
+    if needed) once the file runs out. Returns the number of blocks ready to be
+    compressed, 0 once everything has been handed out.
+*/
+size_t nextblocks(BYTE *buf, size_t maxblocks, FILE *infile, uint64_t *nobits, PADFLAG *status) {
+
+  size_t nobytesread, noblocks, tail, padded;
+  uint64_t bits;
+
+  if (*status == FINISH)
+    return 0;
+
+  nobytesread = fread(buf, 1, maxblocks * 64, infile);
+  *nobits += (8ULL * ((uint64_t) nobytesread));
+  noblocks = nobytesread / 64;
+
+  if (nobytesread < maxblocks * 64) {
+    // End of file, pad the leftover bytes into one or two more blocks.
+    tail = nobytesread % 64;
+    padded = (tail < 56) ? 64 : 128;
+    buf += noblocks * 64;
+    buf[tail] = 0x80;
+    memset(buf + tail + 1, 0, padded - 8 - (tail + 1));
+    bits = htobe64(*nobits);
+    memcpy(buf + padded - 8, &bits, 8);
+    noblocks += padded / 64;
+    *status = FINISH;
+  }
+
+  return noblocks;
 }
 
-int main(int argc, char *argv[]) {
+/*
+    A bulk backend compresses (nblocks) consecutive raw big-endian blocks from
+    (data) into H, keeping H in registers for the whole run where it can.
+*/
+typedef void (*SHA_BLOCKS_FN)(WORD *H, const BYTE *data, size_t nblocks);
 
-  // Expect and open a single filename.
-  if (argc != 2) {
-    printf("Error: expected single filename as argument.\n");
-    return 1;
+/*
+    Reference backend, converts each block to host order and runs nexthash().
+*/
+void sha256_blocks_scalar(WORD *H, const BYTE *data, size_t nblocks) {
+
+  BLOCK M;
+  int i;
+
+  for (; nblocks > 0; nblocks--, data += 64) {
+    memcpy(M.eight, data, 64);
+    for (i = 0; i < 16; i++)
+      M.threetwo[i] = be32toh(M.threetwo[i]);
+    nexthash(M.threetwo, H);
   }
+}
 
-  FILE *infile = fopen(argv[1], "rb");
-  if (!infile) {
-    printf("Error: couldn't open file %s.\n", argv[1]);
-    return 1;
+/*
+    The 64 rounds written out once, expanded by an unrolled backend with its
+    own round macro R_. The working variables rotate through the argument
+    list instead of being shuffled along after every round, (t) is the round
+    number and the last argument K[t] as an immediate.
+*/
+#define SHA256_ROUNDS(R_)                      \
+  R_(a, b, c, d, e, f, g, h,  0, 0x428a2f98U)  \
+  R_(h, a, b, c, d, e, f, g,  1, 0x71374491U)  \
+  R_(g, h, a, b, c, d, e, f,  2, 0xb5c0fbcfU)  \
+  R_(f, g, h, a, b, c, d, e,  3, 0xe9b5dba5U)  \
+  R_(e, f, g, h, a, b, c, d,  4, 0x3956c25bU)  \
+  R_(d, e, f, g, h, a, b, c,  5, 0x59f111f1U)  \
+  R_(c, d, e, f, g, h, a, b,  6, 0x923f82a4U)  \
+  R_(b, c, d, e, f, g, h, a,  7, 0xab1c5ed5U)  \
+  R_(a, b, c, d, e, f, g, h,  8, 0xd807aa98U)  \
+  R_(h, a, b, c, d, e, f, g,  9, 0x12835b01U)  \
+  R_(g, h, a, b, c, d, e, f, 10, 0x243185beU)  \
+  R_(f, g, h, a, b, c, d, e, 11, 0x550c7dc3U)  \
+  R_(e, f, g, h, a, b, c, d, 12, 0x72be5d74U)  \
+  R_(d, e, f, g, h, a, b, c, 13, 0x80deb1feU)  \
+  R_(c, d, e, f, g, h, a, b, 14, 0x9bdc06a7U)  \
+  R_(b, c, d, e, f, g, h, a, 15, 0xc19bf174U)  \
+  R_(a, b, c, d, e, f, g, h, 16, 0xe49b69c1U)  \
+  R_(h, a, b, c, d, e, f, g, 17, 0xefbe4786U)  \
+  R_(g, h, a, b, c, d, e, f, 18, 0x0fc19dc6U)  \
+  R_(f, g, h, a, b, c, d, e, 19, 0x240ca1ccU)  \
+  R_(e, f, g, h, a, b, c, d, 20, 0x2de92c6fU)  \
+  R_(d, e, f, g, h, a, b, c, 21, 0x4a7484aaU)  \
+  R_(c, d, e, f, g, h, a, b, 22, 0x5cb0a9dcU)  \
+  R_(b, c, d, e, f, g, h, a, 23, 0x76f988daU)  \
+  R_(a, b, c, d, e, f, g, h, 24, 0x983e5152U)  \
+  R_(h, a, b, c, d, e, f, g, 25, 0xa831c66dU)  \
+  R_(g, h, a, b, c, d, e, f, 26, 0xb00327c8U)  \
+  R_(f, g, h, a, b, c, d, e, 27, 0xbf597fc7U)  \
+  R_(e, f, g, h, a, b, c, d, 28, 0xc6e00bf3U)  \
+  R_(d, e, f, g, h, a, b, c, 29, 0xd5a79147U)  \
+  R_(c, d, e, f, g, h, a, b, 30, 0x06ca6351U)  \
+  R_(b, c, d, e, f, g, h, a, 31, 0x14292967U)  \
+  R_(a, b, c, d, e, f, g, h, 32, 0x27b70a85U)  \
+  R_(h, a, b, c, d, e, f, g, 33, 0x2e1b2138U)  \
+  R_(g, h, a, b, c, d, e, f, 34, 0x4d2c6dfcU)  \
+  R_(f, g, h, a, b, c, d, e, 35, 0x53380d13U)  \
+  R_(e, f, g, h, a, b, c, d, 36, 0x650a7354U)  \
+  R_(d, e, f, g, h, a, b, c, 37, 0x766a0abbU)  \
+  R_(c, d, e, f, g, h, a, b, 38, 0x81c2c92eU)  \
+  R_(b, c, d, e, f, g, h, a, 39, 0x92722c85U)  \
+  R_(a, b, c, d, e, f, g, h, 40, 0xa2bfe8a1U)  \
+  R_(h, a, b, c, d, e, f, g, 41, 0xa81a664bU)  \
+  R_(g, h, a, b, c, d, e, f, 42, 0xc24b8b70U)  \
+  R_(f, g, h, a, b, c, d, e, 43, 0xc76c51a3U)  \
+  R_(e, f, g, h, a, b, c, d, 44, 0xd192e819U)  \
+  R_(d, e, f, g, h, a, b, c, 45, 0xd6990624U)  \
+  R_(c, d, e, f, g, h, a, b, 46, 0xf40e3585U)  \
+  R_(b, c, d, e, f, g, h, a, 47, 0x106aa070U)  \
+  R_(a, b, c, d, e, f, g, h, 48, 0x19a4c116U)  \
+  R_(h, a, b, c, d, e, f, g, 49, 0x1e376c08U)  \
+  R_(g, h, a, b, c, d, e, f, 50, 0x2748774cU)  \
+  R_(f, g, h, a, b, c, d, e, 51, 0x34b0bcb5U)  \
+  R_(e, f, g, h, a, b, c, d, 52, 0x391c0cb3U)  \
+  R_(d, e, f, g, h, a, b, c, 53, 0x4ed8aa4aU)  \
+  R_(c, d, e, f, g, h, a, b, 54, 0x5b9cca4fU)  \
+  R_(b, c, d, e, f, g, h, a, 55, 0x682e6ff3U)  \
+  R_(a, b, c, d, e, f, g, h, 56, 0x748f82eeU)  \
+  R_(h, a, b, c, d, e, f, g, 57, 0x78a5636fU)  \
+  R_(g, h, a, b, c, d, e, f, 58, 0x84c87814U)  \
+  R_(f, g, h, a, b, c, d, e, 59, 0x8cc70208U)  \
+  R_(e, f, g, h, a, b, c, d, 60, 0x90befffaU)  \
+  R_(d, e, f, g, h, a, b, c, 61, 0xa4506cebU)  \
+  R_(c, d, e, f, g, h, a, b, 62, 0xbef9a3f7U)  \
+  R_(b, c, d, e, f, g, h, a, 63, 0xc67178f2U) 
+
+/*
+    Big-endian load straight from the message bytes, compilers turn this into a
+    single MOVBE or MOV + BSWAP so no separate be32toh pass over the block is needed.
+*/
+#define LOAD_BE32(p) (((WORD) (p)[0] << 24) | ((WORD) (p)[1] << 16) | ((WORD) (p)[2] << 8) | (WORD) (p)[3])
+
+/*
+    Next word of the message schedule in a rolling 16 word window, W[t & 15]
+    still holds W[t-16] when it gets overwritten with W[t].
+*/
+#define SCHED(t) (W[(t) & 15] += sig_one(W[((t) - 2) & 15]) + W[((t) - 7) & 15] + sig_zero(W[((t) - 15) & 15]))
+
+/*
+    Ch and Maj rewritten with one operation less each, the working variables
+    are always plain names here so the arguments aren't parenthesised.
+*/
+#define Ch_fast(x, y, z) (z ^ (x & (y ^ z)))
+#define Maj_fast(x, y, z) ((x & y) | (z & (x | y)))
+
+#define FAST_ROUND(a, b, c, d, e, f, g, h, t, k) { \
+  T1 = h + Sig1(e) + Ch_fast(e, f, g) + (k) + ((t) < 16 ? W[t] : SCHED(t)); \
+  d += T1; h = T1 + Sig0(a) + Maj_fast(a, b, c); }
+
+/*
+    Portable unrolled backend. Words are loaded big-endian as they're needed,
+    the schedule is computed just in time in a 16 word window the compiler can
+    keep in registers and the K constants are folded into each round.
+*/
+void sha256_blocks_fast(WORD *H, const BYTE *data, size_t nblocks) {
+
+  WORD W[16], a, b, c, d, e, f, g, h, T1;
+  int i;
+
+  for (; nblocks > 0; nblocks--, data += 64) {
+    for (i = 0; i < 16; i++)
+      W[i] = LOAD_BE32(data + 4 * i);
+
+    a = H[0]; b = H[1]; c = H[2]; d = H[3];
+    e = H[4]; f = H[5]; g = H[6]; h = H[7];
+
+    SHA256_ROUNDS(FAST_ROUND)
+
+    H[0] += a; H[1] += b; H[2] += c; H[3] += d;
+    H[4] += e; H[5] += f; H[6] += g; H[7] += h;
   }
+}
 
-  // Section 5.3.3
-  WORD H[] = {
-    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
-    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19  
-  };
-  
-  // The current padded message block.
-  BLOCK M;
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h> // SHA, SSSE3 and SSE4.1 intrinsics
+#include <cpuid.h> // __get_cpuid_count for feature detection
+
+/*
+    sig_zero and sig_one on four schedule words at once, SSE has no rotate.
+*/
+#define V4_ROTR(x, n) _mm_or_si128(_mm_srli_epi32(x, n), _mm_slli_epi32(x, 32 - (n)))
+#define V4_sig_zero(x) _mm_xor_si128(_mm_xor_si128(V4_ROTR(x,  7), V4_ROTR(x, 18)), _mm_srli_epi32(x,  3))
+#define V4_sig_one(x) _mm_xor_si128(_mm_xor_si128(V4_ROTR(x, 17), V4_ROTR(x, 19)), _mm_srli_epi32(x, 10))
+
+/*
+    Schedule words t .. t+3 from the window X0 .. X3 = W[t-16] .. W[t-1], then
+    slide the window along. W[t+2] and W[t+3] need sig_one of W[t] and W[t+1]
+    from the same group, so the group is finished in two halves.
+*/
+#define SCHED4(t) if ((t) < 64) { \
+  T = _mm_add_epi32(_mm_add_epi32(X0, V4_sig_zero(_mm_alignr_epi8(X1, X0, 4))), _mm_alignr_epi8(X3, X2, 4)); \
+  LO = _mm_add_epi32(T, V4_sig_one(_mm_shuffle_epi32(X3, 0x0E))); \
+  HI = _mm_add_epi32(T, V4_sig_one(_mm_shuffle_epi32(LO, 0x40))); \
+  X4 = _mm_castps_si128(_mm_shuffle_ps(_mm_castsi128_ps(LO), _mm_castsi128_ps(HI), 0xE4)); \
+  _mm_store_si128((__m128i *) &WK[t], _mm_add_epi32(X4, _mm_loadu_si128((const __m128i *) &K[t]))); \
+  X0 = X1; X1 = X2; X2 = X3; X3 = X4; }
+
+#define WK_ROUND(a, b, c, d, e, f, g, h, t, k) { \
+  T1 = h + Sig1(e) + Ch_fast(e, f, g) + WK[t]; \
+  d += T1; h = T1 + Sig0(a) + Maj_fast(a, b, c); }
+
+/*
+    Backend for CPUs with SSSE3 but neither SHA-NI nor AVX2. PSHUFB byte swaps
+    four message words per instruction and the schedule is computed four words
+    at a time in X0 .. X3, a 16 word window held in XMM registers. Only W+K is
+    written out, for the scalar rounds to pick up. Schedule groups are issued in
+    between the rounds so the vector and integer work can overlap.
+*/
+__attribute__((target("ssse3")))
+void sha256_blocks_ssse3(WORD *H, const BYTE *data, size_t nblocks) {
+
+  _Alignas(16) WORD WK[64];
+  __m128i X0, X1, X2, X3, X4, T, LO, HI;
+  const __m128i BSWAP = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+  WORD a, b, c, d, e, f, g, h, T1;
+  int t;
+
+  for (; nblocks > 0; nblocks--, data += 64) {
+    X0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data +  0)), BSWAP);
+    X1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 16)), BSWAP);
+    X2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 32)), BSWAP);
+    X3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 48)), BSWAP);
+    _mm_store_si128((__m128i *) &WK[0],  _mm_add_epi32(X0, _mm_loadu_si128((const __m128i *) &K[0])));
+    _mm_store_si128((__m128i *) &WK[4],  _mm_add_epi32(X1, _mm_loadu_si128((const __m128i *) &K[4])));
+    _mm_store_si128((__m128i *) &WK[8],  _mm_add_epi32(X2, _mm_loadu_si128((const __m128i *) &K[8])));
+    _mm_store_si128((__m128i *) &WK[12], _mm_add_epi32(X3, _mm_loadu_si128((const __m128i *) &K[12])));
+
+    a = H[0]; b = H[1]; c = H[2]; d = H[3];
+    e = H[4]; f = H[5]; g = H[6]; h = H[7];
+
+    // Sixteen rounds per pass, each group of four overlapping with the schedule for a later group.
+    for (t = 0; t < 64; t += 16) {
+      SCHED4(t + 16);
+      WK_ROUND(a, b, c, d, e, f, g, h, t +  0, 0); WK_ROUND(h, a, b, c, d, e, f, g, t +  1, 0);
+      WK_ROUND(g, h, a, b, c, d, e, f, t +  2, 0); WK_ROUND(f, g, h, a, b, c, d, e, t +  3, 0);
+      SCHED4(t + 20);
+      WK_ROUND(e, f, g, h, a, b, c, d, t +  4, 0); WK_ROUND(d, e, f, g, h, a, b, c, t +  5, 0);
+      WK_ROUND(c, d, e, f, g, h, a, b, t +  6, 0); WK_ROUND(b, c, d, e, f, g, h, a, t +  7, 0);
+      SCHED4(t + 24);
+      WK_ROUND(a, b, c, d, e, f, g, h, t +  8, 0); WK_ROUND(h, a, b, c, d, e, f, g, t +  9, 0);
+      WK_ROUND(g, h, a, b, c, d, e, f, t + 10, 0); WK_ROUND(f, g, h, a, b, c, d, e, t + 11, 0);
+      SCHED4(t + 28);
+      WK_ROUND(e, f, g, h, a, b, c, d, t + 12, 0); WK_ROUND(d, e, f, g, h, a, b, c, t + 13, 0);
+      WK_ROUND(c, d, e, f, g, h, a, b, t + 14, 0); WK_ROUND(b, c, d, e, f, g, h, a, t + 15, 0);
+    }
+
+    H[0] += a; H[1] += b; H[2] += c; H[3] += d;
+    H[4] += e; H[5] += f; H[6] += g; H[7] += h;
+  }
+}
+
+/*
+    The 64 rounds of sha256_blocks_shani(), on the state in STATE0/STATE1 as
+    ABEF/CDGH and the block's words already in host order in MSG0 .. MSG3.
+    MSG and TMP are scratch.
+*/
+#define SHANI_ROUNDS                                                    \
+  /* Rounds 0-3 */                                                      \
+  MSG = _mm_add_epi32(MSG0, _mm_loadu_si128((const __m128i *) &K[0]));  \
+  STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);                  \
+  MSG = _mm_shuffle_epi32(MSG, 0x0E);                                   \
+  STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);                  \
+  /* Rounds 4-7 */                                                      \
+  MSG = _mm_add_epi32(MSG1, _mm_loadu_si128((const __m128i *) &K[4]));  \
+  STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);                  \
+  MSG = _mm_shuffle_epi32(MSG, 0x0E);                                   \
+  STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);                  \
+  MSG0 = _mm_sha256msg1_epu32(MSG0, MSG1);                              \
+  /* Rounds 8-11 */                                                     \
+  MSG = _mm_add_epi32(MSG2, _mm_loadu_si128((const __m128i *) &K[8]));  \
+  STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);                  \
+  MSG = _mm_shuffle_epi32(MSG, 0x0E);                                   \
+  STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);                  \
+  MSG1 = _mm_sha256msg1_epu32(MSG1, MSG2);                              \
+  /* Rounds 12-15 */                                                    \
+  MSG = _mm_add_epi32(MSG3, _mm_loadu_si128((const __m128i *) &K[12])); \
+  STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);                  \
+  TMP = _mm_alignr_epi8(MSG3, MSG2, 4);                                 \
+  MSG0 = _mm_add_epi32(MSG0, TMP);                                      \
+  MSG0 = _mm_sha256msg2_epu32(MSG0, MSG3);                              \
+  MSG = _mm_shuffle_epi32(MSG, 0x0E);                                   \
+  STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);                  \
+  MSG2 = _mm_sha256msg1_epu32(MSG2, MSG3);                              \
+  /* Rounds 16-19 */                                                    \
+  MSG = _mm_add_epi32(MSG0, _mm_loadu_si128((const __m128i *) &K[16])); \
+  STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);                  \
+  TMP = _mm_alignr_epi8(MSG0, MSG3, 4);                                 \
+  MSG1 = _mm_add_epi32(MSG1, TMP);                                      \
+  MSG1 = _mm_sha256msg2_epu32(MSG1, MSG0);                              \
+  MSG = _mm_shuffle_epi32(MSG, 0x0E);                                   \
+  STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);                  \
+  MSG3 = _mm_sha256msg1_epu32(MSG3, MSG0);                              \
+  /* Rounds 20-23 */                                                    \
+  MSG = _mm_add_epi32(MSG1, _mm_loadu_si128((const __m128i *) &K[20])); \
+  STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);                  \
+  TMP = _mm_alignr_epi8(MSG1, MSG0, 4);                                 \
+  MSG2 = _mm_add_epi32(MSG2, TMP);                                      \
+  MSG2 = _mm_sha256msg2_epu32(MSG2, MSG1);                              \
+  MSG = _mm_shuffle_epi32(MSG, 0x0E);                                   \
+  STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);                  \
+  MSG0 = _mm_sha256msg1_epu32(MSG0, MSG1);                              \
+  /* Rounds 24-27 */                                                    \
+  MSG = _mm_add_epi32(MSG2, _mm_loadu_si128((const __m128i *) &K[24])); \
+  STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);                  \
+  TMP = _mm_alignr_epi8(MSG2, MSG1, 4);                                 \
+  MSG3 = _mm_add_epi32(MSG3, TMP);                                      \
+  MSG3 = _mm_sha256msg2_epu32(MSG3, MSG2);                              \
+  MSG = _mm_shuffle_epi32(MSG, 0x0E);                                   \
+  STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);                  \
+  MSG1 = _mm_sha256msg1_epu32(MSG1, MSG2);                              \
+  /* Rounds 28-31 */                                                    \
+  MSG = _mm_add_epi32(MSG3, _mm_loadu_si128((const __m128i *) &K[28])); \
+  STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);                  \
+  TMP = _mm_alignr_epi8(MSG3, MSG2, 4);                                 \
+  MSG0 = _mm_add_epi32(MSG0, TMP);                                      \
+  MSG0 = _mm_sha256msg2_epu32(MSG0, MSG3);                              \
+  MSG = _mm_shuffle_epi32(MSG, 0x0E);                                   \
+  STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);                  \
+  MSG2 = _mm_sha256msg1_epu32(MSG2, MSG3);                              \
+  /* Rounds 32-35 */                                                    \
+  MSG = _mm_add_epi32(MSG0, _mm_loadu_si128((const __m128i *) &K[32])); \
+  STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);                  \
+  TMP = _mm_alignr_epi8(MSG0, MSG3, 4);                                 \
+  MSG1 = _mm_add_epi32(MSG1, TMP);                                      \
+  MSG1 = _mm_sha256msg2_epu32(MSG1, MSG0);                              \
+  MSG = _mm_shuffle_epi32(MSG, 0x0E);                                   \
+  STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);                  \
+  MSG3 = _mm_sha256msg1_epu32(MSG3, MSG0);                              \
+  /* Rounds 36-39 */                                                    \
+  MSG = _mm_add_epi32(MSG1, _mm_loadu_si128((const __m128i *) &K[36])); \
+  STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);                  \
+  TMP = _mm_alignr_epi8(MSG1, MSG0, 4);                                 \
+  MSG2 = _mm_add_epi32(MSG2, TMP);                                      \
+  MSG2 = _mm_sha256msg2_epu32(MSG2, MSG1);                              \
+  MSG = _mm_shuffle_epi32(MSG, 0x0E);                                   \
+  STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);                  \
+  MSG0 = _mm_sha256msg1_epu32(MSG0, MSG1);                              \
+  /* Rounds 40-43 */                                                    \
+  MSG = _mm_add_epi32(MSG2, _mm_loadu_si128((const __m128i *) &K[40])); \
+  STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);                  \
+  TMP = _mm_alignr_epi8(MSG2, MSG1, 4);                                 \
+  MSG3 = _mm_add_epi32(MSG3, TMP);                                      \
+  MSG3 = _mm_sha256msg2_epu32(MSG3, MSG2);                              \
+  MSG = _mm_shuffle_epi32(MSG, 0x0E);                                   \
+  STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);                  \
+  MSG1 = _mm_sha256msg1_epu32(MSG1, MSG2);                              \
+  /* Rounds 44-47 */                                                    \
+  MSG = _mm_add_epi32(MSG3, _mm_loadu_si128((const __m128i *) &K[44])); \
+  STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);                  \
+  TMP = _mm_alignr_epi8(MSG3, MSG2, 4);                                 \
+  MSG0 = _mm_add_epi32(MSG0, TMP);                                      \
+  MSG0 = _mm_sha256msg2_epu32(MSG0, MSG3);                              \
+  MSG = _mm_shuffle_epi32(MSG, 0x0E);                                   \
+  STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);                  \
+  MSG2 = _mm_sha256msg1_epu32(MSG2, MSG3);                              \
+  /* Rounds 48-51 */                                                    \
+  MSG = _mm_add_epi32(MSG0, _mm_loadu_si128((const __m128i *) &K[48])); \
+  STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);                  \
+  TMP = _mm_alignr_epi8(MSG0, MSG3, 4);                                 \
+  MSG1 = _mm_add_epi32(MSG1, TMP);                                      \
+  MSG1 = _mm_sha256msg2_epu32(MSG1, MSG0);                              \
+  MSG = _mm_shuffle_epi32(MSG, 0x0E);                                   \
+  STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);                  \
+  MSG3 = _mm_sha256msg1_epu32(MSG3, MSG0);                              \
+  /* Rounds 52-55 */                                                    \
+  MSG = _mm_add_epi32(MSG1, _mm_loadu_si128((const __m128i *) &K[52])); \
+  STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);                  \
+  TMP = _mm_alignr_epi8(MSG1, MSG0, 4);                                 \
+  MSG2 = _mm_add_epi32(MSG2, TMP);                                      \
+  MSG2 = _mm_sha256msg2_epu32(MSG2, MSG1);                              \
+  MSG = _mm_shuffle_epi32(MSG, 0x0E);                                   \
+  STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);                  \
+  /* Rounds 56-59 */                                                    \
+  MSG = _mm_add_epi32(MSG2, _mm_loadu_si128((const __m128i *) &K[56])); \
+  STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);                  \
+  TMP = _mm_alignr_epi8(MSG2, MSG1, 4);                                 \
+  MSG3 = _mm_add_epi32(MSG3, TMP);                                      \
+  MSG3 = _mm_sha256msg2_epu32(MSG3, MSG2);                              \
+  MSG = _mm_shuffle_epi32(MSG, 0x0E);                                   \
+  STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);                  \
+  /* Rounds 60-63 */                                                    \
+  MSG = _mm_add_epi32(MSG3, _mm_loadu_si128((const __m128i *) &K[60])); \
+  STATE1 = _mm_sha256rnds2_epu32(STATE1, STATE0, MSG);                  \
+  MSG = _mm_shuffle_epi32(MSG, 0x0E);                                   \
+  STATE0 = _mm_sha256rnds2_epu32(STATE0, STATE1, MSG);
+
+/*
+    H as ABCD/EFGH to the ABEF/CDGH form SHA-NI wants, and back.
+*/
+#define SHANI_PACK(lo, hi, ABEF, CDGH) { \
+  TMP = _mm_shuffle_epi32(lo, 0xB1); \
+  CDGH = _mm_shuffle_epi32(hi, 0x1B); \
+  ABEF = _mm_alignr_epi8(TMP, CDGH, 8); \
+  CDGH = _mm_blend_epi16(CDGH, TMP, 0xF0); }
+
+#define SHANI_UNPACK(ABEF, CDGH, lo, hi) { \
+  TMP = _mm_shuffle_epi32(ABEF, 0x1B); \
+  CDGH = _mm_shuffle_epi32(CDGH, 0xB1); \
+  lo = _mm_blend_epi16(TMP, CDGH, 0xF0); \
+  hi = _mm_alignr_epi8(CDGH, TMP, 8); }
+
+/*
+    Backend using the SHA extensions (SHA256RNDS2, SHA256MSG1, SHA256MSG2).
+    The instructions want the state split as ABEF/CDGH, so H is shuffled
+    into that form once on entry and back once on exit. Each RNDS2 does two
+    rounds with W+K in the low half of MSG, MSG1/MSG2 compute the schedule
+    four words at a time.
+*/
+__attribute__((target("sha,ssse3,sse4.1")))
+void sha256_blocks_shani(WORD *H, const BYTE *data, size_t nblocks) {
+
+  __m128i STATE0, STATE1, ABEF_SAVE, CDGH_SAVE;
+  __m128i MSG, MSG0, MSG1, MSG2, MSG3, TMP;
+  const __m128i BSWAP = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+  // H[0..3] = ABCD, H[4..7] = EFGH, rearrange to ABEF and CDGH.
+  SHANI_PACK(_mm_loadu_si128((const __m128i *) &H[0]), _mm_loadu_si128((const __m128i *) &H[4]), STATE0, STATE1)
+
+  for (; nblocks > 0; nblocks--, data += 64) {
+    ABEF_SAVE = STATE0;
+    CDGH_SAVE = STATE1;
+
+    MSG0 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 0)), BSWAP);
+    MSG1 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 16)), BSWAP);
+    MSG2 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 32)), BSWAP);
+    MSG3 = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *) (data + 48)), BSWAP);
+
+    SHANI_ROUNDS
+
+    STATE0 = _mm_add_epi32(STATE0, ABEF_SAVE);
+    STATE1 = _mm_add_epi32(STATE1, CDGH_SAVE);
+  }
+
+  // Back from ABEF/CDGH to ABCD/EFGH.
+  SHANI_UNPACK(STATE0, STATE1, STATE0, STATE1)
+  _mm_storeu_si128((__m128i *) &H[0], STATE0);
+  _mm_storeu_si128((__m128i *) &H[4], STATE1);
+}
+
+/*
+    CPUID.1:ECX bit 9 is SSSE3.
+*/
+int cpu_has_ssse3() {
+
+  unsigned int eax, ebx, ecx, edx;
+
+  return __get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & (1u << 9));
+}
+
+/*
+    CPUID.7.0:EBX bit 29 is SHA, CPUID.1:ECX bits 9 and 19 are SSSE3 and SSE4.1.
+*/
+int cpu_has_shani() {
+
+  unsigned int eax, ebx, ecx, edx;
+
+  if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx) || !(ecx & (1u << 9)) || !(ecx & (1u << 19)))
+    return 0;
+  if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+    return 0;
+  return (ebx >> 29) & 1;
+}
+#endif
+
+/*
+    Pick the fastest backend this CPU supports. The answer is remembered so
+    asking again (once per hash context) doesn't cost a CPUID every time.
+*/
+SHA_BLOCKS_FN sha256_blocks_kernel() {
+
+  static _Atomic(SHA_BLOCKS_FN) best = NULL;
+  SHA_BLOCKS_FN fn = best;
+
+  if (fn)
+    return fn;
+  fn = sha256_blocks_fast;
+#if defined(__x86_64__) || defined(__i386__)
+  if (cpu_has_shani())
+    fn = sha256_blocks_shani;
+  else if (cpu_has_ssse3())
+    fn = sha256_blocks_ssse3;
+#endif
+  best = fn;
+  return fn;
+}
+
+/*
+    Hash the rest of (infile) with a bulk backend, H receives the result.
+    Returns 0 if reading failed part way, H is then only of a prefix.
+*/
+int sha256_file_with(SHA_BLOCKS_FN blocks, FILE *infile, WORD *H) {
+
+  static _Thread_local BYTE buf[(SHA_BUFBLOCKS + 2) * 64];
   uint64_t nobits = 0;
   PADFLAG status = READ;
+  size_t noblocks;
 
-  // Read through all of the padded message blocks.
-  while (nextblock(&M, infile, &nobits, &status)) {
-    // Calculate the next hash value.
-    nexthash(M.threetwo, H);
+  memcpy(H, H0, 8 * sizeof(WORD));
+  while ((noblocks = nextblocks(buf, SHA_BUFBLOCKS, infile, &nobits, &status)) > 0)
+    blocks(H, buf, noblocks);
+  return !ferror(infile);
+}
+
+// ------------------------- Streaming Context -------------------------
+
+/*
+    Everything needed to hash a message fed in pieces of any size, with no
+    globals and no heap, so contexts can be used concurrently from any thread.
+
+      SHA256_CTX ctx;
+      sha256_init(&ctx);
+      sha256_update(&ctx, data, len);  (as many times as needed)
+      sha256_final(&ctx, digest);      (32 bytes, big-endian)
+*/
+typedef struct {
+  _Alignas(64) WORD H[8];
+  uint64_t nobytes; // Message length so far
+  BYTE buf[64]; // Start of a block that isn't full yet
+  uint32_t buflen;
+  SHA_BLOCKS_FN blocks;
+} SHA256_CTX;
+
+void sha256_init(SHA256_CTX *ctx) {
+
+  memcpy(ctx->H, H0, sizeof(ctx->H));
+  ctx->nobytes = 0;
+  ctx->buflen = 0;
+  ctx->blocks = sha256_blocks_kernel();
+}
+
+void sha256_update(SHA256_CTX *ctx, const void *data, size_t len) {
+
+  const BYTE *p = data;
+  size_t n;
+
+  ctx->nobytes += len;
+
+  // Top up a partial block left over from last time first.
+  if (ctx->buflen) {
+    n = (64 - ctx->buflen < len) ? 64 - ctx->buflen : len;
+    memcpy(ctx->buf + ctx->buflen, p, n);
+    ctx->buflen += n;
+    p += n;
+    len -= n;
+    if (ctx->buflen < 64)
+      return;
+    ctx->blocks(ctx->H, ctx->buf, 1);
+    ctx->buflen = 0;
   }
 
-  // Print the hash.
-  for (int i = 0; i < 8; i++)
-    printf("%08" PRIx32 "", H[i]);
-  printf("\n");
+  // Whole blocks straight from the caller's memory, keep the rest for later.
+  if (len >= 64)
+    ctx->blocks(ctx->H, p, len / 64);
+  memcpy(ctx->buf, p + (len & ~(size_t) 63), len & 63);
+  ctx->buflen = len & 63;
+}
 
-  fclose(infile);
+/*
+    Pad the message as in Section 5.1.1 and write the 32 byte digest.
+*/
+void sha256_final(SHA256_CTX *ctx, BYTE digest[32]) {
 
-  return 0;
-}
\ No newline at end of file
+  BYTE last[128];
+  size_t padded = (ctx->buflen < 56) ? 64 : 128;
+  uint64_t bits = htobe64(ctx->nobytes * 8);
+  int i;
+
+  memcpy(last, ctx->buf, ctx->buflen);
+  last[ctx->buflen] = 0x80;
+  memset(last + ctx->buflen + 1, 0, padded - 8 - (ctx->buflen + 1));
+  memcpy(last + padded - 8, &bits, 8);
+  ctx->blocks(ctx->H, last, padded / 64);
+
+  for (i = 0; i < 32; i++)
+    digest[i] = (BYTE) (ctx->H[i / 4] >> (24 - 8 * (i % 4)));
+}
+
+/*
+    A context as SHA_STATE_SIZE bytes, to stop hashing and carry on later:
+    the magic "SHA2STAT", version, bytes in buf, message length so far, H
+    and the partial block. Numbers are big-endian like the rest of SHA-256.
+*/
+#define SHA_STATE_MAGIC "SHA2STAT"
+#define SHA_STATE_VERSION 1
+#define SHA_STATE_SIZE 120
+
+void sha256_export(const SHA256_CTX *ctx, BYTE out[SHA_STATE_SIZE]) {
+
+  uint32_t version = htobe32(SHA_STATE_VERSION), buflen = htobe32(ctx->buflen);
+  uint64_t nobytes = htobe64(ctx->nobytes);
+  int i;
+
+  memcpy(out, SHA_STATE_MAGIC, 8);
+  memcpy(out + 8, &version, 4);
+  memcpy(out + 12, &buflen, 4);
+  memcpy(out + 16, &nobytes, 8);
+  for (i = 0; i < 8; i++) {
+    WORD h = htobe32(ctx->H[i]);
+    memcpy(out + 24 + 4 * i, &h, 4);
+  }
+  memcpy(out + 56, ctx->buf, 64);
+}
+
+/*
+    Restore a context saved by sha256_export(), 0 if (in) isn't one.
+*/
+int sha256_import(SHA256_CTX *ctx, const BYTE in[SHA_STATE_SIZE]) {
+
+  uint32_t version, buflen;
+  uint64_t nobytes;
+  int i;
+
+  memcpy(&version, in + 8, 4);
+  memcpy(&buflen, in + 12, 4);
+  memcpy(&nobytes, in + 16, 8);
+  buflen = be32toh(buflen);
+  nobytes = be64toh(nobytes);
+  if (memcmp(in, SHA_STATE_MAGIC, 8) != 0 || be32toh(version) != SHA_STATE_VERSION || buflen != (nobytes & 63))
+    return 0;
+
+  for (i = 0; i < 8; i++) {
+    memcpy(&ctx->H[i], in + 24 + 4 * i, 4);
+    ctx->H[i] = be32toh(ctx->H[i]);
+  }
+  ctx->nobytes = nobytes;
+  ctx->buflen = buflen;
+  memcpy(ctx->buf, in + 56, 64);
+  ctx->blocks = sha256_blocks_kernel();
+  return 1;
+}
+
+/*
+    One shot hash of (len) bytes already in memory.
+*/
+void sha256_buffer(const void *data, size_t len, BYTE digest[32]) {
+
+  SHA256_CTX ctx;
+
+  sha256_init(&ctx);
+  sha256_update(&ctx, data, len);
+  sha256_final(&ctx, digest);
+}
+
+
+// ----------------------- Multi-Lane Hashing --------------------------
+
+/*
+    Independent messages can be hashed side by side, one per SIMD lane:
+    8 lanes with AVX2, 16 with AVX-512. Every lane gets its blocks from
+    nextblock() so each message is padded by the usual PADFLAG state machine,
+    and lanes with nothing left to hash are masked out.
+*/
+#define SHA_MAX_LANES 16
+
+/*
+    Lane state in structure-of-arrays form, state[i][l] is H[i] of lane l
+    and W[t][l] message word t (host order) of the block for lane l.
+*/
+typedef struct {
+  _Alignas(64) WORD state[8][SHA_MAX_LANES];
+  _Alignas(64) WORD W[16][SHA_MAX_LANES];
+} SHA_LANES;
+
+typedef void (*SHA_LANES_FN)(SHA_LANES *L, uint32_t active);
+
+/*
+    Scalar stand-in with the same shape as the vector kernels, one lane.
+*/
+void sha256_x1_scalar(SHA_LANES *L, uint32_t active) {
+
+  WORD M[16], H[8];
+  int i;
+
+  if (!(active & 1))
+    return;
+  for (i = 0; i < 16; i++)
+    M[i] = L->W[i][0];
+  for (i = 0; i < 8; i++)
+    H[i] = L->state[i][0];
+  nexthash(M, H);
+  for (i = 0; i < 8; i++)
+    L->state[i][0] = H[i];
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/*
+    Vector forms of Ch, Maj, Sig0, Sig1, sig_zero and sig_one.
+    AVX2 has no rotate so ROTR is two shifts and an OR. AVX-512 has VPRORD,
+    and VPTERNLOGD does Ch (0xCA, select) and Maj (0xE8, majority) in one go.
+*/
+#define V8_ROTR(x, n) _mm256_or_si256(_mm256_srli_epi32(x, n), _mm256_slli_epi32(x, 32 - (n)))
+#define V8_XOR3(x, y, z) _mm256_xor_si256(_mm256_xor_si256(x, y), z)
+#define V8_Ch(x, y, z) _mm256_xor_si256(_mm256_and_si256(x, y), _mm256_andnot_si256(x, z))
+#define V8_Maj(x, y, z) _mm256_or_si256(_mm256_and_si256(x, y), _mm256_and_si256(z, _mm256_or_si256(x, y)))
+#define V8_Sig0(x) V8_XOR3(V8_ROTR(x,  2), V8_ROTR(x, 13), V8_ROTR(x, 22))
+#define V8_Sig1(x) V8_XOR3(V8_ROTR(x,  6), V8_ROTR(x, 11), V8_ROTR(x, 25))
+#define V8_sig_zero(x) V8_XOR3(V8_ROTR(x,  7), V8_ROTR(x, 18), _mm256_srli_epi32(x,  3))
+#define V8_sig_one(x) V8_XOR3(V8_ROTR(x, 17), V8_ROTR(x, 19), _mm256_srli_epi32(x, 10))
+
+#define V16_XOR3(x, y, z) _mm512_ternarylogic_epi32(x, y, z, 0x96)
+#define V16_Ch(x, y, z) _mm512_ternarylogic_epi32(x, y, z, 0xCA)
+#define V16_Maj(x, y, z) _mm512_ternarylogic_epi32(x, y, z, 0xE8)
+#define V16_Sig0(x) V16_XOR3(_mm512_ror_epi32(x,  2), _mm512_ror_epi32(x, 13), _mm512_ror_epi32(x, 22))
+#define V16_Sig1(x) V16_XOR3(_mm512_ror_epi32(x,  6), _mm512_ror_epi32(x, 11), _mm512_ror_epi32(x, 25))
+#define V16_sig_zero(x) V16_XOR3(_mm512_ror_epi32(x,  7), _mm512_ror_epi32(x, 18), _mm512_srli_epi32(x,  3))
+#define V16_sig_one(x) V16_XOR3(_mm512_ror_epi32(x, 17), _mm512_ror_epi32(x, 19), _mm512_srli_epi32(x, 10))
+
+/*
+    Lanes 0 .. 7, same rounds as nexthash() with K[t] broadcast once per round.
+    The schedule is kept as a rolling 16 word window instead of all of W[64].
+*/
+__attribute__((target("avx2")))
+void sha256_x8_avx2(SHA_LANES *L, uint32_t active) {
+
+  __m256i W[16], S[8], a, b, c, d, e, f, g, h, T1, T2;
+  const __m256i bits = _mm256_set_epi32(128, 64, 32, 16, 8, 4, 2, 1);
+  const __m256i mask = _mm256_cmpeq_epi32(_mm256_and_si256(_mm256_set1_epi32((int) active), bits), bits);
+  int t;
+
+  for (t = 0; t < 16; t++)
+    W[t] = _mm256_load_si256((const __m256i *) L->W[t]);
+  for (t = 0; t < 8; t++)
+    S[t] = _mm256_load_si256((const __m256i *) L->state[t]);
+
+  a = S[0]; b = S[1]; c = S[2]; d = S[3];
+  e = S[4]; f = S[5]; g = S[6]; h = S[7];
+
+  for (t = 0; t < 64; t++) {
+    if (t >= 16)
+      W[t & 15] = _mm256_add_epi32(_mm256_add_epi32(V8_sig_one(W[(t - 2) & 15]), W[(t - 7) & 15]),
+                                   _mm256_add_epi32(V8_sig_zero(W[(t - 15) & 15]), W[t & 15]));
+    T1 = _mm256_add_epi32(_mm256_add_epi32(h, V8_Sig1(e)), _mm256_add_epi32(V8_Ch(e, f, g),
+         _mm256_add_epi32(_mm256_set1_epi32((int) K[t]), W[t & 15])));
+    T2 = _mm256_add_epi32(V8_Sig0(a), V8_Maj(a, b, c));
+    h = g; g = f; f = e; e = _mm256_add_epi32(d, T1);
+    d = c; c = b; b = a; a = _mm256_add_epi32(T1, T2);
+  }
+
+  // Only add this block into the lanes that are still active.
+  S[0] = _mm256_add_epi32(S[0], _mm256_and_si256(a, mask)); S[1] = _mm256_add_epi32(S[1], _mm256_and_si256(b, mask));
+  S[2] = _mm256_add_epi32(S[2], _mm256_and_si256(c, mask)); S[3] = _mm256_add_epi32(S[3], _mm256_and_si256(d, mask));
+  S[4] = _mm256_add_epi32(S[4], _mm256_and_si256(e, mask)); S[5] = _mm256_add_epi32(S[5], _mm256_and_si256(f, mask));
+  S[6] = _mm256_add_epi32(S[6], _mm256_and_si256(g, mask)); S[7] = _mm256_add_epi32(S[7], _mm256_and_si256(h, mask));
+  for (t = 0; t < 8; t++)
+    _mm256_store_si256((__m256i *) L->state[t], S[t]);
+}
+
+/*
+    Lanes 0 .. 15, the active bits are used directly as an AVX-512 write mask.
+*/
+__attribute__((target("avx512f")))
+void sha256_x16_avx512(SHA_LANES *L, uint32_t active) {
+
+  __m512i W[16], S[8], a, b, c, d, e, f, g, h, T1, T2;
+  const __mmask16 mask = (__mmask16) active;
+  int t;
+
+  for (t = 0; t < 16; t++)
+    W[t] = _mm512_load_si512(L->W[t]);
+  for (t = 0; t < 8; t++)
+    S[t] = _mm512_load_si512(L->state[t]);
+
+  a = S[0]; b = S[1]; c = S[2]; d = S[3];
+  e = S[4]; f = S[5]; g = S[6]; h = S[7];
+
+  for (t = 0; t < 64; t++) {
+    if (t >= 16)
+      W[t & 15] = _mm512_add_epi32(_mm512_add_epi32(V16_sig_one(W[(t - 2) & 15]), W[(t - 7) & 15]),
+                                   _mm512_add_epi32(V16_sig_zero(W[(t - 15) & 15]), W[t & 15]));
+    T1 = _mm512_add_epi32(_mm512_add_epi32(h, V16_Sig1(e)), _mm512_add_epi32(V16_Ch(e, f, g),
+         _mm512_add_epi32(_mm512_set1_epi32((int) K[t]), W[t & 15])));
+    T2 = _mm512_add_epi32(V16_Sig0(a), V16_Maj(a, b, c));
+    h = g; g = f; f = e; e = _mm512_add_epi32(d, T1);
+    d = c; c = b; b = a; a = _mm512_add_epi32(T1, T2);
+  }
+
+  _mm512_store_si512(L->state[0], _mm512_mask_add_epi32(S[0], mask, S[0], a));
+  _mm512_store_si512(L->state[1], _mm512_mask_add_epi32(S[1], mask, S[1], b));
+  _mm512_store_si512(L->state[2], _mm512_mask_add_epi32(S[2], mask, S[2], c));
+  _mm512_store_si512(L->state[3], _mm512_mask_add_epi32(S[3], mask, S[3], d));
+  _mm512_store_si512(L->state[4], _mm512_mask_add_epi32(S[4], mask, S[4], e));
+  _mm512_store_si512(L->state[5], _mm512_mask_add_epi32(S[5], mask, S[5], f));
+  _mm512_store_si512(L->state[6], _mm512_mask_add_epi32(S[6], mask, S[6], g));
+  _mm512_store_si512(L->state[7], _mm512_mask_add_epi32(S[7], mask, S[7], h));
+}
+#endif
+
+/*
+    Pick the widest lane kernel this CPU can run, (*lanes) receives its width.
+*/
+SHA_LANES_FN sha256_lanes_kernel(int *lanes) {
+
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) {
+    *lanes = 16;
+    return sha256_x16_avx512;
+  }
+  if (__builtin_cpu_supports("avx2")) {
+    *lanes = 8;
+    return sha256_x8_avx2;
+  }
+#endif
+  *lanes = 1;
+  return sha256_x1_scalar;
+}
+
+/*
+    Hash (n) independent files, out[i] receives H for names[i]. Each file is
+    opened when a lane picks it up and closed when it ends, so only (lanes)
+    are ever open at once, and each lane is fed from its own bulk buffer
+    filled by nextblocks(). A lane that finishes its file starts on the next
+    one in the queue, once the queue is empty it stays masked out until the
+    slowest lane is done. failed[i] is set for a file that couldn't be
+    opened or read, the return value is how many of those there were.
+*/
+int sha256_multi_with(SHA_LANES_FN kernel, int lanes, char *names[], int n, WORD (*out)[8], char *failed) {
+
+  SHA_LANES L;
+  BYTE *buf = malloc((size_t) lanes * (SHA_BUFBLOCKS + 2) * 64), *block;
+  FILE *files[SHA_MAX_LANES];
+  uint64_t nobits[SHA_MAX_LANES];
+  PADFLAG status[SHA_MAX_LANES];
+  size_t have[SHA_MAX_LANES], pos[SHA_MAX_LANES];
+  int job[SHA_MAX_LANES];
+  int next = 0, nfailed = 0, l, i;
+  uint32_t active = 0;
+
+  if (!buf) {
+    memset(failed, 1, n);
+    return n;
+  }
+  for (l = 0; l < lanes; l++)
+    job[l] = -1;
+
+  for (;;) {
+    for (l = 0; l < lanes; l++) {
+      // Get this lane's next padded block, refilling its buffer or moving on to a new file.
+      while (job[l] < 0 || pos[l] == have[l]) {
+        if (job[l] >= 0) {
+          have[l] = nextblocks(buf + (size_t) l * (SHA_BUFBLOCKS + 2) * 64, SHA_BUFBLOCKS, files[l], &nobits[l], &status[l]);
+          pos[l] = 0;
+          if (have[l] > 0)
+            break;
+          for (i = 0; i < 8; i++)
+            out[job[l]][i] = L.state[i][l];
+          // A read error ends the file early, its digest is of a prefix.
+          if (ferror(files[l])) {
+            failed[job[l]] = 1;
+            nfailed++;
+          }
+          fclose(files[l]);
+        }
+        // Files that can't be opened are skipped, the rest still get hashed.
+        while (next < n && !(files[l] = fopen(names[next], "rb"))) {
+          failed[next++] = 1;
+          nfailed++;
+        }
+        if (next == n) {
+          job[l] = -1;
+          break;
+        }
+        failed[next] = 0;
+        job[l] = next++;
+        nobits[l] = 0;
+        status[l] = READ;
+        have[l] = pos[l] = 0;
+        for (i = 0; i < 8; i++)
+          L.state[i][l] = H0[i];
+      }
+      if (job[l] >= 0) {
+        active |= 1u << l;
+        block = buf + ((size_t) l * (SHA_BUFBLOCKS + 2) + pos[l]++) * 64;
+        for (i = 0; i < 16; i++)
+          L.W[i][l] = LOAD_BE32(block + 4 * i);
+      } else {
+        active &= ~(1u << l);
+      }
+    }
+    if (!active)
+      break;
+    kernel(&L, active);
+  }
+
+  free(buf);
+  return nfailed;
+}
+
+/*
+    Hash (n) files, like sha256_multi_with(). The lanes only pay off without
+    SHA-NI, where they beat one file at a time through the bulk backend.
+    With SHA-NI that backend is faster than the widest lanes, so each file
+    goes through it in turn.
+*/
+int sha256_multi(char *names[], int n, WORD (*out)[8], char *failed) {
+
+  int lanes, shani = 0, nfailed = 0, i;
+  SHA_LANES_FN kernel = sha256_lanes_kernel(&lanes);
+  SHA_BLOCKS_FN blocks = sha256_blocks_kernel();
+  FILE *infile;
+
+#if defined(__x86_64__) || defined(__i386__)
+  shani = cpu_has_shani();
+#endif
+  if (lanes > 1 && !shani)
+    return sha256_multi_with(kernel, lanes, names, n, out, failed);
+
+  for (i = 0; i < n; i++) {
+    failed[i] = !(infile = fopen(names[i], "rb"));
+    if (infile) {
+      failed[i] = !sha256_file_with(blocks, infile, out[i]);
+      fclose(infile);
+    }
+    nfailed += failed[i];
+  }
+  return nfailed;
+}
+
+/*
+    Hash (lanes) messages of (len) bytes each, stored back to back from
+    (buf), one per lane. The in-memory counterpart of sha256_multi_with() for
+    messages of equal length, so every lane stays active to the end.
+*/
+void sha256_lanes_buffers(SHA_LANES_FN kernel, int lanes, const BYTE *buf, size_t len, WORD (*out)[8]) {
+
+  SHA_LANES L;
+  BYTE tail[SHA_MAX_LANES][128];
+  const uint32_t all = (uint32_t) ((1ull << lanes) - 1);
+  size_t rem = len & 63, padded = (rem < 56) ? 64 : 128, b, t;
+  uint64_t bits = htobe64((uint64_t) len * 8);
+  int l, i;
+
+  for (l = 0; l < lanes; l++)
+    for (i = 0; i < 8; i++)
+      L.state[i][l] = H0[i];
+
+  for (b = 0; b < len / 64; b++) {
+    for (l = 0; l < lanes; l++)
+      for (i = 0; i < 16; i++)
+        L.W[i][l] = LOAD_BE32(buf + l * len + 64 * b + 4 * i);
+    kernel(&L, all);
+  }
+
+  // The padded tail, laid out as nextblocks() does it.
+  for (l = 0; l < lanes; l++) {
+    memset(tail[l], 0, sizeof(tail[l]));
+    memcpy(tail[l], buf + l * len + (len & ~(size_t) 63), rem);
+    tail[l][rem] = 0x80;
+    memcpy(tail[l] + padded - 8, &bits, 8);
+  }
+  for (t = 0; t < padded; t += 64) {
+    for (l = 0; l < lanes; l++)
+      for (i = 0; i < 16; i++)
+        L.W[i][l] = LOAD_BE32(tail[l] + t + 4 * i);
+    kernel(&L, all);
+  }
+
+  for (l = 0; l < lanes; l++)
+    for (i = 0; i < 8; i++)
+      out[l][i] = L.state[i][l];
+}
+
+// ---------------------------- HMAC-SHA256 ----------------------------
+
+/*
+    HMAC(K, m) = SHA-256((K ^ opad) || SHA-256((K ^ ipad) || m)), the key
+    padded with zeros to a block, or hashed first if it's longer than one.
+    Both key blocks are the same for every message, so sha256_hmac_key()
+    runs them through nexthash() once and keeps the H each one leaves.
+    After that a message costs its own blocks plus one outer block, and
+    sha256_hmac_lanes() spreads many messages under one key across the
+    lane kernels above.
+*/
+typedef struct {
+  WORD inner[8]; // H after K ^ ipad
+  WORD outer[8]; // H after K ^ opad
+} SHA_HMAC_KEY;
+
+/*
+    A message in memory, for sha256_hmac_lanes().
+*/
+typedef struct {
+  const BYTE *p;
+  size_t len;
+} SHA_RECORD;
+
+void sha256_hmac_key(SHA_HMAC_KEY *K, const BYTE *key, size_t len) {
+
+  BYTE k[64] = {0};
+  WORD M[16];
+  int i;
+
+  if (len > 64)
+    sha256_buffer(key, len, k);
+  else
+    memcpy(k, key, len);
+
+  memcpy(K->inner, H0, sizeof(K->inner));
+  memcpy(K->outer, H0, sizeof(K->outer));
+  for (i = 0; i < 16; i++)
+    M[i] = LOAD_BE32(k + 4 * i) ^ 0x36363636;
+  nexthash(M, K->inner);
+  for (i = 0; i < 16; i++)
+    M[i] = LOAD_BE32(k + 4 * i) ^ 0x5c5c5c5c;
+  nexthash(M, K->outer);
+}
+
+/*
+    Start a context on the message part of an HMAC, the key block already
+    counted. Feed it with sha256_update() and finish with sha256_hmac_final().
+*/
+void sha256_hmac_init(SHA256_CTX *ctx, const SHA_HMAC_KEY *K) {
+
+  sha256_init(ctx);
+  memcpy(ctx->H, K->inner, sizeof(ctx->H));
+  ctx->nobytes = 64;
+}
+
+/*
+    The outer block is the inner digest padded as the end of a 64 + 32
+    byte message.
+*/
+void sha256_hmac_final(SHA256_CTX *ctx, const SHA_HMAC_KEY *K, BYTE digest[32]) {
+
+  BYTE block[64] = {0};
+  int i;
+
+  sha256_final(ctx, block);
+  block[32] = 0x80;
+  block[62] = ((64 + 32) * 8) >> 8;
+  memcpy(ctx->H, K->outer, sizeof(ctx->H));
+  ctx->blocks(ctx->H, block, 1);
+
+  for (i = 0; i < 32; i++)
+    digest[i] = (BYTE) (ctx->H[i / 4] >> (24 - 8 * (i % 4)));
+}
+
+void sha256_hmac(const SHA_HMAC_KEY *K, const void *data, size_t len, BYTE digest[32]) {
+
+  SHA256_CTX ctx;
+
+  sha256_hmac_init(&ctx, K);
+  sha256_update(&ctx, data, len);
+  sha256_hmac_final(&ctx, K, digest);
+}
+
+/*
+    HMAC of (n) messages under one key, out[i] receives H for R[i]. Each
+    lane takes its message's full blocks straight from memory, then one or
+    two padding blocks, then the outer block built from its own state, and
+    then moves on to the next message, so messages can be any length.
+*/
+void sha256_hmac_lanes(SHA_LANES_FN kernel, int lanes, const SHA_HMAC_KEY *K, const SHA_RECORD *R, size_t n,
+                       WORD (*out)[8]) {
+
+  SHA_LANES L;
+  BYTE tail[64];
+  size_t job[SHA_MAX_LANES], b[SHA_MAX_LANES], nblocks[SHA_MAX_LANES], next = 0, start;
+  uint64_t bits;
+  uint32_t active = 0;
+  int l, i;
+
+  for (l = 0; l < lanes; l++)
+    job[l] = SIZE_MAX;
+
+  for (;;) {
+    for (l = 0; l < lanes; l++) {
+      // The outer block is done, so is this lane's message.
+      if (job[l] != SIZE_MAX && b[l] > nblocks[l]) {
+        for (i = 0; i < 8; i++)
+          out[job[l]][i] = L.state[i][l];
+        job[l] = SIZE_MAX;
+      }
+      if (job[l] == SIZE_MAX) {
+        if (next == n) {
+          active &= ~(1u << l);
+          continue;
+        }
+        job[l] = next++;
+        b[l] = 0;
+        nblocks[l] = (R[job[l]].len + 8) / 64 + 1;
+        for (i = 0; i < 8; i++)
+          L.state[i][l] = K->inner[i];
+        active |= 1u << l;
+      }
+
+      start = 64 * b[l];
+      if (start + 64 <= R[job[l]].len) {
+        for (i = 0; i < 16; i++)
+          L.W[i][l] = LOAD_BE32(R[job[l]].p + start + 4 * i);
+      } else if (b[l] < nblocks[l]) {
+        // Padding, laid out as sha256_final() does it.
+        memset(tail, 0, 64);
+        if (start <= R[job[l]].len) {
+          memcpy(tail, R[job[l]].p + start, R[job[l]].len - start);
+          tail[R[job[l]].len - start] = 0x80;
+        }
+        if (b[l] == nblocks[l] - 1) {
+          bits = htobe64((uint64_t) (64 + R[job[l]].len) * 8);
+          memcpy(tail + 56, &bits, 8);
+        }
+        for (i = 0; i < 16; i++)
+          L.W[i][l] = LOAD_BE32(tail + 4 * i);
+      } else {
+        // The inner digest is this lane's H, already in message word order.
+        for (i = 0; i < 8; i++) {
+          L.W[i][l] = L.state[i][l];
+          L.state[i][l] = K->outer[i];
+        }
+        L.W[8][l] = 0x80000000;
+        for (i = 9; i < 15; i++)
+          L.W[i][l] = 0;
+        L.W[15][l] = (64 + 32) * 8;
+      }
+      b[l]++;
+    }
+    if (!active)
+      break;
+    kernel(&L, active);
+  }
+}
+
+// ------------------------ PBKDF2-HMAC-SHA256 -------------------------
+
+/*
+    PBKDF2 (RFC 8018) with HMAC-SHA256. Block i of the derived key is
+    T_i = U_1 ^ U_2 ^ .. ^ U_c, with U_1 = HMAC(P, S || INT(i)) and
+    U_j = HMAC(P, U_j-1). After U_1 every HMAC is of a 32 byte message, so
+    both of its blocks always look the same: U in words 0-7, the 1 bit in
+    word 8, zeros, and (64 + 32) * 8 bits in word 15. The kernels below run
+    the c - 1 iterations from there with U, T and the key's two midstates
+    in registers, writing the block straight from U rather than going
+    through sha256_update() and sha256_final() twice per iteration. The
+    blocks of one long key, or of many requests, go side by side in SIMD
+    lanes, or two at a time on SHA-NI when there are only a few.
+*/
+#define SHA_PBKDF2_BITS ((64 + 32) * 8)
+
+// The longest key RFC 8018 allows, (2^32 - 1) blocks of 32 bytes.
+#define SHA_PBKDF2_MAX_DKLEN ((((uint64_t) 1 << 32) - 1) * 32)
+
+/*
+    Blocks needed before the lane kernels win, against sha256_pbkdf2_x1_fast()
+    and against SHA-NI two blocks at a time. From timing 600k iterations:
+    x16 AVX-512 takes about 4.5 times as long per call as x2 SHA-NI and
+    x8 AVX2 about twice as long as x1 scalar. AVX2 never beats SHA-NI.
+*/
+#define SHA_PBKDF2_WIDE 3
+#define SHA_PBKDF2_SHANI_WIDE 10
+
+/*
+    One derivation: the password, the salt and where (outlen) bytes of
+    derived key go.
+*/
+typedef struct {
+  const BYTE *pass;
+  size_t passlen;
+  const BYTE *salt;
+  size_t saltlen;
+  BYTE *out;
+  size_t outlen;
+} SHA_PBKDF2_JOB;
+
+/*
+    Lane state as for SHA_LANES, [w][l] is word w of lane l.
+*/
+typedef struct {
+  _Alignas(64) WORD inner[8][SHA_MAX_LANES]; // H after K ^ ipad
+  _Alignas(64) WORD outer[8][SHA_MAX_LANES]; // H after K ^ opad
+  _Alignas(64) WORD U[8][SHA_MAX_LANES]; // The last U
+  _Alignas(64) WORD T[8][SHA_MAX_LANES]; // XOR of every U so far
+} SHA_PBKDF2_LANES;
+
+/*
+    Run (rounds) more iterations on every lane of (P).
+*/
+typedef void (*SHA_PBKDF2_FN)(SHA_PBKDF2_LANES *P, uint32_t rounds);
+
+/*
+    U = compress(mid, U || padding), on plain words with the rounds of
+    sha256_blocks_fast(). The constant half of W folds into the first rounds.
+*/
+#define PBKDF2_BLOCK(mid) { \
+  for (i = 0; i < 8; i++) \
+    W[i] = U[i]; \
+  W[8] = 0x80000000; W[9] = W[10] = W[11] = W[12] = W[13] = W[14] = 0; W[15] = SHA_PBKDF2_BITS; \
+  a = mid[0]; b = mid[1]; c = mid[2]; d = mid[3]; \
+  e = mid[4]; f = mid[5]; g = mid[6]; h = mid[7]; \
+  SHA256_ROUNDS(FAST_ROUND) \
+  U[0] = mid[0] + a; U[1] = mid[1] + b; U[2] = mid[2] + c; U[3] = mid[3] + d; \
+  U[4] = mid[4] + e; U[5] = mid[5] + f; U[6] = mid[6] + g; U[7] = mid[7] + h; }
+
+void sha256_pbkdf2_x1_fast(SHA_PBKDF2_LANES *P, uint32_t rounds) {
+
+  WORD W[16], I[8], O[8], U[8], T[8], a, b, c, d, e, f, g, h, T1;
+  int i;
+
+  for (i = 0; i < 8; i++) {
+    I[i] = P->inner[i][0]; O[i] = P->outer[i][0];
+    U[i] = P->U[i][0]; T[i] = P->T[i][0];
+  }
+  for (; rounds > 0; rounds--) {
+    PBKDF2_BLOCK(I)
+    PBKDF2_BLOCK(O)
+    for (i = 0; i < 8; i++)
+      T[i] ^= U[i];
+  }
+  for (i = 0; i < 8; i++) {
+    P->U[i][0] = U[i];
+    P->T[i][0] = T[i];
+  }
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+/*
+    Two lanes on the SHA extensions. Each lane is one long chain of
+    SHA256RNDS2, so a single lane leaves the unit idle waiting on latency
+    and the second lane's chain fills those gaps. The midstates stay packed,
+    U goes back to ABCD/EFGH after each block since it's the next block's
+    message.
+*/
+#define PBKDF2_SHANI_BLOCK(ABEF, CDGH, l) { \
+  MSG0 = U0[l]; MSG1 = U1[l]; MSG2 = PAD0; MSG3 = PAD1; \
+  STATE0 = ABEF[l]; STATE1 = CDGH[l]; \
+  SHANI_ROUNDS \
+  STATE0 = _mm_add_epi32(STATE0, ABEF[l]); \
+  STATE1 = _mm_add_epi32(STATE1, CDGH[l]); \
+  SHANI_UNPACK(STATE0, STATE1, U0[l], U1[l]) }
+
+__attribute__((target("sha,ssse3,sse4.1")))
+void sha256_pbkdf2_x2_shani(SHA_PBKDF2_LANES *P, uint32_t rounds) {
+
+  __m128i STATE0, STATE1, MSG, MSG0, MSG1, MSG2, MSG3, TMP;
+  __m128i IABEF[2], ICDGH[2], OABEF[2], OCDGH[2], U0[2], U1[2], T0[2], T1[2];
+  const __m128i PAD0 = _mm_set_epi32(0, 0, 0, (int) 0x80000000), PAD1 = _mm_set_epi32(SHA_PBKDF2_BITS, 0, 0, 0);
+  _Alignas(16) WORD w[4][8];
+  int i, l;
+
+  for (l = 0; l < 2; l++) {
+    for (i = 0; i < 8; i++) {
+      w[0][i] = P->inner[i][l]; w[1][i] = P->outer[i][l];
+      w[2][i] = P->U[i][l]; w[3][i] = P->T[i][l];
+    }
+    SHANI_PACK(_mm_load_si128((const __m128i *) &w[0][0]), _mm_load_si128((const __m128i *) &w[0][4]), IABEF[l], ICDGH[l])
+    SHANI_PACK(_mm_load_si128((const __m128i *) &w[1][0]), _mm_load_si128((const __m128i *) &w[1][4]), OABEF[l], OCDGH[l])
+    U0[l] = _mm_load_si128((const __m128i *) &w[2][0]); U1[l] = _mm_load_si128((const __m128i *) &w[2][4]);
+    T0[l] = _mm_load_si128((const __m128i *) &w[3][0]); T1[l] = _mm_load_si128((const __m128i *) &w[3][4]);
+  }
+
+  for (; rounds > 0; rounds--) {
+    PBKDF2_SHANI_BLOCK(IABEF, ICDGH, 0)
+    PBKDF2_SHANI_BLOCK(IABEF, ICDGH, 1)
+    PBKDF2_SHANI_BLOCK(OABEF, OCDGH, 0)
+    PBKDF2_SHANI_BLOCK(OABEF, OCDGH, 1)
+    for (l = 0; l < 2; l++) {
+      T0[l] = _mm_xor_si128(T0[l], U0[l]);
+      T1[l] = _mm_xor_si128(T1[l], U1[l]);
+    }
+  }
+
+  for (l = 0; l < 2; l++) {
+    _mm_store_si128((__m128i *) &w[2][0], U0[l]); _mm_store_si128((__m128i *) &w[2][4], U1[l]);
+    _mm_store_si128((__m128i *) &w[3][0], T0[l]); _mm_store_si128((__m128i *) &w[3][4], T1[l]);
+    for (i = 0; i < 8; i++) {
+      P->U[i][l] = w[2][i];
+      P->T[i][l] = w[3][i];
+    }
+  }
+}
+
+/*
+    Lane 0 alone, for a single block. Quicker than sha256_pbkdf2_x2_shani()
+    with a lane going spare, the two chains don't overlap perfectly.
+*/
+__attribute__((target("sha,ssse3,sse4.1")))
+void sha256_pbkdf2_x1_shani(SHA_PBKDF2_LANES *P, uint32_t rounds) {
+
+  __m128i STATE0, STATE1, MSG, MSG0, MSG1, MSG2, MSG3, TMP;
+  __m128i IABEF[1], ICDGH[1], OABEF[1], OCDGH[1], U0[1], U1[1], T0, T1;
+  const __m128i PAD0 = _mm_set_epi32(0, 0, 0, (int) 0x80000000), PAD1 = _mm_set_epi32(SHA_PBKDF2_BITS, 0, 0, 0);
+  _Alignas(16) WORD w[4][8];
+  int i;
+
+  for (i = 0; i < 8; i++) {
+    w[0][i] = P->inner[i][0]; w[1][i] = P->outer[i][0];
+    w[2][i] = P->U[i][0]; w[3][i] = P->T[i][0];
+  }
+  SHANI_PACK(_mm_load_si128((const __m128i *) &w[0][0]), _mm_load_si128((const __m128i *) &w[0][4]), IABEF[0], ICDGH[0])
+  SHANI_PACK(_mm_load_si128((const __m128i *) &w[1][0]), _mm_load_si128((const __m128i *) &w[1][4]), OABEF[0], OCDGH[0])
+  U0[0] = _mm_load_si128((const __m128i *) &w[2][0]); U1[0] = _mm_load_si128((const __m128i *) &w[2][4]);
+  T0 = _mm_load_si128((const __m128i *) &w[3][0]); T1 = _mm_load_si128((const __m128i *) &w[3][4]);
+
+  for (; rounds > 0; rounds--) {
+    PBKDF2_SHANI_BLOCK(IABEF, ICDGH, 0)
+    PBKDF2_SHANI_BLOCK(OABEF, OCDGH, 0)
+    T0 = _mm_xor_si128(T0, U0[0]);
+    T1 = _mm_xor_si128(T1, U1[0]);
+  }
+
+  _mm_store_si128((__m128i *) &w[2][0], U0[0]); _mm_store_si128((__m128i *) &w[2][4], U1[0]);
+  _mm_store_si128((__m128i *) &w[3][0], T0); _mm_store_si128((__m128i *) &w[3][4], T1);
+  for (i = 0; i < 8; i++) {
+    P->U[i][0] = w[2][i];
+    P->T[i][0] = w[3][i];
+  }
+}
+
+/*
+    The vector kernels' block, same rounds as sha256_x8_avx2() and
+    sha256_x16_avx512() with the padding words broadcast.
+*/
+#define PBKDF2_V8_BLOCK(mid) { \
+  for (i = 0; i < 8; i++) \
+    W[i] = U[i]; \
+  W[8] = _mm256_set1_epi32((int) 0x80000000); \
+  for (i = 9; i < 15; i++) \
+    W[i] = _mm256_setzero_si256(); \
+  W[15] = _mm256_set1_epi32(SHA_PBKDF2_BITS); \
+  a = mid[0]; b = mid[1]; c = mid[2]; d = mid[3]; \
+  e = mid[4]; f = mid[5]; g = mid[6]; h = mid[7]; \
+  for (t = 0; t < 64; t++) { \
+    if (t >= 16) \
+      W[t & 15] = _mm256_add_epi32(_mm256_add_epi32(V8_sig_one(W[(t - 2) & 15]), W[(t - 7) & 15]), \
+                                   _mm256_add_epi32(V8_sig_zero(W[(t - 15) & 15]), W[t & 15])); \
+    T1 = _mm256_add_epi32(_mm256_add_epi32(h, V8_Sig1(e)), _mm256_add_epi32(V8_Ch(e, f, g), \
+         _mm256_add_epi32(_mm256_set1_epi32((int) K[t]), W[t & 15]))); \
+    T2 = _mm256_add_epi32(V8_Sig0(a), V8_Maj(a, b, c)); \
+    h = g; g = f; f = e; e = _mm256_add_epi32(d, T1); \
+    d = c; c = b; b = a; a = _mm256_add_epi32(T1, T2); \
+  } \
+  U[0] = _mm256_add_epi32(mid[0], a); U[1] = _mm256_add_epi32(mid[1], b); \
+  U[2] = _mm256_add_epi32(mid[2], c); U[3] = _mm256_add_epi32(mid[3], d); \
+  U[4] = _mm256_add_epi32(mid[4], e); U[5] = _mm256_add_epi32(mid[5], f); \
+  U[6] = _mm256_add_epi32(mid[6], g); U[7] = _mm256_add_epi32(mid[7], h); }
+
+#define PBKDF2_V16_BLOCK(mid) { \
+  for (i = 0; i < 8; i++) \
+    W[i] = U[i]; \
+  W[8] = _mm512_set1_epi32((int) 0x80000000); \
+  for (i = 9; i < 15; i++) \
+    W[i] = _mm512_setzero_si512(); \
+  W[15] = _mm512_set1_epi32(SHA_PBKDF2_BITS); \
+  a = mid[0]; b = mid[1]; c = mid[2]; d = mid[3]; \
+  e = mid[4]; f = mid[5]; g = mid[6]; h = mid[7]; \
+  for (t = 0; t < 64; t++) { \
+    if (t >= 16) \
+      W[t & 15] = _mm512_add_epi32(_mm512_add_epi32(V16_sig_one(W[(t - 2) & 15]), W[(t - 7) & 15]), \
+                                   _mm512_add_epi32(V16_sig_zero(W[(t - 15) & 15]), W[t & 15])); \
+    T1 = _mm512_add_epi32(_mm512_add_epi32(h, V16_Sig1(e)), _mm512_add_epi32(V16_Ch(e, f, g), \
+         _mm512_add_epi32(_mm512_set1_epi32((int) K[t]), W[t & 15]))); \
+    T2 = _mm512_add_epi32(V16_Sig0(a), V16_Maj(a, b, c)); \
+    h = g; g = f; f = e; e = _mm512_add_epi32(d, T1); \
+    d = c; c = b; b = a; a = _mm512_add_epi32(T1, T2); \
+  } \
+  U[0] = _mm512_add_epi32(mid[0], a); U[1] = _mm512_add_epi32(mid[1], b); \
+  U[2] = _mm512_add_epi32(mid[2], c); U[3] = _mm512_add_epi32(mid[3], d); \
+  U[4] = _mm512_add_epi32(mid[4], e); U[5] = _mm512_add_epi32(mid[5], f); \
+  U[6] = _mm512_add_epi32(mid[6], g); U[7] = _mm512_add_epi32(mid[7], h); }
+
+__attribute__((target("avx2")))
+void sha256_pbkdf2_x8_avx2(SHA_PBKDF2_LANES *P, uint32_t rounds) {
+
+  __m256i W[16], I[8], O[8], U[8], T[8], a, b, c, d, e, f, g, h, T1, T2;
+  int i, t;
+
+  for (i = 0; i < 8; i++) {
+    I[i] = _mm256_load_si256((const __m256i *) P->inner[i]);
+    O[i] = _mm256_load_si256((const __m256i *) P->outer[i]);
+    U[i] = _mm256_load_si256((const __m256i *) P->U[i]);
+    T[i] = _mm256_load_si256((const __m256i *) P->T[i]);
+  }
+  for (; rounds > 0; rounds--) {
+    PBKDF2_V8_BLOCK(I)
+    PBKDF2_V8_BLOCK(O)
+    for (i = 0; i < 8; i++)
+      T[i] = _mm256_xor_si256(T[i], U[i]);
+  }
+  for (i = 0; i < 8; i++) {
+    _mm256_store_si256((__m256i *) P->U[i], U[i]);
+    _mm256_store_si256((__m256i *) P->T[i], T[i]);
+  }
+}
+
+__attribute__((target("avx512f")))
+void sha256_pbkdf2_x16_avx512(SHA_PBKDF2_LANES *P, uint32_t rounds) {
+
+  __m512i W[16], I[8], O[8], U[8], T[8], a, b, c, d, e, f, g, h, T1, T2;
+  int i, t;
+
+  for (i = 0; i < 8; i++) {
+    I[i] = _mm512_load_si512(P->inner[i]);
+    O[i] = _mm512_load_si512(P->outer[i]);
+    U[i] = _mm512_load_si512(P->U[i]);
+    T[i] = _mm512_load_si512(P->T[i]);
+  }
+  for (; rounds > 0; rounds--) {
+    PBKDF2_V16_BLOCK(I)
+    PBKDF2_V16_BLOCK(O)
+    for (i = 0; i < 8; i++)
+      T[i] = _mm512_xor_si512(T[i], U[i]);
+  }
+  for (i = 0; i < 8; i++) {
+    _mm512_store_si512(P->U[i], U[i]);
+    _mm512_store_si512(P->T[i], T[i]);
+  }
+}
+#endif
+
+/*
+    The quickest kernel for (left) blocks still to derive, (*lanes)
+    receives how many of them it takes.
+*/
+SHA_PBKDF2_FN sha256_pbkdf2_kernel(size_t left, int *lanes) {
+
+  int shani = 0;
+
+#if defined(__x86_64__) || defined(__i386__)
+  shani = cpu_has_shani();
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f") && left >= (shani ? SHA_PBKDF2_SHANI_WIDE : SHA_PBKDF2_WIDE)) {
+    *lanes = 16;
+    return sha256_pbkdf2_x16_avx512;
+  }
+  if (__builtin_cpu_supports("avx2") && !shani && left >= SHA_PBKDF2_WIDE) {
+    *lanes = 8;
+    return sha256_pbkdf2_x8_avx2;
+  }
+  if (shani) {
+    *lanes = left >= 2 ? 2 : 1;
+    return left >= 2 ? sha256_pbkdf2_x2_shani : sha256_pbkdf2_x1_shani;
+  }
+#endif
+  (void) shani;
+  *lanes = 1;
+  return sha256_pbkdf2_x1_fast;
+}
+
+/*
+    Set lane (l) up for block (i), counting from 1, of (J): the password's
+    two midstates, and U_1 = T = HMAC(P, S || INT(i)) the usual way.
+*/
+void sha256_pbkdf2_start(SHA_PBKDF2_LANES *P, int l, const SHA_PBKDF2_JOB *J, uint32_t i) {
+
+  SHA_HMAC_KEY K;
+  SHA256_CTX ctx;
+  BYTE u[32], be[4] = { (BYTE) (i >> 24), (BYTE) (i >> 16), (BYTE) (i >> 8), (BYTE) i };
+  int w;
+
+  sha256_hmac_key(&K, J->pass, J->passlen);
+  sha256_hmac_init(&ctx, &K);
+  sha256_update(&ctx, J->salt, J->saltlen);
+  sha256_update(&ctx, be, 4);
+  sha256_hmac_final(&ctx, &K, u);
+  for (w = 0; w < 8; w++) {
+    P->inner[w][l] = K.inner[w];
+    P->outer[w][l] = K.outer[w];
+    P->U[w][l] = P->T[w][l] = LOAD_BE32(u + 4 * w);
+  }
+}
+
+/*
+    Derive every job's key with (iterations) iterations (at least 1). The
+    blocks of all the jobs are dealt out to the lanes together, so a single
+    long key and many short ones both fill them.
+*/
+void sha256_pbkdf2_many(const SHA_PBKDF2_JOB *jobs, size_t n, uint32_t iterations) {
+
+  SHA_PBKDF2_LANES P;
+  size_t left = 0, job[SHA_MAX_LANES], j = 0, pos, b;
+  uint32_t block[SHA_MAX_LANES], i = 1;
+  SHA_PBKDF2_FN kernel;
+  int k, l;
+  memset(&P, 0, sizeof(P));
+  for (j = 0; j < n; j++)
+    left += (jobs[j].outlen + 31) / 32;
+  if (iterations < 1)
+    iterations = 1;
+
+  for (j = 0; left > 0; left -= k) {
+    kernel = sha256_pbkdf2_kernel(left, &k);
+    if ((size_t) k > left)
+      k = (int) left;
+    for (l = 0; l < k; l++) {
+      while (32 * (size_t) (i - 1) >= jobs[j].outlen) {
+        j++;
+        i = 1;
+      }
+      job[l] = j;
+      block[l] = i++;
+      sha256_pbkdf2_start(&P, l, &jobs[job[l]], block[l]);
+    }
+
+    kernel(&P, iterations - 1);
+
+    // Big-endian T, the last block of a key cut short.
+    for (l = 0; l < k; l++) {
+      pos = 32 * (size_t) (block[l] - 1);
+      for (b = 0; b < 32 && pos + b < jobs[job[l]].outlen; b++)
+        jobs[job[l]].out[pos + b] = (BYTE) (P.T[b / 4][l] >> (24 - 8 * (b % 4)));
+    }
+  }
+}
+
+void sha256_pbkdf2(const BYTE *pass, size_t passlen, const BYTE *salt, size_t saltlen, uint32_t iterations,
+                   BYTE *out, size_t outlen) {
+
+  SHA_PBKDF2_JOB J = { pass, passlen, salt, saltlen, out, outlen };
+
+  sha256_pbkdf2_many(&J, 1, iterations);
+}
+
+// -------------------------- Tree Hash Mode ---------------------------
+
+/*
+    Plain SHA-256 is one long dependency chain, so a single huge file can
+    only ever use one core. Tree mode (--tree) gives a different digest that
+    can be computed on every core at once.
+
+    Format SHA256-TREE-V1:
+
+      - The file is cut into leaves of SHA_TREE_LEAF (1 MiB) bytes, the
+        last one may be shorter. An empty file is one empty leaf.
+      - leaf = SHA-256(LEAF_TAG || leaf bytes)
+      - node = SHA-256(NODE_TAG || left digest || right digest)
+      - Leaves are paired left to right into nodes, then those nodes,
+        and so on. A node left without a partner moves up a level as it
+        is. The last one left is the root.
+      - LEAF_TAG and NODE_TAG are 64 byte blocks holding the ASCII strings
+        "SHA256-TREE-V1 LEAF" and "SHA256-TREE-V1 NODE" followed by zeros.
+        Leaves can never be mistaken for nodes, and since the tags are
+        exactly one block they're compressed once up front, and every
+        leaf starts from that midstate with its data still block aligned.
+
+    The root is printed as "SHA256-TREE-V1 (file) = <hex>". The leaf size is
+    part of the format, so a different leaf size would be a new version.
+    The root only depends on the file, never on the number of threads.
+*/
+#define SHA_TREE_LEAF (1 << 20)
+#define SHA_TREE_LEAF_TAG "SHA256-TREE-V1 LEAF"
+#define SHA_TREE_NODE_TAG "SHA256-TREE-V1 NODE"
+
+/*
+    One file being tree hashed. Workers claim leaves from (next) one at a
+    time and write leaf i's digest to digest[i].
+*/
+typedef struct {
+  int fd;
+  uint64_t size;
+  uint64_t noleaves;
+  _Atomic uint64_t next;
+  atomic_int failed;
+  BYTE (*digest)[32];
+  WORD leaf_mid[8]; // State after compressing LEAF_TAG
+  WORD node_mid[8]; // State after compressing NODE_TAG
+} SHA_TREE;
+
+/*
+    State after hashing a one block tag, the starting point for every
+    leaf or node with that tag.
+*/
+void sha256_tree_midstate(WORD *mid, const char *tag) {
+
+  BYTE block[64] = {0};
+
+  memcpy(block, tag, strlen(tag));
+  memcpy(mid, H0, 32);
+  sha256_blocks_kernel()(mid, block, 1);
+}
+
+/*
+    Finish hashing (len) more bytes from a tag's midstate.
+*/
+void sha256_tree_digest(const WORD *mid, const BYTE *data, size_t len, BYTE digest[32]) {
+
+  SHA256_CTX ctx;
+
+  sha256_init(&ctx);
+  memcpy(ctx.H, mid, sizeof(ctx.H));
+  ctx.nobytes = 64;
+  sha256_update(&ctx, data, len);
+  sha256_final(&ctx, digest);
+}
+
+/* Fill (len) bytes at (offset), retrying short reads and EINTR. Stops early at EOF or on error */
+size_t pread_full(int fd, BYTE *buf, size_t len, off_t offset) {
+
+  size_t done = 0;
+  ssize_t n;
+
+  while (done < len) {
+    n = pread(fd, buf + done, len - done, offset + (off_t) done);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    done += (size_t) n;
+  }
+  return done;
+}
+
+void *sha256_tree_worker(void *arg) {
+
+  SHA_TREE *T = arg;
+  BYTE *buf = aligned_alloc(64, SHA_TREE_LEAF);
+  uint64_t i, offset;
+  size_t len;
+
+  if (!buf) {
+    T->failed = 1;
+    return NULL;
+  }
+
+  while ((i = atomic_fetch_add(&T->next, 1)) < T->noleaves) {
+    offset = i * SHA_TREE_LEAF;
+    len = (T->size - offset < SHA_TREE_LEAF) ? (size_t) (T->size - offset) : SHA_TREE_LEAF;
+    if (pread_full(T->fd, buf, len, (off_t) offset) != len) {
+      T->failed = 1;
+      break;
+    }
+    sha256_tree_digest(T->leaf_mid, buf, len, T->digest[i]);
+  }
+
+  free(buf);
+  return NULL;
+}
+
+/*
+    Leaf digests of a pipe or other stream, which has no size up front and
+    can't be read at an offset, so its leaves are read one after another on
+    this thread. They are the same leaves a regular file with those bytes
+    would have, so the root is too.
+*/
+void sha256_tree_stream(SHA_TREE *T) {
+
+  BYTE *buf = aligned_alloc(64, SHA_TREE_LEAF), (*grown)[32];
+  uint64_t cap = 0;
+  size_t len;
+  ssize_t got = 0;
+
+  T->noleaves = 0;
+  T->digest = NULL;
+  if (!buf) {
+    T->failed = 1;
+    return;
+  }
+
+  do {
+    for (len = 0; len < SHA_TREE_LEAF; len += (size_t) got) {
+      got = read(T->fd, buf + len, SHA_TREE_LEAF - len);
+      if (got < 0 && errno == EINTR)
+        got = 0;
+      else if (got <= 0)
+        break;
+    }
+    if (got < 0) {
+      T->failed = 1;
+      break;
+    }
+    // An empty stream is one empty leaf, otherwise EOF on a leaf boundary adds none.
+    if (len == 0 && T->noleaves > 0)
+      break;
+    if (T->noleaves == cap) {
+      cap = cap ? 2 * cap : 64;
+      if (!(grown = realloc(T->digest, cap * sizeof(*T->digest)))) {
+        T->failed = 1;
+        break;
+      }
+      T->digest = grown;
+    }
+    sha256_tree_digest(T->leaf_mid, buf, len, T->digest[T->noleaves++]);
+  } while (len == SHA_TREE_LEAF);
+
+  free(buf);
+}
+
+/*
+    Tree hash an open file on (nothreads) threads, writing the root to
+    (root). A pipe or other stream is read on this thread alone. Returns 0
+    if the file couldn't be read.
+*/
+int sha256_tree(int fd, int nothreads, BYTE root[32]) {
+
+  SHA_TREE T;
+  struct stat st;
+  pthread_t *threads = NULL;
+  uint64_t n, i;
+  int t, started = 0;
+
+  if (fstat(fd, &st) != 0)
+    return 0;
+
+  T.fd = fd;
+  T.next = 0;
+  T.failed = 0;
+  sha256_tree_midstate(T.leaf_mid, SHA_TREE_LEAF_TAG);
+  sha256_tree_midstate(T.node_mid, SHA_TREE_NODE_TAG);
+
+  if (!S_ISREG(st.st_mode)) {
+    // No size to split by, the leaves are read in order instead.
+    sha256_tree_stream(&T);
+  } else {
+    T.size = (uint64_t) st.st_size;
+    T.noleaves = T.size ? (T.size + SHA_TREE_LEAF - 1) / SHA_TREE_LEAF : 1;
+    T.digest = malloc(T.noleaves * sizeof(*T.digest));
+
+    if (nothreads < 1)
+      nothreads = 1;
+    if ((uint64_t) nothreads > T.noleaves)
+      nothreads = (int) T.noleaves;
+    threads = malloc(nothreads * sizeof(pthread_t));
+    if (!T.digest || !threads) {
+      free(T.digest);
+      free(threads);
+      return 0;
+    }
+
+    // Hash the leaves, this thread takes a share too.
+    for (t = 1; t < nothreads; t++)
+      if (pthread_create(&threads[started], NULL, sha256_tree_worker, &T) == 0)
+        started++;
+    sha256_tree_worker(&T);
+    for (t = 0; t < started; t++)
+      pthread_join(threads[t], NULL);
+  }
+
+  // Combine pairs level by level, in place, until only the root is left.
+  for (n = T.noleaves; n > 1 && !T.failed; n = (n + 1) / 2) {
+    for (i = 0; i < n / 2; i++)
+      sha256_tree_digest(T.node_mid, T.digest[2 * i], 64, T.digest[i]);
+    if (n & 1)
+      memmove(T.digest[n / 2], T.digest[n - 1], 32);
+  }
+  if (!T.failed)
+    memcpy(root, T.digest[0], 32);
+
+  free(T.digest);
+  free(threads);
+  return !T.failed;
+}
+
+/*
+    Tree hash every file named on the command line.
+*/
+int main_tree(int n, char *names[], int nothreads) {
+
+  BYTE root[32];
+  int i, j, fd;
+
+  for (i = 0; i < n; i++) {
+    fd = open(names[i], O_RDONLY);
+    if (fd < 0 || !sha256_tree(fd, nothreads, root)) {
+      printf("Error: couldn't read file %s.\n", names[i]);
+      if (fd >= 0)
+        close(fd);
+      return 1;
+    }
+    close(fd);
+
+    printf("SHA256-TREE-V1 (%s) = ", names[i]);
+    for (j = 0; j < 32; j++)
+      printf("%02x", root[j]);
+    printf("\n");
+  }
+  return 0;
+}
+
+// ---------------------------- Benchmark ------------------------------
+
+/*
+    --bench times every SHA-256 backend and lane kernel this CPU can run over
+    a sweep of message sizes in memory, and from 64KiB up the same bytes from
+    a file through the bulk reader and tree mode. Each case is run once to
+    warm up, then timed for at least SHA_BENCH_MIN_REPS samples of
+    SHA_BENCH_SAMPLE_NS or more. The median and p99 per call are printed as
+    GB/s, cycles/byte (TSC ticks) and digests/s, and written as JSON to
+    bench-sha256.json (or --json <path>), laid out like md5's report.
+*/
+#define SHA_BENCH_MIN_REPS 5
+#define SHA_BENCH_MAX_REPS 1000
+#define SHA_BENCH_SAMPLE_NS 20000.0
+#define SHA_BENCH_CASE_NS 200000000.0
+#define SHA_BENCH_FILE_MIN (64 << 10)
+#define SHA_BENCH_LANES_MAX (16 << 20)
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h> // __rdtsc
+#define sha_bench_ticks() __rdtsc()
+#else
+#define sha_bench_ticks() 0
+#endif
+
+/*
+    --perf adds hardware counters to each case, opened one event at a time so
+    a missing counter only blanks its own column, and scaled by enabled over
+    running time when the kernel multiplexes them. Without a PMU (VMs, or
+    perf_event_paranoid) the report falls back to timing alone.
+*/
+#define SHA_PERF_EVENTS 7
+enum { PERF_CYCLES, PERF_INSTRUCTIONS, PERF_BRANCH_MISSES, PERF_L1D_MISSES, PERF_LLC_MISSES,
+       PERF_FRONTEND_STALLS, PERF_BACKEND_STALLS };
+
+typedef struct {
+  int fd[SHA_PERF_EVENTS]; // -1 if the event couldn't be opened
+  double count[SHA_PERF_EVENTS]; // Per call over the last case, < 0 if not counted
+  int open;
+} SHA_PERF;
+
+int bench_perf = 0;
+SHA_PERF sha_perf;
+
+#ifdef SHA_HAVE_PERF
+void sha_perf_open(SHA_PERF *P) {
+  static const struct { uint32_t type; uint64_t config; } events[SHA_PERF_EVENTS] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+    { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                          (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_FRONTEND },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_STALLED_CYCLES_BACKEND },
+  };
+  struct perf_event_attr attr;
+  int e;
+
+  P->open = 0;
+  for (e = 0; e < SHA_PERF_EVENTS; e++) {
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = events[e].type;
+    attr.config = events[e].config;
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+    P->fd[e] = (int) syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+    P->open += P->fd[e] >= 0;
+  }
+}
+
+void sha_perf_start(SHA_PERF *P) {
+  int e;
+  for (e = 0; e < SHA_PERF_EVENTS; e++) {
+    if (P->fd[e] >= 0) {
+      ioctl(P->fd[e], PERF_EVENT_IOC_RESET, 0);
+      ioctl(P->fd[e], PERF_EVENT_IOC_ENABLE, 0);
+    }
+  }
+}
+
+// Stop counting and keep each count divided by (calls).
+void sha_perf_stop(SHA_PERF *P, double calls) {
+  uint64_t v[3]; // value, time enabled, time running
+  int e;
+  for (e = 0; e < SHA_PERF_EVENTS; e++) {
+    P->count[e] = -1;
+    if (P->fd[e] >= 0) {
+      ioctl(P->fd[e], PERF_EVENT_IOC_DISABLE, 0);
+      if (read(P->fd[e], v, sizeof(v)) == sizeof(v) && v[2] > 0)
+        P->count[e] = (double) v[0] * ((double) v[1] / v[2]) / calls;
+    }
+  }
+}
+
+void sha_perf_close(SHA_PERF *P) {
+  int e;
+  for (e = 0; e < SHA_PERF_EVENTS; e++)
+    if (P->fd[e] >= 0)
+      close(P->fd[e]);
+  P->open = 0;
+}
+#else
+void sha_perf_open(SHA_PERF *P) { P->open = 0; }
+void sha_perf_start(SHA_PERF *P) { (void) P; }
+void sha_perf_stop(SHA_PERF *P, double calls) { int e; (void) calls; for (e = 0; e < SHA_PERF_EVENTS; e++) P->count[e] = -1; }
+void sha_perf_close(SHA_PERF *P) { (void) P; }
+#endif
+
+// x per (per), or -1 when either side wasn't counted.
+double sha_perf_ratio(double x, double per) {
+  return (x >= 0 && per > 0) ? x / per : -1;
+}
+
+// Print a metric to the table and the JSON row, "-" and null if it's missing.
+void sha_perf_metric(FILE *json, const char *name, double x, const char *format, int last) {
+  if (x < 0) {
+    printf(" %8s", "-");
+    fprintf(json, "\"%s\": null%s", name, last ? "" : ", ");
+  } else {
+    printf(format, x);
+    fprintf(json, "\"%s\": %.4f%s", name, x, last ? "" : ", ");
+  }
+}
+
+/*
+    One case to time, (run) hashes (count) messages of (len) bytes once.
+*/
+typedef struct SHA_BENCH {
+  const char *impl;
+  const char *source;
+  void (*run)(struct SHA_BENCH *bench);
+  const BYTE *buf;
+  size_t len;
+  int count;
+  SHA_BLOCKS_FN blocks;
+  SHA_LANES_FN lanes_fn;
+  int lanes;
+  const char *path;
+} SHA_BENCH;
+
+// Somewhere for digests to go so the compiler can't drop the work.
+volatile WORD sha_bench_sink;
+
+double sha_bench_now(void) {
+
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+void sha_bench_backend(SHA_BENCH *bench) {
+
+  SHA256_CTX ctx;
+  BYTE digest[32];
+
+  sha256_init(&ctx);
+  ctx.blocks = bench->blocks;
+  sha256_update(&ctx, bench->buf, bench->len);
+  sha256_final(&ctx, digest);
+  sha_bench_sink = digest[0];
+}
+
+void sha_bench_lanes(SHA_BENCH *bench) {
+
+  WORD out[SHA_MAX_LANES][8];
+
+  sha256_lanes_buffers(bench->lanes_fn, bench->lanes, bench->buf, bench->len, out);
+  sha_bench_sink = out[0][0];
+}
+
+// The single file path of main(), bulk reads and the best backend.
+void sha_bench_file(SHA_BENCH *bench) {
+
+  FILE *infile = fopen(bench->path, "rb");
+  WORD H[8];
+
+  if (!infile)
+    return;
+  sha256_file_with(bench->blocks, infile, H);
+  fclose(infile);
+  sha_bench_sink = H[0];
+}
+
+void sha_bench_tree(SHA_BENCH *bench) {
+
+  BYTE root[32];
+  int fd = open(bench->path, O_RDONLY);
+
+  if (fd < 0)
+    return;
+  sha256_tree(fd, (int) sysconf(_SC_NPROCESSORS_ONLN), root);
+  close(fd);
+  sha_bench_sink = root[0];
+}
+
+int sha_bench_cmp(const void *x, const void *y) {
+
+  double a = *(const double *) x, b = *(const double *) y;
+
+  return (a > b) - (a < b);
+}
+
+/*
+    Warm up, size the samples, time them and report one row.
+*/
+void sha_bench_case(SHA_BENCH *bench, FILE *json, int first, double *tsc_ns, double *tsc_ticks) {
+
+  static double ns[SHA_BENCH_MAX_REPS], ticks[SHA_BENCH_MAX_REPS];
+  double t0, warm, bytes = (double) bench->len * bench->count;
+  uint64_t c0;
+  long inner, i;
+  int reps, r;
+
+  t0 = sha_bench_now();
+  bench->run(bench);
+  warm = sha_bench_now() - t0;
+  if (warm < 1)
+    warm = 1;
+  inner = (warm < SHA_BENCH_SAMPLE_NS) ? (long) (SHA_BENCH_SAMPLE_NS / warm) + 1 : 1;
+  reps = (int) (SHA_BENCH_CASE_NS / (warm * inner));
+  reps = reps < SHA_BENCH_MIN_REPS ? SHA_BENCH_MIN_REPS : reps > SHA_BENCH_MAX_REPS ? SHA_BENCH_MAX_REPS : reps;
+
+  if (sha_perf.open)
+    sha_perf_start(&sha_perf);
+  for (r = 0; r < reps; r++) {
+    t0 = sha_bench_now();
+    c0 = sha_bench_ticks();
+    for (i = 0; i < inner; i++)
+      bench->run(bench);
+    ticks[r] = (double) (sha_bench_ticks() - c0) / inner;
+    ns[r] = (sha_bench_now() - t0) / inner;
+    *tsc_ns += ns[r];
+    *tsc_ticks += ticks[r];
+  }
+  if (sha_perf.open)
+    sha_perf_stop(&sha_perf, (double) reps * inner);
+  qsort(ns, reps, sizeof(double), sha_bench_cmp);
+  qsort(ticks, reps, sizeof(double), sha_bench_cmp);
+
+  double median = ns[reps / 2], p99 = ns[(reps * 99) / 100];
+  double gbps = bytes / median, cpb = bytes > 0 ? ticks[reps / 2] / bytes : 0;
+  double dps = bench->count * 1e9 / median;
+
+  printf("%-14s %-6s %11zu %4d %10.3f %9.2f %12.0f %12.0f %12.0f", bench->impl, bench->source,
+         bench->len, bench->count, gbps, cpb, dps, median, p99);
+  fprintf(json, "%s    {\"impl\": \"%s\", \"source\": \"%s\", \"size\": %zu, \"messages\": %d, "
+                "\"reps\": %d, \"calls_per_rep\": %ld, \"median_ns\": %.1f, \"p99_ns\": %.1f, "
+                "\"gb_per_s\": %.4f, \"cycles_per_byte\": %.4f, \"digests_per_s\": %.1f, \"perf\": ",
+          first ? "" : ",\n", bench->impl, bench->source, bench->len, bench->count,
+          reps, inner, median, p99, gbps, cpb, dps);
+
+  if (sha_perf.open) {
+    const double *n = sha_perf.count, kib = bytes / 1024;
+    fprintf(json, "{");
+    sha_perf_metric(json, "core_cycles_per_byte", sha_perf_ratio(n[PERF_CYCLES], bytes), " %8.2f", 0);
+    sha_perf_metric(json, "ipc", sha_perf_ratio(n[PERF_INSTRUCTIONS], n[PERF_CYCLES]), " %8.2f", 0);
+    sha_perf_metric(json, "branch_misses_per_kib", sha_perf_ratio(n[PERF_BRANCH_MISSES], kib), " %8.2f", 0);
+    sha_perf_metric(json, "l1d_misses_per_kib", sha_perf_ratio(n[PERF_L1D_MISSES], kib), " %8.2f", 0);
+    sha_perf_metric(json, "llc_misses_per_kib", sha_perf_ratio(n[PERF_LLC_MISSES], kib), " %8.3f", 0);
+    sha_perf_metric(json, "frontend_stall_pct", sha_perf_ratio(n[PERF_FRONTEND_STALLS] * 100, n[PERF_CYCLES]), " %7.1f%%", 0);
+    sha_perf_metric(json, "backend_stall_pct", sha_perf_ratio(n[PERF_BACKEND_STALLS] * 100, n[PERF_CYCLES]), " %7.1f%%", 1);
+    fprintf(json, "}}");
+  } else {
+    fprintf(json, "null}");
+  }
+  printf("\n");
+  fflush(stdout);
+}
+
+/*
+    Run the sweep over every size up to (maxsize) bytes.
+*/
+int sha_bench(size_t maxsize, const char *jsonpath) {
+
+  static const size_t sizes[] = {
+    0, 16, 55, 64, 256, 1 << 10, 4 << 10, 64 << 10, 1 << 20, 16 << 20, 256 << 20, 1 << 30
+  };
+  struct {
+    const char *impl;
+    SHA_BLOCKS_FN blocks;
+    int supported;
+  } backends[] = {
+    { "reference", sha256_blocks_scalar, 1 },
+    { "fast",      sha256_blocks_fast,   1 },
+#if defined(__x86_64__) || defined(__i386__)
+    { "ssse3",     sha256_blocks_ssse3,  cpu_has_ssse3() },
+    { "shani",     sha256_blocks_shani,  cpu_has_shani() },
+#endif
+  };
+  struct {
+    const char *impl;
+    SHA_LANES_FN lanes_fn;
+    int lanes;
+    int supported;
+  } kernels[] = {
+    { "lanes-scalar", sha256_x1_scalar,  1,  1 },
+#if defined(__x86_64__) || defined(__i386__)
+    { "lanes-avx2",   sha256_x8_avx2,    8,  __builtin_cpu_supports("avx2") },
+    { "lanes-avx512", sha256_x16_avx512, 16, __builtin_cpu_supports("avx512f") },
+#endif
+  };
+  const int nobackends = sizeof(backends) / sizeof(backends[0]);
+  const int nokernels = sizeof(kernels) / sizeof(kernels[0]);
+  char path[] = "sha-bench-XXXXXX";
+  size_t lanesize = maxsize < SHA_BENCH_LANES_MAX ? maxsize : SHA_BENCH_LANES_MAX;
+  size_t bufsize = SHA_MAX_LANES * (lanesize > 64 ? lanesize : 64), s, i;
+  double tsc_ns = 0, tsc_ticks = 0;
+  int first = 1, fd, k;
+  SHA_BENCH bench;
+  FILE *json;
+  BYTE *buf;
+
+  if (bufsize < maxsize)
+    bufsize = maxsize;
+  buf = aligned_alloc(64, (bufsize + 63) & ~(size_t) 63);
+  json = fopen(jsonpath, "w");
+  if (!buf || !json) {
+    printf("Error: couldn't set up the benchmark.\n");
+    free(buf);
+    if (json)
+      fclose(json);
+    return 1;
+  }
+  for (i = 0; i < bufsize; i++)
+    buf[i] = (BYTE) (i * 2654435761u >> 13);
+
+  if (bench_perf) {
+    sha_perf_open(&sha_perf);
+    if (!sha_perf.open)
+      printf("Hardware counters unavailable (no PMU, or perf_event_paranoid too high), timing only.\n");
+  }
+  fprintf(json, "{\n  \"tool\": \"sha256\",\n  \"format\": 1,\n  \"results\": [\n");
+  printf("%-14s %-6s %11s %4s %10s %9s %12s %12s %12s", "impl", "source", "size", "msgs",
+         "GB/s", "cyc/byte", "digests/s", "median ns", "p99 ns");
+  if (sha_perf.open)
+    printf(" %8s %8s %8s %8s %8s %8s %8s", "core c/B", "IPC", "brm/KiB", "L1D/KiB", "LLC/KiB",
+           "fe stall", "be stall");
+  printf("\n");
+
+  for (s = 0; s < sizeof(sizes) / sizeof(sizes[0]) && sizes[s] <= maxsize; s++) {
+    memset(&bench, 0, sizeof(bench));
+    bench.buf = buf;
+    bench.len = sizes[s];
+    bench.count = 1;
+    bench.source = "memory";
+
+    for (k = 0; k < nobackends; k++) {
+      if (!backends[k].supported)
+        continue;
+      bench.impl = backends[k].impl;
+      bench.blocks = backends[k].blocks;
+      bench.run = sha_bench_backend;
+      sha_bench_case(&bench, json, first, &tsc_ns, &tsc_ticks);
+      first = 0;
+    }
+
+    // One message per lane, (lanes) of them side by side.
+    for (k = 0; k < nokernels && sizes[s] <= SHA_BENCH_LANES_MAX; k++) {
+      if (!kernels[k].supported)
+        continue;
+      bench.impl = kernels[k].impl;
+      bench.lanes_fn = kernels[k].lanes_fn;
+      bench.lanes = bench.count = kernels[k].lanes;
+      bench.run = sha_bench_lanes;
+      sha_bench_case(&bench, json, first, &tsc_ns, &tsc_ticks);
+    }
+    bench.count = 1;
+
+    // The same bytes from a file, read in bulk and as a tree.
+    if (sizes[s] >= SHA_BENCH_FILE_MIN) {
+      fd = mkstemp(path);
+      if (fd < 0 || pwrite(fd, buf, sizes[s], 0) != (ssize_t) sizes[s]) {
+        printf("Error: couldn't write the scratch file %s.\n", path);
+        if (fd >= 0) {
+          close(fd);
+          unlink(path);
+        }
+        fclose(json);
+        free(buf);
+        return 1;
+      }
+      close(fd);
+      bench.path = path;
+      bench.source = "file";
+      bench.blocks = sha256_blocks_kernel();
+      bench.impl = "file-stream";
+      bench.run = sha_bench_file;
+      sha_bench_case(&bench, json, first, &tsc_ns, &tsc_ticks);
+      bench.impl = "file-tree";
+      bench.run = sha_bench_tree;
+      sha_bench_case(&bench, json, first, &tsc_ns, &tsc_ticks);
+      unlink(path);
+      strcpy(path, "sha-bench-XXXXXX");
+    }
+  }
+
+  fprintf(json, "\n  ],\n  \"tsc_ghz\": %.4f,\n  \"perf_events\": %d\n}\n",
+          tsc_ns > 0 ? tsc_ticks / tsc_ns : 0, sha_perf.open);
+  fclose(json);
+  free(buf);
+  sha_perf_close(&sha_perf);
+  printf("Report written to %s\n", jsonpath);
+  return 0;
+}
+
+/*
+    A --bench size limit like 4096, 64K, 16M or 1G.
+*/
+size_t sha_bench_size(const char *arg) {
+
+  char *end;
+  size_t n = (size_t) strtoull(arg, &end, 10);
+
+  switch (*end) {
+    case 'G': case 'g': n <<= 10; /* fall through */
+    case 'M': case 'm': n <<= 10; /* fall through */
+    case 'K': case 'k': n <<= 10; break;
+    default: break;
+  }
+  return n;
+}
+
+// ------------------------- Resumable Hashing -------------------------
+
+/*
+    --state <file> keeps the context between runs, so hashing an append only
+    file again reads just the bytes added since, and a long hash saves its
+    state every SHA_STATE_CHECKPOINT bytes to carry on after a crash. The file
+    holds sha256_export() then the device and inode hashed. A state for some
+    other file, or for more bytes than the file has now, is ignored and the
+    file hashed from the start. Only for files that are appended to, a file
+    rewritten in place without shrinking looks the same.
+*/
+#define SHA_STATE_CHECKPOINT ((uint64_t) 1 << 30)
+
+/*
+    Write (ctx) for the file (st) to (statepath) by way of a temporary file,
+    so a crash mid write leaves the previous state intact.
+*/
+int sha_state_save(const char *statepath, const SHA256_CTX *ctx, const struct stat *st) {
+
+  BYTE out[SHA_STATE_SIZE + 16];
+  uint64_t dev = htobe64((uint64_t) st->st_dev), ino = htobe64((uint64_t) st->st_ino);
+  size_t len = strlen(statepath) + sizeof(".XXXXXX");
+  char *tmp = malloc(len);
+  FILE *f = NULL;
+  int fd, ok;
+
+  sha256_export(ctx, out);
+  memcpy(out + SHA_STATE_SIZE, &dev, 8);
+  memcpy(out + SHA_STATE_SIZE + 8, &ino, 8);
+
+  snprintf(tmp, len, "%s.XXXXXX", statepath);
+  fd = mkstemp(tmp);
+  if (fd >= 0 && !(f = fdopen(fd, "wb")))
+    close(fd);
+  ok = f && fwrite(out, sizeof(out), 1, f) == 1 && fflush(f) == 0 && fsync(fd) == 0;
+  if (f)
+    ok = fclose(f) == 0 && ok;
+  ok = ok && rename(tmp, statepath) == 0;
+  if (!ok && fd >= 0)
+    unlink(tmp);
+  free(tmp);
+  return ok;
+}
+
+/*
+    Load the state in (statepath) into (ctx) if it belongs to the file (st).
+*/
+int sha_state_load(const char *statepath, SHA256_CTX *ctx, const struct stat *st) {
+
+  BYTE in[SHA_STATE_SIZE + 16];
+  uint64_t dev, ino;
+  FILE *f = fopen(statepath, "rb");
+  int ok;
+
+  if (!f)
+    return 0;
+  ok = fread(in, sizeof(in), 1, f) == 1 && sha256_import(ctx, in);
+  fclose(f);
+  if (!ok)
+    return 0;
+  memcpy(&dev, in + SHA_STATE_SIZE, 8);
+  memcpy(&ino, in + SHA_STATE_SIZE + 8, 8);
+  return be64toh(dev) == (uint64_t) st->st_dev && be64toh(ino) == (uint64_t) st->st_ino &&
+         ctx->nobytes <= (uint64_t) st->st_size;
+}
+
+/*
+    Hash (name) carrying on from (statepath), save the state for next time
+    and print the digest.
+*/
+int main_resume(const char *name, const char *statepath) {
+
+  static BYTE buf[SHA_BUFBLOCKS * 64];
+  SHA256_CTX ctx, fin;
+  struct stat st;
+  BYTE digest[32];
+  uint64_t checkpoint;
+  ssize_t n = 0;
+  int i, fd = open(name, O_RDONLY);
+
+  if (fd < 0 || fstat(fd, &st) != 0) {
+    printf("Error: couldn't open file %s.\n", name);
+    if (fd >= 0)
+      close(fd);
+    return 1;
+  }
+  if (!sha_state_load(statepath, &ctx, &st))
+    sha256_init(&ctx);
+
+  // Only what's past the saved length is read.
+  checkpoint = ctx.nobytes + SHA_STATE_CHECKPOINT;
+  for (;;) {
+    n = pread(fd, buf, sizeof(buf), (off_t) ctx.nobytes);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      break;
+    sha256_update(&ctx, buf, (size_t) n);
+    if (ctx.nobytes >= checkpoint) {
+      sha_state_save(statepath, &ctx, &st);
+      checkpoint = ctx.nobytes + SHA_STATE_CHECKPOINT;
+    }
+  }
+  close(fd);
+  if (n < 0 || !sha_state_save(statepath, &ctx, &st)) {
+    printf("Error: couldn't hash file %s or save its state to %s.\n", name, statepath);
+    return 1;
+  }
+
+  // Pad a copy, the saved state is the unpadded one.
+  fin = ctx;
+  sha256_final(&fin, digest);
+  for (i = 0; i < 32; i++)
+    printf("%02x", digest[i]);
+  printf("  %s\n", name);
+  return 0;
+}
+
+// ------------------------- Check a Manifest --------------------------
+
+/*
+    --check <manifest> verifies the files a sha256sum manifest lists, as
+    "digest  path" (or "digest *path"), with sha256sum's backslash escapes for
+    names holding line breaks, or as "SHA256 (path) = digest". Digests are
+    decoded to 32 bytes when the manifest is read and each worker thread takes
+    the next entry from a shared counter, printing "path: OK" or "path: FAILED"
+    as soon as it knows. --fail-fast stops every worker at the first failure,
+    including part way through a file.
+*/
+typedef struct {
+  char *path;
+  BYTE expect[32];
+  atomic_int result; // 0 not checked, 1 matched, -1 failed
+} SHA_CHECK_ENTRY;
+
+typedef struct {
+  SHA_CHECK_ENTRY *entries;
+  size_t n;
+  _Atomic size_t next;
+  atomic_int stop;
+  int fail_fast;
+} SHA_CHECK;
+
+// 32 bytes from 64 hex digits, 0 if they aren't all hex.
+int sha_unhex(const char *hex, BYTE out[32]) {
+
+  int i, hi, lo;
+
+  for (i = 0; i < 32; i++) {
+    hi = hex[2 * i] | 0x20;
+    lo = hex[2 * i + 1] | 0x20;
+    hi = (hi >= '0' && hi <= '9') ? hi - '0' : (hi >= 'a' && hi <= 'f') ? hi - 'a' + 10 : -1;
+    lo = (lo >= '0' && lo <= '9') ? lo - '0' : (lo >= 'a' && lo <= 'f') ? lo - 'a' + 10 : -1;
+    if (hi < 0 || lo < 0)
+      return 0;
+    out[i] = (BYTE) (hi << 4 | lo);
+  }
+  return 1;
+}
+
+/*
+    The path of one manifest line, freshly allocated, with its digest in
+    (expect). NULL if the line is in neither format.
+*/
+char *sha_check_parse(char *line, BYTE expect[32]) {
+
+  int escaped = line[0] == '\\';
+  size_t len;
+  char *name, *r, *w;
+
+  line += escaped;
+  len = strlen(line);
+  if (strncmp(line, "SHA256 (", 8) == 0 && len > 8 + 4 + 64 && strncmp(line + len - 68, ") = ", 4) == 0) {
+    if (!sha_unhex(line + len - 64, expect))
+      return NULL;
+    line[len - 68] = '\0';
+    name = line + 8;
+  } else if (len > 66 && line[64] == ' ' && (line[65] == ' ' || line[65] == '*') && sha_unhex(line, expect)) {
+    name = line + 66;
+  } else {
+    return NULL;
+  }
+
+  name = strdup(name);
+  if (escaped) {
+    for (r = w = name; *r; ) {
+      if (*r == '\\' && (r[1] == '\\' || r[1] == 'n' || r[1] == 'r')) {
+        *w++ = (r[1] == 'n') ? '\n' : (r[1] == 'r') ? '\r' : '\\';
+        r += 2;
+      } else {
+        *w++ = *r++;
+      }
+    }
+    *w = '\0';
+  }
+  return name;
+}
+
+// Print "path: result" in one call, escaping a path with a line break like sha256sum.
+void sha_check_report(const char *path, const char *result) {
+
+  char *line = malloc(2 * strlen(path) + strlen(result) + 4), *w = line;
+  const char *r;
+
+  if (strpbrk(path, "\n\r")) {
+    *w++ = '\\';
+    for (r = path; *r; r++) {
+      if (*r == '\\' || *r == '\n' || *r == '\r') {
+        *w++ = '\\';
+        *w++ = (*r == '\n') ? 'n' : (*r == '\r') ? 'r' : '\\';
+      } else {
+        *w++ = *r;
+      }
+    }
+  } else {
+    strcpy(w, path);
+    w += strlen(path);
+  }
+  sprintf(w, ": %s\n", result);
+  fputs(line, stdout);
+  // Failures show up in a log or pipe as they happen, not at exit.
+  if (strcmp(result, "OK") != 0)
+    fflush(stdout);
+  free(line);
+}
+
+void *sha_check_worker(void *arg) {
+
+  SHA_CHECK *C = arg;
+  BYTE *buf = malloc(SHA_BUFBLOCKS * 64);
+  BYTE digest[32];
+  SHA256_CTX ctx;
+  size_t i;
+  ssize_t n;
+  int fd, ok, stopped = 0;
+
+  if (!buf)
+    return NULL;
+
+  while (!atomic_load(&C->stop) && (i = atomic_fetch_add(&C->next, 1)) < C->n) {
+    SHA_CHECK_ENTRY *e = &C->entries[i];
+
+    n = -1;
+    fd = open(e->path, O_RDONLY);
+    if (fd >= 0) {
+      posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+      sha256_init(&ctx);
+      for (;;) {
+        if (atomic_load_explicit(&C->stop, memory_order_relaxed)) {
+          stopped = 1;
+          break;
+        }
+        n = read(fd, buf, SHA_BUFBLOCKS * 64);
+        if (n < 0 && errno == EINTR)
+          continue;
+        if (n <= 0)
+          break;
+        sha256_update(&ctx, buf, (size_t) n);
+      }
+      close(fd);
+    }
+    // Cut short by --fail-fast, even before the first read, this file's result is unknown.
+    if (stopped)
+      break;
+
+    ok = n == 0;
+    if (ok) {
+      sha256_final(&ctx, digest);
+      ok = memcmp(digest, e->expect, 32) == 0;
+    }
+    atomic_store(&e->result, ok ? 1 : -1);
+    sha_check_report(e->path, ok ? "OK" : (n == 0) ? "FAILED" : "FAILED open or read");
+    if (!ok && C->fail_fast)
+      atomic_store(&C->stop, 1);
+  }
+
+  free(buf);
+  return NULL;
+}
+
+/*
+    Verify every file listed in the manifest (name) on (nothreads) threads,
+    "-" for standard input. Returns the exit code.
+*/
+int main_check(const char *name, int nothreads, int fail_fast) {
+
+  SHA_CHECK C = { NULL, 0, 0, 0, fail_fast };
+  FILE *manifest = (strcmp(name, "-") == 0) ? stdin : fopen(name, "r");
+  pthread_t *threads;
+  SHA_CHECK_ENTRY *grown;
+  size_t cap = 0, improper = 0, lines = 0, failed = 0, unchecked = 0, i, len = 0;
+  char *line = NULL, *path;
+  ssize_t got;
+  int t, started = 0;
+
+  if (!manifest) {
+    printf("Error: couldn't open file %s.\n", name);
+    return 1;
+  }
+  while ((got = getline(&line, &len, manifest)) >= 0) {
+    while (got > 0 && (line[got - 1] == '\n' || line[got - 1] == '\r'))
+      line[--got] = '\0';
+    lines++;
+    if (C.n == cap) {
+      cap = cap ? cap * 2 : 256;
+      if (!(grown = realloc(C.entries, cap * sizeof(SHA_CHECK_ENTRY)))) {
+        printf("Error: out of memory reading %s.\n", name);
+        for (i = 0; i < C.n; i++)
+          free(C.entries[i].path);
+        free(C.entries);
+        free(line);
+        if (manifest != stdin)
+          fclose(manifest);
+        return 1;
+      }
+      C.entries = grown;
+    }
+    if ((path = sha_check_parse(line, C.entries[C.n].expect)) != NULL) {
+      C.entries[C.n].path = path;
+      atomic_init(&C.entries[C.n].result, 0);
+      C.n++;
+    } else if (line[0] != '\0' && line[0] != '#') {
+      improper++;
+    }
+  }
+  free(line);
+  if (manifest != stdin)
+    fclose(manifest);
+  if (improper)
+    fprintf(stderr, "Warning: %zu of %zu lines aren't properly formatted SHA-256 checksum lines.\n", improper, lines);
+
+  if (nothreads < 1)
+    nothreads = 1;
+  threads = malloc(nothreads * sizeof(pthread_t));
+
+  // This thread checks files too, so only the threads that did start are joined.
+  for (t = 1; threads && t < nothreads; t++)
+    if (pthread_create(&threads[started], NULL, sha_check_worker, &C) == 0)
+      started++;
+  sha_check_worker(&C);
+  for (t = 0; t < started; t++)
+    pthread_join(threads[t], NULL);
+  free(threads);
+
+  for (i = 0; i < C.n; i++) {
+    failed += atomic_load(&C.entries[i].result) < 0;
+    unchecked += atomic_load(&C.entries[i].result) == 0;
+    free(C.entries[i].path);
+  }
+  if (failed)
+    fprintf(stderr, "Warning: %zu of %zu files did NOT match.\n", failed, C.n);
+  if (unchecked)
+    fprintf(stderr, "Stopped after the first failure, %zu files not checked.\n", unchecked);
+  free(C.entries);
+  return (failed || (improper && !C.n)) ? 1 : 0;
+}
+
+/*
+    All of a small file (a key, a password, a salt) in memory, NULL if it
+    can't be read. Secrets come from files so they never show up in the
+    process list.
+*/
+BYTE *sha_read_file(const char *path, size_t *len) {
+
+  FILE *f = fopen(path, "rb");
+  size_t cap = 256, got;
+  BYTE *data;
+
+  if (!f)
+    return NULL;
+  data = malloc(cap);
+  *len = 0;
+  while (data && (got = fread(data + *len, 1, cap - *len, f)) > 0) {
+    *len += got;
+    if (*len == cap) {
+      BYTE *grown = realloc(data, cap *= 2);
+      if (!grown) {
+        memset(data, 0, *len);
+        free(data);
+      }
+      data = grown;
+    }
+  }
+  if (data && ferror(f)) {
+    memset(data, 0, *len);
+    free(data);
+    data = NULL;
+  }
+  fclose(f);
+  return data;
+}
+
+/*
+    Files no bigger than this are read whole by main_hmac() and go through
+    sha256_hmac_lanes() together, bigger ones are streamed one at a time.
+*/
+#define SHA_HMAC_LANE_FILE (64 << 10)
+
+/*
+    HMAC-SHA256 of every file named under the key in (keypath), printed
+    like sha256sum. Without SHA-NI the small files are queued a few per
+    lane and run through the lane kernels, as sha256_multi() does for
+    plain digests.
+*/
+int main_hmac(const char *keypath, int n, char *names[]) {
+
+  static BYTE buf[SHA_BUFBLOCKS * 64];
+  SHA_HMAC_KEY K;
+  SHA256_CTX ctx;
+  SHA_RECORD R[4 * SHA_MAX_LANES];
+  int queued[4 * SHA_MAX_LANES];
+  WORD H[4 * SHA_MAX_LANES][8];
+  WORD (*out)[8] = malloc(n * sizeof(*out));
+  char *status = calloc(n, 1);
+  BYTE *key, *small = NULL, digest[32];
+  size_t keylen, got;
+  FILE *f;
+  int lanes, shani = 0, batch = 0, nq = 0, i, j, failed = 0;
+  SHA_LANES_FN kernel = sha256_lanes_kernel(&lanes);
+
+#if defined(__x86_64__) || defined(__i386__)
+  shani = cpu_has_shani();
+#endif
+  if (lanes > 1 && !shani) {
+    batch = 4 * lanes;
+    small = malloc((size_t) batch * SHA_HMAC_LANE_FILE);
+  }
+  if (!out || !status || (batch && !small)) {
+    printf("Error: out of memory.\n");
+    free(out);
+    free(status);
+    free(small);
+    return 1;
+  }
+  if (!(key = sha_read_file(keypath, &keylen))) {
+    printf("Error: couldn't read key file %s.\n", keypath);
+    free(out);
+    free(status);
+    free(small);
+    return 1;
+  }
+  sha256_hmac_key(&K, key, keylen);
+  memset(key, 0, keylen);
+  free(key);
+
+  for (i = 0; ; i++) {
+    // A full queue, or what's left of one at the end, goes through the lanes.
+    if (nq && (nq == batch || i == n)) {
+      sha256_hmac_lanes(kernel, lanes, &K, R, nq, H);
+      for (j = 0; j < nq; j++)
+        memcpy(out[queued[j]], H[j], sizeof(H[j]));
+      nq = 0;
+    }
+    if (i == n)
+      break;
+
+    if (!(f = fopen(names[i], "rb"))) {
+      status[i] = 1;
+      continue;
+    }
+    got = 0;
+    if (batch) {
+      got = fread(small + (size_t) nq * SHA_HMAC_LANE_FILE, 1, SHA_HMAC_LANE_FILE, f);
+      if (got < SHA_HMAC_LANE_FILE && feof(f)) {
+        R[nq].p = small + (size_t) nq * SHA_HMAC_LANE_FILE;
+        R[nq].len = got;
+        queued[nq++] = i;
+        fclose(f);
+        continue;
+      }
+    }
+    sha256_hmac_init(&ctx, &K);
+    if (got)
+      sha256_update(&ctx, small + (size_t) nq * SHA_HMAC_LANE_FILE, got);
+    while (!ferror(f) && (got = fread(buf, 1, sizeof(buf), f)) > 0)
+      sha256_update(&ctx, buf, got);
+    if (ferror(f))
+      status[i] = 2;
+    fclose(f);
+    sha256_hmac_final(&ctx, &K, digest);
+    for (j = 0; j < 8; j++)
+      out[i][j] = LOAD_BE32(digest + 4 * j);
+  }
+
+  for (i = 0; i < n; i++) {
+    if (status[i] == 1)
+      printf("Error: couldn't open file %s.\n", names[i]);
+    else if (status[i] == 2)
+      printf("Error: couldn't read file %s.\n", names[i]);
+    if (status[i]) {
+      failed = 1;
+      continue;
+    }
+    for (j = 0; j < 8; j++)
+      printf("%08" PRIx32 "", out[i][j]);
+    printf("  %s\n", names[i]);
+  }
+
+  free(small);
+  free(status);
+  free(out);
+  return failed;
+}
+
+/*
+    PBKDF2-HMAC-SHA256 with the salt in (saltpath) of the password in each
+    file named, (dklen) bytes of key for each printed like sha256sum. Every
+    password is derived together so their blocks share the lanes.
+*/
+int main_pbkdf2(uint32_t iterations, const char *saltpath, size_t dklen, int n, char *names[]) {
+
+  SHA_PBKDF2_JOB *jobs = calloc(n, sizeof(SHA_PBKDF2_JOB));
+  BYTE *salt;
+  size_t saltlen, b;
+  int i, failed = 0;
+
+  if (!jobs) {
+    printf("Error: out of memory.\n");
+    return 1;
+  }
+  if (!(salt = sha_read_file(saltpath, &saltlen))) {
+    printf("Error: couldn't read salt file %s.\n", saltpath);
+    free(jobs);
+    return 1;
+  }
+  for (i = 0; i < n; i++) {
+    jobs[i].salt = salt;
+    jobs[i].saltlen = saltlen;
+    if (!(jobs[i].pass = sha_read_file(names[i], &jobs[i].passlen))) {
+      printf("Error: couldn't open file %s.\n", names[i]);
+      failed = 1;
+      continue;
+    }
+    if (!(jobs[i].out = malloc(dklen))) {
+      printf("Error: out of memory for a %zu byte key for %s.\n", dklen, names[i]);
+      memset((BYTE *) jobs[i].pass, 0, jobs[i].passlen);
+      free((BYTE *) jobs[i].pass);
+      jobs[i].pass = NULL;
+      failed = 1;
+      continue;
+    }
+    jobs[i].outlen = dklen;
+  }
+
+  sha256_pbkdf2_many(jobs, n, iterations);
+
+  for (i = 0; i < n; i++) {
+    if (!jobs[i].pass)
+      continue;
+    for (b = 0; b < dklen; b++)
+      printf("%02x", jobs[i].out[b]);
+    printf("  %s\n", names[i]);
+    memset((BYTE *) jobs[i].pass, 0, jobs[i].passlen);
+    free((BYTE *) jobs[i].pass);
+    free(jobs[i].out);
+  }
+  free(salt);
+  free(jobs);
+  return failed;
+}
+
+uint64_t swap_endian(uint64_t x) {
+    uint64_t mask[8];
+    mask[0] = 0xff;
+    for(int i = 0; i < 8; i++) {
+        mask[i] = mask[0] << (8 * i);
+    }
+
+    uint64_t y = 
+       (x >> 56) & mask[0]
+    ^ ((x >> 40) & mask[1])     
+    ^ ((x >> 24) & mask[2])
+    ^ ((x >> 8)  & mask[3])
+    ^ ((x << 24) & mask[4])
+    ^ ((x << 16) & mask[5])
+    ^ ((x << 8)  & mask[6])
+    ^ ((x << 48) & mask[7]);
+
+    return y;
+}
+
+/*
+    Hash every file named on the command line, printing each digest
+    followed by the filename like sha256sum does. A file that can't be
+    opened or read is reported in its place and the rest are still hashed.
+*/
+int main_multi(int n, char *names[]) {
+
+  WORD (*out)[8] = malloc(n * sizeof(*out));
+  char *failed = malloc(n);
+  int i, j, nfailed;
+
+  nfailed = sha256_multi(names, n, out, failed);
+
+  for (i = 0; i < n; i++) {
+    if (failed[i]) {
+      printf("Error: couldn't read file %s.\n", names[i]);
+      continue;
+    }
+    for (j = 0; j < 8; j++)
+      printf("%08" PRIx32 "", out[i][j]);
+    printf("  %s\n", names[i]);
+  }
+
+  free(failed);
+  free(out);
+  return nfailed != 0;
+}
+
+// Built with -DSHA_NO_MAIN the functions above can be linked into another program.
+#ifndef SHA_NO_MAIN
+int main(int argc, char *argv[]) {
+
+  // Options come before the filenames: --tree, --threads <n>, --bench[=max size], --json <path>, --perf, --state <file>,
+  // --check <manifest>, --fail-fast, --hmac <keyfile>, --pbkdf2 <iterations>, --salt <file>, --dklen <bytes>.
+  int tree = 0, nothreads = (int) sysconf(_SC_NPROCESSORS_ONLN);
+  int argi = 1, bench = 0;
+  size_t benchmax = (size_t) 1 << 30;
+  const char *jsonpath = "bench-sha256.json";
+  const char *statepath = NULL;
+  const char *manifest = NULL;
+  const char *hmacpath = NULL;
+  const char *saltpath = NULL;
+  uint32_t iterations = 0;
+  size_t dklen = 32;
+  int pbkdf2 = 0, fail_fast = 0;
+  char *end;
+
+  while (argi < argc && strncmp(argv[argi], "--", 2) == 0) {
+    if (strcmp(argv[argi], "--tree") == 0) {
+      tree = 1;
+    } else if (strcmp(argv[argi], "--threads") == 0 && argi + 1 < argc) {
+      nothreads = atoi(argv[++argi]);
+    } else if (strcmp(argv[argi], "--bench") == 0 || strncmp(argv[argi], "--bench=", 8) == 0) {
+      bench = 1;
+      if (argv[argi][7] == '=')
+        benchmax = sha_bench_size(argv[argi] + 8);
+    } else if (strcmp(argv[argi], "--json") == 0 && argi + 1 < argc) {
+      jsonpath = argv[++argi];
+    } else if (strcmp(argv[argi], "--perf") == 0) {
+      bench_perf = 1;
+    } else if (strcmp(argv[argi], "--state") == 0 && argi + 1 < argc) {
+      statepath = argv[++argi];
+    } else if (strcmp(argv[argi], "--check") == 0 && argi + 1 < argc) {
+      manifest = argv[++argi];
+    } else if (strcmp(argv[argi], "--fail-fast") == 0) {
+      fail_fast = 1;
+    } else if (strcmp(argv[argi], "--hmac") == 0 && argi + 1 < argc) {
+      hmacpath = argv[++argi];
+    } else if (strcmp(argv[argi], "--pbkdf2") == 0 && argi + 1 < argc) {
+      unsigned long count = strtoul(argv[++argi], &end, 10);
+      pbkdf2 = 1;
+      iterations = (*end || end == argv[argi] || count > UINT32_MAX) ? 0 : (uint32_t) count;
+    } else if (strcmp(argv[argi], "--salt") == 0 && argi + 1 < argc) {
+      saltpath = argv[++argi];
+    } else if (strcmp(argv[argi], "--dklen") == 0 && argi + 1 < argc) {
+      unsigned long long len = strtoull(argv[++argi], &end, 10);
+      dklen = (*end || end == argv[argi] || len > SHA_PBKDF2_MAX_DKLEN || len > SIZE_MAX) ? 0 : (size_t) len;
+    } else {
+      printf("Error: unknown option %s.\n", argv[argi]);
+      return 1;
+    }
+    argi++;
+  }
+  // Drop the options, argv[1] is the first filename from here on.
+  argc -= argi - 1;
+  argv += argi - 1;
+
+  if (bench)
+    return sha_bench(benchmax, jsonpath);
+
+  if (manifest)
+    return main_check(manifest, nothreads, fail_fast);
+
+  // Expect at least one filename.
+  if (argc < 2) {
+    printf("Error: expected a filename as argument.\n");
+    return 1;
+  }
+
+  if (tree)
+    return main_tree(argc - 1, argv + 1, nothreads);
+
+  if (hmacpath)
+    return main_hmac(hmacpath, argc - 1, argv + 1);
+
+  if (pbkdf2) {
+    if (!iterations) {
+      printf("Error: --pbkdf2 needs a number of iterations from 1 to %u.\n", (unsigned) UINT32_MAX);
+      return 1;
+    }
+    if (!saltpath || dklen < 1) {
+      printf("Error: --pbkdf2 needs a --salt file and a --dklen from 1 to %llu.\n",
+             (unsigned long long) SHA_PBKDF2_MAX_DKLEN);
+      return 1;
+    }
+    return main_pbkdf2(iterations, saltpath, dklen, argc - 1, argv + 1);
+  }
+
+  // One file, picking up where the last run left off.
+  if (statepath) {
+    if (argc > 2) {
+      printf("Error: --state takes a single file.\n");
+      return 1;
+    }
+    return main_resume(argv[1], statepath);
+  }
+
+  // Several files are hashed side by side in SIMD lanes, one digest per line.
+  if (argc > 2)
+    return main_multi(argc - 1, argv + 1);
+
+  FILE *infile = fopen(argv[1], "rb");
+  if (!infile) {
+    printf("Error: couldn't open file %s.\n", argv[1]);
+    return 1;
+  }
+
+  // Section 5.3.3, raw message blocks read and compressed many at a time.
+  WORD H[8];
+  if (!sha256_file_with(sha256_blocks_kernel(), infile, H)) {
+    printf("Error: couldn't read file %s.\n", argv[1]);
+    fclose(infile);
+    return 1;
+  }
+
+  // Print the hash.
+  for (int i = 0; i < 8; i++)
+    printf("%08" PRIx32 "", H[i]);
+  printf("\n");
+
+  fclose(infile);
+
+  return 0;
+}
+#endif